@@ -0,0 +1,71 @@
+#ifndef _ADMISSION_CONTROLLER_H_
+#define _ADMISSION_CONTROLLER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+// A limit of 0 disables the corresponding check
+struct AdmissionLimits
+{
+    uint64_t MaxJobs = 0;
+    int64_t MaxQueuedFrames = 0;
+    // Busy fraction of all cpus, 0.9 refuses new jobs above 90% utilisation
+    double MaxCpuUtilisation = 0.0;
+    uint64_t MaxP99LatencyUs = 0;
+};
+
+/*!
+    Decides on Start whether this processing unit can take another job, based on
+    the live signals of LoadMonitor. A refused job gets Ready(false, reason) so the
+    VMS can place it on another unit instead of overloading this one.
+
+    {"maxJobs": 16, "maxQueuedFrames": 256, "maxCpuUtilisation": 0.9, "maxP99LatencyUs": 50000}
+*/
+class AdmissionController
+{
+public:
+    static void SetLimits(const json &Limits);
+    static AdmissionLimits GetLimits();
+
+    /*!
+        True when a new job fits and reserves its place, otherwise Reason tells which
+        limit would be exceeded. An admitted Start calls Confirm once its job counts as
+        active in LoadMonitor, or Withdraw when creating the job failed.
+    */
+    static bool Admit(std::string &Reason);
+    static void Confirm();
+    static void Withdraw();
+    // Same check without counting it as an admission decision
+    static bool WouldAdmit(std::string &Reason);
+    // Headroom left under each configured limit, for the VMS to place jobs on
+    static json GetCapacity();
+
+    static json GetStats();
+
+private:
+    AdmissionController() : m_Reserved(0), m_Admitted(0), m_Rejected(0) {}
+
+    // Reserved counts the admitted jobs not active yet, the new one included
+    static bool Check(std::string &Reason, uint64_t Reserved);
+
+    static AdmissionController &getInstance()
+    {
+        static AdmissionController instance;
+        return instance;
+    }
+
+    std::mutex m_Mutex;
+    AdmissionLimits m_Limits;
+    std::atomic<uint64_t> m_Reserved;
+    std::atomic<uint64_t> m_Admitted;
+    std::atomic<uint64_t> m_Rejected;
+    std::string m_LastRejection;
+};
+} // namespace ProcessingUnit
+#endif // _ADMISSION_CONTROLLER_H_
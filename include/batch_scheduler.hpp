@@ -0,0 +1,92 @@
+#ifndef _BATCH_SCHEDULER_H_
+#define _BATCH_SCHEDULER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "observable.hpp"
+#include "processor.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Collects frames of all jobs that share the same processor / config key and runs
+    them as one IProcessor::ProcessBatch call. A batch is flushed when it is full or
+    when its oldest frame waited longer than the maximum wait time.
+
+    Enabled per job through the Start info:
+    "processor": "detector",
+    "batching": { "maxBatchSize": 8, "maxWaitMs": 5, "key": "optional explicit key" }
+*/
+struct BatchSettings
+{
+    std::size_t MaxBatchSize = 8;
+    std::chrono::microseconds MaxWait = std::chrono::microseconds(5000);
+};
+
+class BatchScheduler
+{
+public:
+    typedef std::function<void(DataPtr &Result)> ResultCallback;
+
+    BatchScheduler(const std::string &Key, std::shared_ptr<IProcessor> Processor, const BatchSettings &Settings);
+    ~BatchScheduler();
+    BatchScheduler(const BatchScheduler &) = delete;
+    BatchScheduler &operator=(const BatchScheduler &) = delete;
+
+    // Queue a frame, Callback is called from the scheduler thread with the result of this frame
+    void Submit(DataPtr &Data, ResultCallback Callback);
+
+    std::string GetKey() const { return m_Key; }
+    json GetStats() const;
+
+    // True when the Start info asks for batching and the requested processor is registered
+    static bool IsRequested(const json &Config);
+    // Shared scheduler for the key of this Start info, created on first use, throws when its processor can't be created
+    static std::shared_ptr<BatchScheduler> Acquire(const json &Config);
+    static json GetAllStats();
+
+private:
+    struct PendingFrame
+    {
+        DataPtr Data;
+        ResultCallback Callback;
+        std::chrono::steady_clock::time_point Enqueued;
+    };
+
+    void Run();
+    void RunBatch(std::deque<PendingFrame> &Batch);
+
+    static std::string MakeKey(const json &Config);
+    static BatchSettings ReadSettings(const json &Config);
+
+    const std::string m_Key;
+    std::shared_ptr<IProcessor> m_Processor;
+    const BatchSettings m_Settings;
+
+    std::mutex m_QueueProtector;
+    std::condition_variable m_ConVarQueue;
+    std::deque<PendingFrame> m_Queue;
+    bool m_isStopSignaled = false;
+    std::thread m_BatchThread;
+
+    std::atomic<uint64_t> m_Batches;
+    std::atomic<uint64_t> m_Frames;
+    std::atomic<uint64_t> m_TotalQueueDelayUs;
+    std::atomic<uint64_t> m_MaxQueueDelayUs;
+    std::atomic<uint64_t> m_TotalProcessUs;
+
+    static std::mutex s_RegistryMutex;
+    static std::map<std::string, std::weak_ptr<BatchScheduler>> s_Registry;
+};
+} // namespace ProcessingUnit
+#endif // _BATCH_SCHEDULER_H_
@@ -0,0 +1,56 @@
+#ifndef _CAPTURE_READER_H_
+#define _CAPTURE_READER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "stream_recorder.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Read-only view on a capture file written by StreamRecorder. The file is memory
+    mapped, frames point straight into the mapping and stay valid until Close.
+    Every frame of the index lies within the file, a corrupt index is ignored and
+    the records are scanned instead.
+*/
+struct CaptureFrame
+{
+    const CaptureRecordHeader *Header = nullptr;
+    const char *Data = nullptr; // msgpack frame, Header->Size bytes
+};
+
+class CaptureReader
+{
+public:
+    CaptureReader() {}
+    ~CaptureReader();
+    CaptureReader(const CaptureReader &) = delete;
+    CaptureReader &operator=(const CaptureReader &) = delete;
+
+    bool Open(const std::string &FilePath);
+    void Close();
+
+    std::string GetJobId() const;
+    uint64_t GetStartTimeNs() const;
+    std::size_t GetFrameCount() const { return m_Offsets.size(); }
+    // True when the index came from the trailer, false when it was rebuilt by scanning
+    bool HasIndex() const { return m_HasIndex; }
+
+    CaptureFrame GetFrame(std::size_t FrameNr) const;
+
+private:
+    bool ReadIndex();
+    void ScanRecords();
+
+    const char *m_Data = nullptr;
+    std::size_t m_Size = 0;
+#ifdef _WIN32
+    std::vector<char> m_FileContents;
+#endif
+    bool m_HasIndex = false;
+    std::vector<uint64_t> m_Offsets;
+};
+} // namespace ProcessingUnit
+#endif // _CAPTURE_READER_H_
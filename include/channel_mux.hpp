@@ -0,0 +1,65 @@
+#ifndef _CHANNEL_MUX_H_
+#define _CHANNEL_MUX_H_
+
+#include <server_ws.hpp>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "job_connection.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Runs many jobs over one websocket. Every message carries the channel it belongs to
+    in its info, each channel is a JobConnection with its own job, flow control and
+    memory account. One output thread per socket serves all channels round robin, so
+    a client with many streams doesn't cost a socket and two threads per stream.
+*/
+class ChannelMux
+{
+public:
+    // Clients ask for it when connecting: ws://host:port/?multiplex=1
+    static bool IsRequested(const std::string &QueryString);
+
+    explicit ChannelMux(ConnectionPtr Conn);
+    ~ChannelMux();
+
+    // Parses the message once and hands it to its channel, a Start opens the channel
+    void OnMessage(std::shared_ptr<WsServer::Message> Message);
+
+    json GetStats();
+    // Load of the channels from lock free counters, takes the channel lock only
+    json GetLoad();
+    // Builds the reply to a Stats request, a channel isn't needed to ask for it
+    void SetStatsProvider(std::function<json()> Provider) { m_StatsProvider = Provider; }
+
+private:
+    void Output();
+    // Sends at most one message per channel, true when any channel sent
+    bool PumpChannels();
+    void Wake();
+
+    ConnectionPtr m_Connection;
+    std::function<json()> m_StatsProvider;
+    // Shared by all channels: the high water marks are the socket's, not a job's
+    std::shared_ptr<SendQueueState> m_SendState = std::make_shared<SendQueueState>();
+    std::size_t m_SendHighWaterBytes;
+    std::size_t m_SendHighWaterMessages;
+
+    std::mutex m_ChannelsMutex;
+    // Messages are dispatched to a channel outside the lock, they hold it meanwhile
+    std::map<std::string, std::shared_ptr<JobConnection>> m_Channels;
+    uint64_t m_OpenedChannels = 0;
+    std::atomic<uint64_t> m_ChannelErrors{0};
+
+    // Guarded by m_SendState->Mutex, the output thread waits on its ConVarDrained
+    bool m_OutputPending = false;
+    bool m_Stop = false;
+    std::thread m_OutputThread;
+};
+} // namespace ProcessingUnit
+#endif // _CHANNEL_MUX_H_
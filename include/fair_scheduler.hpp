@@ -0,0 +1,108 @@
+#ifndef _FAIR_SCHEDULER_H_
+#define _FAIR_SCHEDULER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Shares processor time between jobs by weight once the machine is saturated.
+
+    A job holds one of the processing slots while its processor works on a frame.
+    As long as slots are free every job gets one immediately. When jobs have to
+    wait the slot goes to the waiting job with the highest priority and, within a
+    priority, to the one that used the least processor time relative to its weight
+    (weighted fair queueing on a per job virtual time).
+
+    Priorities are strict, so a steady load of higher priority jobs would starve the
+    lower ones. To bound that a waiting job gains one priority level for every agingMs
+    it waits (default 1000, 0 turns aging off), in the "scheduling" tuning section.
+
+    Set per job in the Start info: "priority": 1, "weight": 4
+    Defaults are priority 0 and weight 1.
+*/
+class FairScheduler
+{
+public:
+    typedef uint64_t JobHandle;
+
+    static JobHandle Register(const std::string &JobId, const json &Config);
+    static void Unregister(JobHandle Handle);
+
+    // Blocks until the job may run its processor on a frame, false without a slot once it is cancelled
+    static bool Acquire(JobHandle Handle);
+    static void Release(JobHandle Handle, std::chrono::microseconds Used);
+    // Wakes the waiting threads of a job that is torn down, later Acquires fail right away
+    static void Cancel(JobHandle Handle);
+
+    // Number of frames processed concurrently, defaults to the number of cpus
+    static void SetSlots(std::size_t Slots);
+    // Time a waiting job needs to gain one priority level, 0 for strict priorities
+    static void SetAging(std::chrono::milliseconds Aging);
+    static json GetStats();
+
+    // Holds a processing slot for one frame
+    class Grant
+    {
+    public:
+        Grant(JobHandle Handle);
+        ~Grant();
+        Grant(const Grant &) = delete;
+        Grant &operator=(const Grant &) = delete;
+
+        // False when the job was cancelled instead, the frame must not be processed
+        explicit operator bool() const { return m_Granted; }
+
+    private:
+        JobHandle m_Handle;
+        bool m_Granted;
+        std::chrono::steady_clock::time_point m_Start;
+    };
+
+private:
+    struct JobEntry
+    {
+        std::string JobId;
+        double Weight = 1.0;
+        int Priority = 0;
+        double VirtualTime = 0.0;
+        // Threads of the job waiting for a slot, a pipeline has one per stage worker
+        std::size_t Waiting = 0;
+        bool Cancelled = false;
+        // Since when the job has waiters
+        std::chrono::steady_clock::time_point WaitStart;
+        uint64_t Grants = 0;
+        uint64_t UsedUs = 0;
+        uint64_t TotalWaitUs = 0;
+        uint64_t MaxWaitUs = 0;
+    };
+
+    FairScheduler();
+
+    static FairScheduler &getInstance()
+    {
+        static FairScheduler instance;
+        return instance;
+    }
+
+    bool IsNext(JobHandle Handle, std::chrono::steady_clock::time_point Now) const;
+    int64_t EffectivePriority(const JobEntry &Entry, std::chrono::steady_clock::time_point Now) const;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_ConVarSlots;
+    std::map<JobHandle, JobEntry> m_Jobs;
+    JobHandle m_NextHandle = 1;
+    std::size_t m_Slots;
+    std::size_t m_Busy = 0;
+    std::chrono::milliseconds m_Aging;
+    double m_VirtualClock = 0.0;
+    uint64_t m_ContendedGrants = 0;
+};
+} // namespace ProcessingUnit
+#endif // _FAIR_SCHEDULER_H_
@@ -0,0 +1,108 @@
+#ifndef _FAN_OUT_H_
+#define _FAN_OUT_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "observable.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Worker threads shared by all jobs that fan a frame out to the input subscribers.
+
+    {"workers": 4}
+
+    Run hands the tasks to the workers and takes part itself, so it finishes even
+    when every worker is busy with other jobs. Workers are started on first use, more
+    can be added later, fewer take effect after a restart.
+*/
+class FanOutPool
+{
+public:
+    static void SetWorkers(const json &Config);
+
+    // Runs all tasks in parallel and returns when they are done, rethrows the first exception
+    static void Run(std::vector<std::function<void()>> &Tasks);
+
+    static json GetStats();
+
+private:
+    struct Batch
+    {
+        std::vector<std::function<void()>> *Tasks;
+        std::size_t Count = 0;
+        std::atomic<std::size_t> Next{0};
+        std::size_t Done = 0; // Guarded by Mutex
+        std::exception_ptr Error;
+        std::mutex Mutex;
+        std::condition_variable ConVarDone;
+    };
+
+    FanOutPool();
+    ~FanOutPool();
+
+    static FanOutPool &getInstance()
+    {
+        static FanOutPool instance;
+        return instance;
+    }
+
+    void StartWorkers(std::size_t Workers);
+    void Worker();
+    // Runs unclaimed tasks of the batch until none is left, the number it ran
+    static std::size_t Drain(Batch &Work);
+
+    std::mutex m_Mutex;
+    std::condition_variable m_ConVarWork;
+    std::deque<std::shared_ptr<Batch>> m_Queue;
+    std::vector<std::thread> m_Workers;
+    std::size_t m_TargetWorkers;
+    bool m_Stop = false;
+
+    std::atomic<uint64_t> m_FanOuts{0};
+    std::atomic<uint64_t> m_Tasks{0};
+    std::atomic<uint64_t> m_TasksOnCaller{0};
+    std::atomic<uint64_t> m_Errors{0};
+};
+
+/*!
+    Sends each frame of a job to all input subscribers at once instead of one after
+    another, so a frame takes as long as the slowest analytics, not all of them.
+
+    Enabled per job through the Start info:
+    "fanOut": { "resultTimeoutMs": 1000 }
+
+    Subscribers run on FanOutPool threads, each with its own message sharing one read
+    only payload (ObserverDataMessage::payload()). A subscriber is done when its callback
+    returns, one that deferred its result is waited for up to resultTimeoutMs. Results
+    tagged for an earlier frame are dropped. The job sends what it got as one Data
+    message: a msgpack array with a bin per non empty result, in the order they came in.
+*/
+class FanOut
+{
+public:
+    explicit FanOut(const json &Config);
+
+    static bool IsRequested(const json &Config);
+
+    std::chrono::milliseconds GetResultTimeout() const { return m_ResultTimeout; }
+
+    // Packs the results into the payload of one Data message, empty when all are empty
+    static DataPtr Merge(const std::vector<DataPtr> &Results);
+
+private:
+    std::chrono::milliseconds m_ResultTimeout;
+};
+} // namespace ProcessingUnit
+#endif // _FAN_OUT_H_
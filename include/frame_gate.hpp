@@ -0,0 +1,57 @@
+#ifndef _FRAME_GATE_H_
+#define _FRAME_GATE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "observable.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Skips the processor for frames that hardly differ from the last processed one,
+    the job re-emits the previous result instead. Meant for fixed cameras watching
+    static scenes.
+
+    Enabled per job through the Start info:
+    "frameGate": { "threshold": 0.5, "maxSkipped": 100 }
+
+    threshold is the mean absolute difference per payload byte below which a frame
+    counts as unchanged. maxSkipped forces a processed frame after that many skipped
+    ones, 0 never forces one. Frames are compared with the last processed frame, not
+    the previous one, so a slow drift still gets processed once it adds up.
+*/
+class FrameGate
+{
+public:
+    explicit FrameGate(const json &Config);
+
+    static bool IsRequested(const json &Config);
+
+    // True when Frame can skip the processor. Otherwise Frame becomes the new reference.
+    bool IsUnchanged(const DataPtr &Frame);
+    // Result of the last processed frame, re-emitted for unchanged frames
+    void SetResult(const DataPtr &Result) { m_LastResult = Result; }
+    const DataPtr &GetLastResult() const { return m_LastResult; }
+
+    // Sum of absolute byte differences, stops early once it exceeds Limit
+    static uint64_t SumAbsDiff(const uint8_t *A, const uint8_t *B, std::size_t Size, uint64_t Limit);
+
+    // Frames checked and skipped over all jobs
+    static json GetStats();
+
+private:
+    double m_Threshold = 0.0;
+    uint64_t m_MaxSkipped = 100;
+    uint64_t m_Skipped = 0;
+    bool m_HasReference = false;
+    DataPtr m_Reference;
+    DataPtr m_LastResult;
+
+    static std::atomic<uint64_t> s_Checked;
+    static std::atomic<uint64_t> s_Skipped;
+};
+} // namespace ProcessingUnit
+#endif // _FRAME_GATE_H_
@@ -0,0 +1,134 @@
+#ifndef _FRAME_TRACER_H_
+#define _FRAME_TRACER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "job_host.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Timeline of the frame path in the Chrome trace event format, to open in
+    chrome://tracing or ui.perfetto.dev. Shows how the input, job, processor and
+    output threads of the jobs interleave, and where frames wait on a Continue, on
+    send capacity or on a lock.
+
+    {"enabled": false, "capacity": 262144, "directory": ".", "windowMs": 0}
+
+    While enabled every thread writes duration events (name, thread, job id, frame
+    sequence number) into one ring buffer of capacity events, lock free: a slot is
+    claimed with an atomic increment, the oldest events are overwritten. A writer
+    that finds its slot still being written, or holding a newer event, drops its own. The
+    buffer is allocated when tracing is first enabled, a later capacity needs a restart.
+
+    The buffer is written to <directory>/trace-<time>.json:
+    - on SIGUSR2
+    - on a Stats request with {"dumpTrace": true} in its stats, the reply carries the
+      file name as "traceFile" right away, the file is written shortly after
+    - windowMs after tracing was enabled when windowMs isn't 0, tracing stops then
+
+    Frames are numbered per job in the order they were received, output and continue
+    events carry the number of the result they send.
+*/
+class FrameTracer
+{
+public:
+    static const uint64_t NoSeq = ~uint64_t(0);
+
+    static void SetTracing(const json &Config);
+    static bool IsEnabled() { return getInstance().m_Enabled.load(std::memory_order_relaxed); }
+
+    // Names the calling thread on the timeline, Name must outlive the thread
+    static void SetThreadName(const char *Name);
+
+    /*!
+        Records one duration event from its construction to its destruction, nothing
+        when tracing is off or Name is null. Host gives the job id and must outlive it.
+    */
+    class Span
+    {
+    public:
+        Span(const char *Name, const JobHost *Host, uint64_t Seq = NoSeq);
+        ~Span();
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+        // For events whose frame is only known once they started
+        void SetSeq(uint64_t Seq) { m_Seq = Seq; }
+
+    private:
+        const char *m_Name;
+        const JobHost *m_Host;
+        uint64_t m_Seq;
+        uint64_t m_StartNs;
+    };
+
+    // Writes the buffer out, the file name or empty when it couldn't be written
+    static std::string Dump();
+    // Has the watch thread dump when a Stats request asks for it, adds the file to the reply
+    static void HandleStatsRequest(const json &Request, json &Reply);
+
+    static json GetStats();
+
+private:
+    static const std::size_t JobIdSize = 40;
+
+    struct TraceEvent
+    {
+        // Index + 1 of the event in the slot, 0 while it is written
+        std::atomic<uint64_t> Stamp{0};
+        const char *Name;
+        const char *ThreadName;
+        uint32_t ThreadId;
+        uint64_t Seq;
+        uint64_t StartNs;
+        uint64_t DurationNs;
+        char JobId[JobIdSize];
+    };
+
+    FrameTracer();
+    ~FrameTracer();
+
+    static FrameTracer &getInstance()
+    {
+        static FrameTracer instance;
+        return instance;
+    }
+
+    static uint64_t Now();
+    void Record(const char *Name, const JobHost *Host, uint64_t Seq, uint64_t StartNs, uint64_t EndNs);
+    void Watch();
+    // Needs m_Mutex
+    std::string NextDumpPath() const;
+    bool WriteDump(const std::string &Path);
+
+    const std::chrono::steady_clock::time_point m_Epoch;
+    std::atomic<bool> m_Enabled{false};
+    std::unique_ptr<TraceEvent[]> m_Events;
+    std::size_t m_Capacity = 0;
+    std::atomic<uint64_t> m_Head{0};
+    std::atomic<uint64_t> m_Dropped{0};
+
+    // Guards the settings and the watch thread
+    std::mutex m_Mutex;
+    std::string m_Directory = ".";
+    std::chrono::milliseconds m_Window{0};
+    std::chrono::steady_clock::time_point m_WindowEnd;
+    uint64_t m_Dumps = 0;
+    std::string m_LastDump;
+    // File a Stats request asked for, the watch thread writes it
+    std::string m_RequestedDump;
+    std::condition_variable m_ConVarWatch;
+    bool m_Stop = false;
+    std::thread m_WatchThread;
+};
+} // namespace ProcessingUnit
+#endif // _FRAME_TRACER_H_
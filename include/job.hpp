@@ -5,43 +5,99 @@
 #include <memory>
 #include <thread>
 #include <future>
+#include <atomic>
+#include <set>
 
-#include "job_connection.hpp"
+#include "job_host.hpp"
+#include "batch_scheduler.hpp"
+#include "processor.hpp"
+#include "thread_placement.hpp"
+#include "fair_scheduler.hpp"
+#include "frame_gate.hpp"
+#include "radiometric_preprocessor.hpp"
+#include "job_pipeline.hpp"
+#include "fan_out.hpp"
 #include "json/jsonconfig.hpp"
 
 namespace ProcessingUnit
 {
-class JobConnection;
-
 class Job
 {
 public:
-    Job(const json &config, JobConnection *job_con);
+    // Throws std::runtime_error when the Start info holds an invalid configuration
+    Job(const json &config, JobHost *host);
 
     ~Job();
 
-    // Add data to the processing queue
+    // Add data to the processing queue, takes over the buffer and leaves data empty
     json process(DataPtr &data);
 
     // Functions for the PU implementation
     bool readData(DataPtr *data);
+    // Call with m_DataProtector held, it also keeps the result for the frame gate
     void writeData(DataPtr &data);
     void stopJob();
+    // Teardown without draining: drops the queued frames and wakes every wait, returns without joining
+    void cancelJob();
     bool isStoped();
 
+    json GetStats() const;
+    // Frames waiting for the processor, lock free
+    int64_t GetQueuedFrames() const { return m_QueuedFrames.load(); }
+
 private:
     void Processing();
+    void ProcessBatched(DataPtr &data);
+    void ProcessFannedOut(DataPtr &data);
+
+    // Outlives the job in the callbacks of its batched frames
+    struct BatchWait
+    {
+        std::mutex Mutex;
+        bool Cancelled = false;
+    };
+
+    struct InputFrame
+    {
+        DataPtr Data;
+        int Node; // NUMA node the frame was received on
+        uint64_t Seq; // Order the frame was received in, for the probes
+    };
 
-    JobConnection *m_JobConnection;
-    std::queue<DataPtr> m_InputData;
+    JobHost *m_Host;
+    std::queue<InputFrame> m_InputData;
+    std::atomic<int64_t> m_QueuedFrames{0};
+    uint64_t m_NextSeq = 0;
+    // Frame the processing thread works on, result callbacks can run on other threads
+    std::atomic<uint64_t> m_CurrentSeq{0};
+    std::size_t m_LastResultBytes = 0;
+    uint64_t m_PipelineSeq = 0;
     std::mutex m_DataProtector;
     std::condition_variable m_ConditionVariable;
     volatile bool m_isJobEmpty = true;
     volatile bool m_isStopJobSignaled = false;
+    volatile bool m_isCancelled = false;
     std::thread m_ProcessThread;
     std::condition_variable m_ConVarVARecived;
     volatile bool m_isVARecived = false;
     uint32_t _callback_identifier;
+    bool _is_subscribed = false;
+    std::shared_ptr<BatchScheduler> m_BatchScheduler;
+    std::shared_ptr<BatchWait> m_BatchWait = std::make_shared<BatchWait>();
+    std::shared_ptr<IProcessor> m_Processor;
+    json m_Config;
+    int m_ProcessingNode = -1;
+    bool m_NumaLocalBuffers = false;
+    FairScheduler::JobHandle m_SchedulerHandle;
+    std::unique_ptr<FrameGate> m_FrameGate;
+    std::unique_ptr<RadiometricPreprocessor> m_Preprocessor;
+    std::unique_ptr<JobPipeline> m_Pipeline;
+    std::unique_ptr<FanOut> m_FanOut;
+    // The frame being fanned out and what its subscribers sent, guarded by m_DataProtector
+    bool m_FanOutActive = false;
+    uint64_t m_FanOutSeq = 0;
+    std::vector<DataPtr> m_FanOutResults;
+    std::set<uint32_t> m_FanOutAnswered;
 };
 } // namespace ProcessingUnit
 #endif // _JOB_H_
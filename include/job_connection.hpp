@@ -6,12 +6,18 @@
 #include <condition_variable>
 #include <memory>
 #include <functional>
+#include <atomic>
+#include <thread>
 
 #include "observable.hpp"
 #include "observables_resolver.hpp"
 #include "osprey_ws_protocol.hpp"
 #include "concurrent_queue.hpp"
+#include "job_host.hpp"
 #include "job.hpp"
+#include "stream_recorder.hpp"
+#include "memory_governor.hpp"
+#include "load_monitor.hpp"
 #include "json/jsonconfig.hpp"
 
 
@@ -34,6 +40,43 @@ enum class ConnectionState
 typedef SimpleWeb::SocketServer<SimpleWeb::WS> WsServer;
 typedef std::shared_ptr<WsServer::Connection> ConnectionPtr;
 
+/*!
+    Messages handed to the websocket that the socket didn't finish writing yet.
+    Shared with the send completion callbacks, which can run after the JobConnection is gone.
+*/
+struct SendQueueState
+{
+    std::mutex Mutex;
+    std::condition_variable ConVarDrained;
+    std::size_t OutstandingBytes = 0;
+    std::size_t OutstandingMessages = 0;
+    uint64_t SentBytes = 0;
+    uint64_t SentMessages = 0;
+    uint64_t SendErrors = 0;
+    uint64_t HighWaterStalls = 0;
+};
+
+/*!
+    Socket a job currently talks to. A detached job has none, a resumed one gets the
+    socket the client reconnected on. Shared with callbacks that outlive the JobConnection.
+*/
+struct ConnectionLink
+{
+    std::mutex Mutex;
+    ConnectionPtr Connection;
+
+    ConnectionPtr Get()
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        return Connection;
+    }
+    void Set(ConnectionPtr Conn)
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Connection = Conn;
+    }
+};
+
 struct JobInfo
 {
     JobInfo() {}
@@ -44,41 +87,71 @@ struct JobInfo
     bool IsProcessing() { return false; }
 };
 
-class JobConnection
+class JobConnection : public JobHost
 {
 public:
     JobConnection();
     ~JobConnection();
 
     void Init(ConnectionPtr Conn);
+    /*!
+        Job on one channel of a multiplexed connection. It starts no threads of its own:
+        the ChannelMux of the socket drives the output through PumpOutput, and all
+        channels of the socket share one send state.
+    */
+    void InitHosted(ConnectionPtr Conn, const std::string &Channel, std::shared_ptr<SendQueueState> SendState,
+                    std::function<void()> WakeOutput);
 
     ConnectionState GetState() const { return m_Info.state; }
     void SetState(ConnectionState state) { m_Info.state = state; }
     //
-    std::string GetJobId() const { return m_Info.jobId; }
-
-    void NotifyInputData(ObserverDataMessage &input_message) const
-    {
-        return _input_observable->notify(input_message);
-    }
-
-    uint32_t SubscribeProcessorResult(std::function<void(ObserverDataMessage &)> callback) const
-    {
-        return _processor_result_observable->subscribe(callback);
-    }
-
-    void UnsubscribeProcessorResult(uint32_t callback_identifier) const
-    {
-        _processor_result_observable->unsubscribe(callback_identifier);
-    }
+    std::string GetJobId() const override { return m_Info.jobId; }
 
     void SetJobId(const std::string &jobId) { m_Info.jobId = jobId; }
 
     void OnMessage(std::shared_ptr<WsServer::Message> Message);
+    /*!
+        Large frames are decoded straight from the socket buffer. Small messages, and all
+        of them when KeepBytes is set, go through Bytes so a recorder sees the exact bytes.
+    */
+    static bool ReadMessage(std::shared_ptr<WsServer::Message> Message, MessageReader &Reader, std::string &Bytes,
+                            bool KeepBytes);
+    // Bytes holds the raw message when it was read into a string, it is what gets recorded
+    void OnParsedMessage(MessageReader &Reader, const std::string &Bytes);
+    // Hosted only: sends the next output message when the client gave credit, true when it sent one
+    bool PumpOutput();
+
+    std::string GetChannel() const { return m_Channel; }
+    // Socket of the job, a resumed job moves to a new one: read it through the link
+    ConnectionPtr GetConnection() const { return m_Link->Get(); }
+
+    // Session resumption, see session_registry.hpp
+    std::string GetResumeToken() const { return m_ResumeToken; }
+    bool IsResumable() const
+    {
+        return !m_ResumeToken.empty() &&
+               (m_Info.state == ConnectionState::job_started || m_Info.state == ConnectionState::job_started_end_received);
+    }
+    // The socket is gone: the job runs on, its results stay queued and nothing is sent
+    void Detach();
+    // Continues a detached job on the socket the client reconnected on, answers the Start with Ready
+    void Reattach(ConnectionPtr Conn);
+    // Drops the queued results and cancels the job, it reaches job_ended once its threads are done
+    void Abandon();
 
     // Comunication with Job functions
-    void SendContinue();
-    void SendData(std::vector<char> &data);
+    void OnFrameDequeued(std::size_t Bytes) override;
+    void SendContinue() override;
+    void SendData(std::vector<char> &data) override;
+    void OnFrameProcessed(std::chrono::microseconds ProcessingTime) override;
+
+    json GetStats();
+    // Frame rate, queue depths and latency of the job from lock free counters, for Stats replies
+    json GetLoad() const;
+    // Builds the reply to a Stats request, set by whoever owns the connection
+    void SetStatsProvider(std::function<json()> Provider) { m_StatsProvider = Provider; }
+    // Stats reply on a socket that has no JobConnection of its own to send it
+    static void SendStatsReply(ConnectionPtr Conn, StatsMessage &Msg, std::shared_ptr<SendQueueState> State);
 
 private:
     JobInfo m_Info;
@@ -87,12 +160,50 @@ private:
     std::queue<std::unique_ptr<Message>> m_OutputMessages;
     bool m_Valid;
 
-    std::shared_ptr<ObservablesResolver> observables_resolver;
-    std::shared_ptr<IObservable> _input_observable = observables_resolver->getInputObservable();
-    std::shared_ptr<IObservable> _processor_result_observable = observables_resolver->getProcessorResultObservable();
-
     void Input(ConnectionPtr Conn);
     void Output(ConnectionPtr Conn);
+    void WaitForSendCapacity();
+    void SetSendHighWater(const json &FlowControl);
+    // Wakes every wait of the connection and its job, then joins their threads
+    void Shutdown();
+    // Caller holds m_DataProtectorOutputQueue for both
+    bool HasOutputReady() const;
+    // True once End was sent
+    bool SendNextOutput();
+    void NotifyOutput();
+    void StopHostedJob();
+    template <class CertainMessageType>
+    void Send(CertainMessageType &Msg);
+
+    std::string m_Channel;
+    bool m_Hosted = false;
+    std::shared_ptr<ConnectionLink> m_Link = std::make_shared<ConnectionLink>();
+    std::string m_ResumeToken;
+    bool m_Detached = false; // Guarded by m_DataProtectorOutputQueue
+    bool m_Abandoned = false; // Guarded by m_DataProtectorOutputQueue
+    std::function<void()> m_WakeOutput;
+    std::thread m_StopThread;
+    std::function<json()> m_StatsProvider;
+    RateCounter m_FrameRate;
+    std::atomic<uint64_t> m_LastLatencyUs{0};
+    std::atomic<int64_t> m_OutputDepth{0};
+    // Continue counts for the probes, sent is shared with the memory credit callback
+    std::shared_ptr<std::atomic<uint64_t>> m_ContinuesSent = std::make_shared<std::atomic<uint64_t>>(0);
+    uint64_t m_ContinuesReceived = 0; // Guarded by m_DataProtectorOutputQueue
+    // Data messages sent, numbers the output events of the tracer
+    uint64_t m_OutputSeq = 0; // Guarded by m_DataProtectorOutputQueue
+    std::thread m_InputThread;
+    std::thread m_OutputThread;
+
+    std::shared_ptr<SendQueueState> m_SendState = std::make_shared<SendQueueState>();
+    // The Start of the job sets them while the output thread already waits on them
+    std::atomic<std::size_t> m_SendHighWaterBytes;
+    std::atomic<std::size_t> m_SendHighWaterMessages;
+    unsigned char m_SendFinRsvOpcode = 130;
+    // Set on Start from the io thread, read from the output thread: std::atomic_load / atomic_store only
+    std::shared_ptr<StreamRecorder> m_Recorder;
+    // Payload bytes of this job in the input, job and output queues, created on Start
+    std::unique_ptr<MemoryGovernor::Account> m_MemoryAccount;
 
     std::mutex m_DataProtector;
     std::mutex m_MutexContinue;
@@ -100,7 +211,7 @@ private:
     std::mutex m_DataProtectorOutputQueue;
     std::condition_variable m_ConVarOutputQueue;
     std::condition_variable m_ConVarInputQueue;
-    bool m_Processing;
+    std::atomic<bool> m_Processing;
     bool m_isContinueMessageRecived = true;
     bool m_isEndMessageReceived = false;
     bool m_isJobStoped = false;
@@ -3,9 +3,12 @@
 
 #include <server_ws.hpp>
 #include <queue>
+#include <deque>
 #include <condition_variable>
+#include <thread>
 #include "osprey_ws_protocol.hpp"
 #include "job_connection.hpp"
+#include "channel_mux.hpp"
 
 namespace ProcessingUnit
 {
@@ -16,6 +19,9 @@ private:
     typedef std::shared_ptr<WsServer::Connection> ConnectionPtr;
 
 public:
+    JobConnectionManager();
+    ~JobConnectionManager();
+
     void OnOpen(ConnectionPtr conn);
     void AddJobIdToConnection(ConnectionPtr conn, const std::string &jobId);
     void AddInputMessage(ConnectionPtr conn, std::unique_ptr<DataMessage> msg);
@@ -23,16 +29,37 @@ public:
 
     void OnMessage(ConnectionPtr conn, std::shared_ptr<WsServer::Message> message);
     void OnClose(ConnectionPtr conn);
-    bool IsEmpty() const { return m_Jobs.empty(); }
+    bool IsEmpty() const { return m_Jobs.empty() && m_Muxes.empty(); }
 
     ConnectionState GetConnectionState(ConnectionPtr conn);
     void ChangeConnectionState(ConnectionPtr conn, ConnectionState state);
     std::string GetJobId(ConnectionPtr conn);
     void AddJobId(ConnectionPtr conn, const std::string &jobId);
 
+    json GetStats();
+
 private:
-    std::map<ConnectionPtr, JobConnection> m_Jobs;
+    // Reattaches the socket to a detached job when its Start asks for that, true when it did.
+    // The caller holds m_ConnectionsMutex
+    bool TryResume(ConnectionPtr conn, MessageReader &Reader);
+    // Answer to a Stats request, takes m_ConnectionsMutex only to copy the connections
+    json BuildLoadReport();
+    // Destroys closed connections: that cancels their jobs and joins their threads, which
+    // must neither block the io thread nor happen under m_ConnectionsMutex
+    void TearDown();
+
+    // Shared, a resumable job outlives its socket in the SessionRegistry
+    std::map<ConnectionPtr, std::shared_ptr<JobConnection>> m_Jobs;
+    // Sockets that asked for multiplexing, they carry many jobs each
+    std::map<ConnectionPtr, std::shared_ptr<ChannelMux>> m_Muxes;
     std::mutex m_ConnectionsMutex;
+
+    std::mutex m_ClosedMutex;
+    std::condition_variable m_ConVarClosed;
+    // A JobConnection or a ChannelMux each, destroyed by the teardown thread
+    std::deque<std::shared_ptr<void>> m_Closed;
+    bool m_StopTearDown = false;
+    std::thread m_TearDownThread;
 };
 } // namespace ProcessingUnit
 #endif // _JOB_CONNECTION_MANAGER_H_
@@ -0,0 +1,124 @@
+#ifndef _JOB_DISPATCHER_H_
+#define _JOB_DISPATCHER_H_
+
+#include <server_ws.hpp>
+#include <client_ws.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+struct DispatchRelay;
+
+/*!
+    One ProcessingUnitServer the dispatcher hands jobs to
+*/
+struct DispatchBackend
+{
+    typedef SimpleWeb::SocketClient<SimpleWeb::WS> WsClient;
+
+    // host:port/path as the websocket client takes it
+    std::string Address;
+    // Data relayed to the backend that it didn't answer with a Continue yet
+    std::atomic<int64_t> OutstandingFrames{0};
+    std::atomic<int64_t> Relays{0};
+    std::atomic<uint64_t> Dispatched{0};
+    // Jobs sent its way since its last Stats reply, so a burst doesn't all land on one stale report
+    std::atomic<uint64_t> StartsSinceReport{0};
+
+    // Guards the probe state below
+    std::mutex Mutex;
+    json Report;
+    bool Reachable = false;
+    std::chrono::steady_clock::time_point ReportTime;
+    std::shared_ptr<WsClient::Connection> ProbeConnection;
+    std::unique_ptr<WsClient> ProbeClient;
+    std::thread ProbeThread;
+    std::atomic<bool> ProbeRunning{false};
+};
+
+/*!
+    Front end for several ProcessingUnitServers, on this host or others, behind one address.
+
+    {
+        "host": "", "port": 8080, "endpoint": "^/$", "ioThreads": 2,
+        "backends": ["127.0.0.1:8081", "127.0.0.1:8082", "10.0.0.7:8080"],
+        "policy": "load",
+        "probeIntervalMs": 1000
+    }
+
+    A client connects as it would to a ProcessingUnitServer. Its Start picks a backend
+    and from then on the socket is relayed to that backend as is: messages are only
+    peeked at for their info and forwarded byte for byte, payloads are never decoded.
+    Continue credits come from the backend, so flow control stays end to end.
+
+    policy "load" picks the backend that reported the fewest active jobs in its last
+    Stats reply, policy "leastOutstanding" the one with the fewest relayed frames it
+    didn't answer yet. Either way backends that refuse jobs or don't answer probes are
+    only picked when no other backend is left.
+
+    A Start with a resume token goes to the backend that handed out the token. A
+    multiplexed socket (?multiplex=1) goes to one backend as a whole, picked by its
+    first Start. A Stats request before any Start is answered by the dispatcher.
+*/
+class JobDispatcher
+{
+public:
+    typedef SimpleWeb::SocketServer<SimpleWeb::WS> WsServer;
+    typedef std::shared_ptr<WsServer::Connection> ConnectionPtr;
+
+    explicit JobDispatcher(const json &Config);
+    ~JobDispatcher();
+    JobDispatcher &operator=(const JobDispatcher &) = delete;
+    JobDispatcher(const JobDispatcher &) = delete;
+
+    // Serves clients until Stop, false when the configuration has no backends
+    bool Start();
+    void Stop();
+
+    json GetStats();
+
+private:
+    void OnOpen(ConnectionPtr Conn);
+    void OnMessage(ConnectionPtr Conn, std::shared_ptr<WsServer::Message> Message);
+    void OnClose(ConnectionPtr Conn);
+
+    std::shared_ptr<DispatchRelay> OpenRelay(ConnectionPtr Conn, DispatchBackend *Backend);
+    DispatchBackend *PickBackend();
+    DispatchBackend *FindResumeBackend(const std::string &ResumeToken);
+    void RememberResumeToken(const std::string &ResumeToken, DispatchBackend *Backend);
+
+    void Probe();
+    void StartProbe(DispatchBackend &Backend);
+    void StopProbe(DispatchBackend &Backend);
+
+    std::string m_Host;
+    int m_Port = 8080;
+    std::string m_Endpoint = "^/$";
+    std::size_t m_IoThreads = 2;
+    bool m_LeastOutstanding = false;
+    std::chrono::milliseconds m_ProbeInterval;
+
+    WsServer m_Server;
+    std::vector<std::unique_ptr<DispatchBackend>> m_Backends;
+
+    std::mutex m_Mutex;
+    std::map<ConnectionPtr, std::shared_ptr<DispatchRelay>> m_Relays;
+    std::map<std::string, std::pair<DispatchBackend *, std::chrono::steady_clock::time_point>> m_ResumeTokens;
+
+    std::mutex m_ProbeMutex;
+    std::condition_variable m_ConVarProbe;
+    bool m_Stop = false;
+    std::thread m_ProbeThread;
+};
+} // namespace ProcessingUnit
+#endif // _JOB_DISPATCHER_H_
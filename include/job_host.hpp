@@ -0,0 +1,92 @@
+#ifndef _JOB_HOST_H_
+#define _JOB_HOST_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "observable.hpp"
+#include "observables_resolver.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Everything a Job needs from whoever feeds it frames: flow control towards the
+    client, a sink for the results and access to the processor observables.
+    JobConnection hosts jobs for a websocket, ReplaySession hosts them for a capture file.
+*/
+class JobHost
+{
+public:
+    virtual ~JobHost() {}
+
+    virtual std::string GetJobId() const { return ""; }
+
+    // The job id copied once it is known, for readers that must not allocate or lock (FrameTracer)
+    const char *GetCachedJobId() const
+    {
+        int State = m_JobIdState.load(std::memory_order_acquire);
+        if (State == JobIdUnknown)
+        {
+            const std::string JobId = GetJobId();
+            if (!JobId.empty() && m_JobIdState.compare_exchange_strong(State, JobIdWriting))
+            {
+                const std::size_t Length = std::min(JobId.size(), sizeof(m_JobId) - 1);
+                std::memcpy(m_JobId, JobId.data(), Length);
+                m_JobId[Length] = '\0';
+                m_JobIdState.store(JobIdCached, std::memory_order_release);
+                return m_JobId;
+            }
+        }
+        return State == JobIdCached ? m_JobId : "";
+    }
+
+    // Job took a frame of Bytes payload from its queue, called right before SendContinue
+    virtual void OnFrameDequeued(std::size_t Bytes) {}
+    // Job took a frame from its queue, the client may send the next one
+    virtual void SendContinue() = 0;
+    // Result of the processor for the client
+    virtual void SendData(std::vector<char> &data) = 0;
+    // Job finished a frame, called once per frame in order
+    virtual void OnFrameProcessed(std::chrono::microseconds ProcessingTime) {}
+
+    void NotifyInputData(ObserverDataMessage &input_message) const
+    {
+        return _input_observable->notify(input_message);
+    }
+
+    // Sends the frame to all input subscribers at once, returns how many there are
+    std::size_t FanOutInputData(const ObserverDataMessage &input_message, std::vector<uint32_t> &deferred_subscribers) const
+    {
+        return _input_observable->fan_out(input_message, deferred_subscribers);
+    }
+
+    uint32_t SubscribeProcessorResult(std::function<void(ObserverDataMessage &)> callback) const
+    {
+        return _processor_result_observable->subscribe(callback);
+    }
+
+    void UnsubscribeProcessorResult(uint32_t callback_identifier) const
+    {
+        _processor_result_observable->unsubscribe(callback_identifier);
+    }
+
+private:
+    enum
+    {
+        JobIdUnknown,
+        JobIdWriting,
+        JobIdCached
+    };
+    mutable std::atomic<int> m_JobIdState{JobIdUnknown};
+    mutable char m_JobId[40];
+
+    std::shared_ptr<IObservable> _input_observable = ObservablesResolver::getInputObservable();
+    std::shared_ptr<IObservable> _processor_result_observable = ObservablesResolver::getProcessorResultObservable();
+};
+} // namespace ProcessingUnit
+#endif // _JOB_HOST_H_
@@ -0,0 +1,120 @@
+#ifndef _JOB_PIPELINE_H_
+#define _JOB_PIPELINE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fair_scheduler.hpp"
+#include "observable.hpp"
+#include "processor.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Runs the processing of a Job as a chain of stages, each with its own worker
+    threads and a bounded queue in front of it. Stage N of the next frame overlaps
+    with stage N+1 of the current one, so throughput is that of the slowest stage.
+    Results are handed out in the order the frames were submitted.
+
+    Enabled per job through the Start info, each stage is a registered processor
+    and gets its entry as config:
+    "pipeline": [
+        { "processor": "decode" },
+        { "processor": "detector", "workers": 2, "queueSize": 4 },
+        { "processor": "tracker" }
+    ]
+
+    The stage name "preprocess" runs the RadiometricPreprocessor configured by the
+    "preprocess" object of the Start info. When "preprocess" is configured but not
+    listed, it runs as the first stage.
+
+    A stage without output, or one that throws, ends the frame without a result.
+*/
+class JobPipeline
+{
+public:
+    // Called in submission order, one result at a time, from a thread that completed a
+    // frame. No pipeline lock is held, the callback may take its own locks.
+    typedef std::function<void(DataPtr &Result, std::chrono::microseconds Latency)> ResultCallback;
+
+    // Throws std::runtime_error when a stage processor isn't registered
+    JobPipeline(const json &Config, FairScheduler::JobHandle SchedulerHandle, ResultCallback Callback);
+    ~JobPipeline();
+
+    JobPipeline(const JobPipeline &) = delete;
+    JobPipeline &operator=(const JobPipeline &) = delete;
+
+    static bool IsRequested(const json &Config);
+
+    // Takes the frame, blocks while the queue of the first stage is full
+    void Submit(DataPtr &Frame);
+    // Result that skips all stages but keeps its place in the output order
+    void Bypass(DataPtr &Result);
+    // Waits until every submitted frame was handed out and stops the workers
+    void Drain();
+    // Drops the queued frames and the results still to come, Drain then only waits for
+    // the frames the workers are processing. Callable from any thread.
+    void Cancel();
+
+    json GetStats() const;
+
+private:
+    struct PipelineFrame
+    {
+        uint64_t Sequence = 0;
+        DataPtr Data;
+        std::chrono::steady_clock::time_point Submitted;
+    };
+
+    struct Stage
+    {
+        std::string Name;
+        std::size_t Workers = 1;
+        std::size_t QueueSize = 4;
+        json Config;
+
+        std::mutex Mutex;
+        std::condition_variable ConVarNotEmpty;
+        std::condition_variable ConVarNotFull;
+        std::deque<PipelineFrame> Queue;
+        bool Closed = false;
+        std::vector<std::thread> Threads;
+
+        std::atomic<uint64_t> Frames{0};
+        std::atomic<uint64_t> Errors{0};
+        std::atomic<uint64_t> BusyUs{0};
+        std::atomic<uint64_t> MaxUs{0};
+        std::atomic<uint64_t> FullWaits{0};
+    };
+
+    void Push(Stage &Target, PipelineFrame &&Frame);
+    void Worker(std::size_t StageIndex, std::shared_ptr<IProcessor> Processor);
+    void Complete(PipelineFrame &&Frame);
+
+    const FairScheduler::JobHandle m_SchedulerHandle;
+    const json m_Config;
+    ResultCallback m_Callback;
+    std::vector<std::unique_ptr<Stage>> m_Stages;
+
+    mutable std::mutex m_OrderMutex;
+    std::condition_variable m_ConVarEmitted;
+    std::map<uint64_t, PipelineFrame> m_Completed;
+    uint64_t m_NextSequence = 0;
+    uint64_t m_NextToEmit = 0;
+    // A thread is handing out results, the others leave theirs to it
+    bool m_Emitting = false;
+    bool m_Cancelled = false;
+    bool m_Drained = false;
+};
+} // namespace ProcessingUnit
+#endif // _JOB_PIPELINE_H_
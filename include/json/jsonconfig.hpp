@@ -1,6 +1,9 @@
 #pragma once
 
 
+#include <fstream>
+#include <string>
+
 #include "vendor/json.hpp"
 
 // Normally it is a big no-no to pollute the global namespace in a header file, but we use this json
@@ -24,6 +27,19 @@ void fetch(const json& j, const std::string& key, T& val) {
     val = j[key].get<T>();
   }
 }
+
+// Load a json file, returns a null json when the file can't be opened or parsed.
+inline json loadJson(const std::string& path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    return json();
+  }
+  try {
+    return json::parse(file);
+  } catch (const std::exception&) {
+    return json();
+  }
+}
 }
 
 
@@ -0,0 +1,122 @@
+#ifndef _LOAD_MONITOR_H_
+#define _LOAD_MONITOR_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Events per second over the last full second, lock free on both sides.
+    Reads 0 once no event came in for two seconds.
+*/
+class RateCounter
+{
+public:
+    RateCounter();
+    void Tick();
+    double GetRate() const;
+
+private:
+    std::atomic<int64_t> m_WindowStartMs;
+    std::atomic<uint64_t> m_Count;
+    std::atomic<double> m_LastRate;
+};
+
+/*!
+    Process wide load signals, updated from the frame path with atomic counters only.
+
+    Processing latency goes into a histogram with power of two microsecond buckets.
+    Two histograms take turns: every LatencyWindow the older one is cleared and
+    becomes the current one, so percentiles cover the last one to two windows.
+
+    Cpu, threads, memory and open files come from /proc, read once a second by a
+    sampler thread, so a Stats request only loads atomics.
+*/
+class LoadMonitor
+{
+public:
+    static void JobStarted();
+    static void JobEnded();
+    static void FramesQueued(int64_t Count);
+    static void RecordProcessingLatency(std::chrono::microseconds Latency);
+
+    // Sockets and JobConnections alive, to see churn return to its baseline
+    static void ConnectionOpened();
+    static void ConnectionClosed();
+    static void JobConnectionCreated();
+    static void JobConnectionDestroyed();
+
+    // Counts a connection, job or pipeline thread for as long as it runs
+    class LiveThread
+    {
+    public:
+        LiveThread() { getInstance().m_LiveThreads++; }
+        ~LiveThread() { getInstance().m_LiveThreads--; }
+    };
+
+    static uint64_t GetActiveJobs();
+    static int64_t GetQueuedFrames();
+    // Upper bound of the bucket holding the requested percentile, 0 without samples
+    static uint64_t GetLatencyPercentileUs(double Percentile);
+    // Busy fraction of all cpus between the last two samples
+    static double GetCpuUtilisation();
+    // Threads of the whole process, from /proc/self/status, 0 when unavailable
+    static uint64_t GetProcessThreads();
+    // Resident memory of the process in bytes, from /proc/self/status, 0 when unavailable
+    static uint64_t GetResidentBytes();
+    // Open file descriptors of the process, from /proc/self/fd, 0 when unavailable
+    static uint64_t GetOpenFiles();
+
+    static json GetStats();
+
+private:
+    static const std::size_t BucketCount = 40;
+    typedef std::array<std::atomic<uint64_t>, BucketCount> Histogram;
+
+    LoadMonitor();
+    ~LoadMonitor();
+
+    static LoadMonitor &getInstance()
+    {
+        static LoadMonitor instance;
+        return instance;
+    }
+
+    void RotateLatencyWindow();
+    void Sample();
+    void SampleCpu();
+
+    std::atomic<uint64_t> m_ActiveJobs;
+    std::atomic<int64_t> m_QueuedFrames;
+    std::atomic<uint64_t> m_ProcessedFrames;
+    std::atomic<int64_t> m_LiveConnections;
+    std::atomic<int64_t> m_LiveJobConnections;
+    std::atomic<int64_t> m_LiveThreads;
+
+    Histogram m_Latency[2];
+    std::atomic<int> m_CurrentWindow;
+    std::atomic<int64_t> m_WindowStartMs;
+
+    std::atomic<double> m_CpuUtilisation;
+    std::atomic<uint64_t> m_ProcessThreads;
+    std::atomic<uint64_t> m_ResidentBytes;
+    std::atomic<uint64_t> m_OpenFiles;
+    // Only touched by the sampler thread
+    uint64_t m_LastCpuBusy = 0;
+    uint64_t m_LastCpuTotal = 0;
+
+    std::mutex m_SampleMutex;
+    std::condition_variable m_ConVarSample;
+    bool m_StopSampling = false;
+    std::thread m_SampleThread;
+};
+} // namespace ProcessingUnit
+#endif // _LOAD_MONITOR_H_
@@ -0,0 +1,88 @@
+#ifndef _MEMORY_GOVERNOR_H_
+#define _MEMORY_GOVERNOR_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Process wide budget for frame payloads waiting in the connection input queue,
+    the job queue and the connection output queue.
+
+    Every job gets an Account with a guaranteed reservation, above it jobs share
+    what is left of the budget. Payloads that arrived are always accepted, the
+    governor slows clients down instead: a job over its reservation while the
+    shared pool is used up doesn't get Continue, the withheld credits are handed
+    out once memory is released. The budget is a soft limit, each job can exceed
+    it by the frames its client sent on credits given before the pool ran out.
+
+    {"totalBytes": 536870912, "perJobReservedBytes": 8388608}, totalBytes 0 only accounts
+*/
+class MemoryGovernor
+{
+public:
+    class Account
+    {
+    public:
+        // OnCredit sends a withheld Continue, it is called from whichever thread releases memory
+        Account(const std::string &JobId, std::function<void()> OnCredit);
+        ~Account();
+
+        Account(const Account &) = delete;
+        Account &operator=(const Account &) = delete;
+
+        // Payload entered one of the queues
+        void Charge(std::size_t Bytes);
+        // Payload left the queues
+        void Release(std::size_t Bytes);
+        // True when the client may send another frame, otherwise the credit is withheld
+        bool TryTakeCredit();
+
+    private:
+        uint64_t m_Id;
+    };
+
+    static void SetBudget(const json &Config);
+    static json GetStats();
+
+private:
+    struct AccountState
+    {
+        std::string JobId;
+        std::size_t Used = 0;
+        std::size_t Peak = 0;
+        uint64_t Withheld = 0;
+        uint64_t WithheldTotal = 0;
+        std::function<void()> OnCredit;
+    };
+
+    MemoryGovernor() {}
+
+    static MemoryGovernor &getInstance()
+    {
+        static MemoryGovernor instance;
+        return instance;
+    }
+
+    bool HasCredit(const AccountState &State) const;
+    std::size_t SharedUsed() const;
+    // Hands out withheld credits that fit now, call without holding m_Mutex
+    void GrantWithheld();
+
+    std::mutex m_Mutex;
+    std::size_t m_TotalBytes = 0;
+    std::size_t m_PerJobReservedBytes = 8 * 1024 * 1024;
+    std::size_t m_Used = 0;
+    std::size_t m_Peak = 0;
+    uint64_t m_NextId = 1;
+    uint64_t m_CreditsWithheld = 0;
+    std::map<uint64_t, AccountState> m_Accounts;
+};
+} // namespace ProcessingUnit
+#endif // _MEMORY_GOVERNOR_H_
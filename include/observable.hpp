@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include <vector>
 #include <functional>
 #include <algorithm>
@@ -11,6 +12,7 @@
 #include <ctime>
 #include <chrono>
 #include <map>
+#include <memory>
 #include <string>
 #include <typeinfo>
 
@@ -22,18 +24,66 @@ namespace ProcessingUnit
 {
 typedef std::vector<char> DataPtr;
 
+/*!
+    A frame for the input subscribers or a result for the processor result subscribers.
+
+    A frame a job fans out carries its payload in shared_payload, read only and shared
+    by all subscribers, each of them gets its own message tagged with the job, the frame
+    and the subscriber. A subscriber answers with result(), so the job can tell its
+    result from late ones of earlier frames. One that publishes after its callback
+    returned calls defer_result() first, the job waits for it up to resultTimeoutMs and
+    counts every other subscriber as done once its callback returned.
+*/
 struct ObserverDataMessage
 {
+    static const uint64_t no_frame = ~uint64_t(0);
+
     ObserverDataMessage(DataPtr payload) : message_payload(payload) {}
 
-    ObserverDataMessage(const ObserverDataMessage &result_message) : message_payload(result_message.message_payload) {}
+    ObserverDataMessage(std::shared_ptr<const DataPtr> payload, const void *origin, uint64_t seq)
+        : shared_payload(std::move(payload)), frame_origin(origin), frame_seq(seq)
+    {
+    }
+
+    ObserverDataMessage(const ObserverDataMessage &result_message)
+        : message_payload(result_message.message_payload), shared_payload(result_message.shared_payload),
+          frame_origin(result_message.frame_origin), frame_seq(result_message.frame_seq),
+          subscriber_id(result_message.subscriber_id), result_deferred(result_message.result_deferred)
+    {
+    }
     ObserverDataMessage &operator=(const ObserverDataMessage &other)
     {
         this->message_payload = other.message_payload;
+        this->shared_payload = other.shared_payload;
+        this->frame_origin = other.frame_origin;
+        this->frame_seq = other.frame_seq;
+        this->subscriber_id = other.subscriber_id;
+        this->result_deferred = other.result_deferred;
         return *this;
     }
 
+    // The frame, wherever it is kept
+    const DataPtr &payload() const { return shared_payload ? *shared_payload : message_payload; }
+
+    // The result for this frame, tagged like it
+    ObserverDataMessage result(DataPtr result_payload) const
+    {
+        ObserverDataMessage result_message(std::move(result_payload));
+        result_message.frame_origin = frame_origin;
+        result_message.frame_seq = frame_seq;
+        result_message.subscriber_id = subscriber_id;
+        return result_message;
+    }
+
+    void defer_result() { result_deferred = true; }
+
     DataPtr message_payload;
+    std::shared_ptr<const DataPtr> shared_payload;
+    // Job that fanned the frame out, null for untagged messages
+    const void *frame_origin = nullptr;
+    uint64_t frame_seq = no_frame;
+    uint32_t subscriber_id = 0;
+    bool result_deferred = false;
 };
 
 class IObservable
@@ -42,19 +92,66 @@ public:
     virtual uint32_t subscribe(std::function<void(ObserverDataMessage &)>) = 0;
     virtual void unsubscribe(uint32_t) = 0;
     virtual void notify(ObserverDataMessage &) = 0;
+    /*!
+        Calls all subscribers in parallel, each with its own copy of the frame message
+        tagged with its id. Returns how many there were, the ids of those that deferred
+        their result go to deferred_subscribers.
+    */
+    virtual std::size_t fan_out(const ObserverDataMessage &, std::vector<uint32_t> &deferred_subscribers) = 0;
 };
 
+/*!
+    Subscribers are published as an immutable snapshot. Subscribe and unsubscribe copy
+    the map under _mutex_publisher and swap it in, notify and fan_out take no mutex:
+    they count themselves as a reader of the current epoch, load the snapshot and
+    leave the count when done, a few atomic operations.
+    Replaced snapshots are kept until a grace period passed: unsubscribe moves on to
+    the next epoch and waits until no reader of the previous one is left, then frees
+    them. It returns once no notify or fan_out could still call the removed callback,
+    so it must not be called from inside a callback of the same observable.
+    fan_out runs the callbacks of its snapshot on the FanOutPool and joins them.
+*/
 class Observable : public IObservable
 {
 public:
-    Observable(){};
+    Observable();
+    ~Observable();
+    Observable(const Observable &) = delete;
+    Observable &operator=(const Observable &) = delete;
+
     uint32_t subscribe(std::function<void(ObserverDataMessage &)>) override;
     void unsubscribe(uint32_t callback_identifier) override;
     void notify(ObserverDataMessage &) override;
+    std::size_t fan_out(const ObserverDataMessage &, std::vector<uint32_t> &deferred_subscribers) override;
 
 private:
+    typedef std::map<uint32_t, std::function<void(ObserverDataMessage &)>> CallbacksMap;
+
+    // Reads the current snapshot, the caller counts as a reader of its epoch until destroyed
+    class reader_scope
+    {
+    public:
+        explicit reader_scope(Observable &observable);
+        ~reader_scope();
+        reader_scope(const reader_scope &) = delete;
+        reader_scope &operator=(const reader_scope &) = delete;
+
+        const CallbacksMap &callbacks() const { return *_snapshot; }
+
+    private:
+        std::atomic<uint64_t> *_readers;
+        const CallbacksMap *_snapshot;
+    };
+
+    // Publishes snapshot, the one it replaces is freed after the next grace period
+    void publish(std::unique_ptr<CallbacksMap> snapshot);
+
+    std::atomic<const CallbacksMap *> _callbacks_observers_map;
+    std::atomic<uint64_t> _epoch{0};
+    std::atomic<uint64_t> _readers[2];
+
     std::mutex _mutex_publisher;
-    std::map<uint32_t, std::function<void(ObserverDataMessage &)>> _callbacks_observers_map;
     uint32_t _counter = 0;
+    std::vector<std::unique_ptr<const CallbacksMap>> _retired; // Guarded by _mutex_publisher
 };
 } // namespace ProcessingUnit
@@ -14,6 +14,7 @@
 #include <string>
 #include <typeinfo>
 
+#include "observable.hpp"
 #include "json/jsonconfig.hpp"
 
 using namespace std;
@@ -2,6 +2,8 @@
 #define _OSPREY_WS_PROTOCOL_H_
 
 #include <msgpack.hpp>
+#include <atomic>
+#include <istream>
 #include <string>
 
 #include "json/jsonconfig.hpp"
@@ -21,6 +23,10 @@
     End (Processor -> Prism)
     // Continue is for both sides: any side receiving data should respond with continue
 
+    Any time, also on a connection without a job:
+    Stats (VMS -> processor), without stats, or {"dumpTrace": true} to also write the frame trace
+    Stats (Processor -> VMS), stats holds the load and free capacity of the processing unit
+
     We're not throwing errors everywhere, we simply made sure nothing crashes when wrong data is given.
     If exception handling is preferred, feel free to amend.
 
@@ -90,7 +96,9 @@ public:
         Data,
         Continue,
         End,
-        Unknown
+        Unknown,
+        // After Unknown, capture files store the numeric type
+        Stats
     };
 
     Message();
@@ -103,6 +111,7 @@ public:
     static std::string GetPreamble();
     static std::string GetPostamble();
     static std::string GetInfoLabel();
+    static std::string GetChannelLabel();
     static std::string GetPayloadLabel();
 
     bool IsStartMessage() const;
@@ -112,9 +121,14 @@ public:
 
     void SetMessageType(const std::string &MessageType);
 
+    // Job the message belongs to on a multiplexed connection, empty otherwise
+    std::string GetChannel() const { return m_Channel; }
+    void SetChannel(const std::string &Channel) { m_Channel = Channel; }
+
 private:
     //std::string m_MessageType;
     MessageType m_MessageType;
+    std::string m_Channel;
 };
 
 class StartMessage : public Message
@@ -124,6 +138,8 @@ public:
     StartMessage(const std::string &JobId, const json &Info);
     std::string GetJobId() const;
     json GetInfoJson() const; //<! todo not sure if this is good 'nough
+    // Resume token of an earlier Ready in the info, asks to reattach to that job
+    std::string GetResumeToken() const;
 
     void SetJobId(const std::string &JobId);
     void SetInfoJson(const json &Info);
@@ -145,10 +161,15 @@ public:
     DataMessage(const std::string &Metadata, const std::vector<unsigned char> &Payload);
     std::string GetMetaData() const;
     std::vector<char> GetPayloadData() const;
+    // The payload without copying it, valid as long as the message is
+    const std::vector<char> &GetPayload() const;
     std::size_t GetPayloadSize() const;
+    // Moves the payload out, the message is left without payload
+    std::vector<char> TakePayload();
 
     void SetMetadata(const std::string &Metadata);
     void SetPayload(const std::vector<char> &Payload);
+    void SetPayload(std::vector<char> &&Payload);
 
 private:
     std::string m_Metadata;
@@ -166,13 +187,21 @@ public:
     ReadyMessage(bool IsReady, const std::string &Description = "");
     bool IsReady() const;
     std::string GetDescription() const;
+    // Token to resume the job with after a reconnect, empty when the job can't be resumed
+    std::string GetResumeToken() const;
+    // True when the Start resumed a detached job instead of starting a new one
+    bool IsResumed() const;
 
     void SetIsReady(bool IsReady);
     void SetDescription(const std::string &Description);
+    void SetResumeToken(const std::string &ResumeToken);
+    void SetResumed(bool Resumed);
 
 private:
     bool m_IsReady;
     std::string m_Description;
+    std::string m_ResumeToken;
+    bool m_Resumed = false;
 };
 void to_json(nlohmann::json &J, const ReadyMessage &M);
 void from_json(const nlohmann::json &J, ReadyMessage &M);
@@ -203,6 +232,24 @@ void from_json(const nlohmann::json &J, EndMessage &M);
 
 /////////////////////////////////////////////////////////////
 
+class StatsMessage : public Message
+{
+public:
+    StatsMessage();
+    StatsMessage(const json &Stats);
+    // Null in a request
+    json GetStats() const;
+
+    void SetStats(const json &Stats);
+
+private:
+    json m_Stats;
+};
+void to_json(nlohmann::json &J, const StatsMessage &M);
+void from_json(const nlohmann::json &J, StatsMessage &M);
+
+/////////////////////////////////////////////////////////////
+
 class MessageReader
 {
 public:
@@ -213,21 +260,78 @@ public:
         depending on that type ask the proper getter like GetStartMessage or GetEndMessage or GetDataMessage
     */
     bool Parse(const std::string &Input);
+    /*!
+        Same as above but decodes the message while reading it from Input, the payload
+        is read straight into its buffer without first copying the whole message.
+        Only the map / str / bin subset of msgpack used by the protocol is understood.
+        Input must hold the whole message in its buffer, as a received websocket message
+        does: sizes beyond the bytes left in it or payloads over the maximum are rejected
+        before anything is allocated.
+    */
+    bool Parse(std::istream &Input);
+    /*!
+        Only reads the info and steps over the payload, for code that routes messages
+        by type and forwards their bytes as they are. GetDataMessage has no payload after it.
+    */
+    bool ParseInfo(std::istream &Input);
 
     Message::MessageType GetMessageType() const;
     std::unique_ptr<StartMessage> GetStartMessage() const;
     std::unique_ptr<EndMessage> GetEndMessage() const;
     std::unique_ptr<ReadyMessage> GetReadyMessage() const;
+    // Hands over the parsed payload, call it once per Parse
     std::unique_ptr<DataMessage> GetDataMessage();
     std::unique_ptr<ContinueMessage> GetContinueMessage() const;
+    std::unique_ptr<StatsMessage> GetStatsMessage() const;
 
     std::unique_ptr<Message> GetMessage() const;
 
+    // Channel in the info of the parsed message, empty for non multiplexed connections
+    std::string GetChannel() const;
+    // Payload bytes of the parsed Data message, 0 once GetDataMessage took them
+    std::size_t GetPayloadSize() const;
+
+    // Largest payload a streamed message may carry, 256 MiB by default
+    static void SetMaxPayloadSize(std::size_t Size);
+
 private:
+    bool ParseStream(std::istream &Input, bool KeepPayload);
+
+    static std::atomic<std::size_t> s_MaxPayloadSize;
+
     Message::MessageType m_CurrMessageType;
     nlohmann::json m_Json;
     std::vector<char> m_Payload;
 };
+
+/*!
+    Info json of a message as it goes on the wire, with the channel when it has one
+*/
+template <class CertainMessageType>
+json MessageInfoJson(const CertainMessageType &Msg)
+{
+    json JsonMessage = Msg;
+    if (!Msg.GetChannel().empty())
+    {
+        JsonMessage[Message::GetChannelLabel()] = Msg.GetChannel();
+    }
+    return JsonMessage;
+}
+
+/*!
+    Packs a DataMessage up to and including the bin header of its payload. The payload
+    bytes follow as they are, so a sender can write them from the message itself.
+*/
+template <typename Stream>
+void PackDataMessageHeader(msgpack::packer<Stream> &O, const DataMessage &Msg)
+{
+    json JsonMessage = MessageInfoJson(Msg);
+    O.pack_map(2);
+    O.pack(Message::GetInfoLabel());
+    O.pack(JsonMessage.dump(0));
+    O.pack(Message::GetPayloadLabel());
+    O.pack_bin(uint32_t(Msg.GetPayloadSize()));
+}
 } // namespace ProcessingUnit
 
 /////////////////////////////////////////////////////////////
@@ -244,7 +348,7 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
         template <typename Stream>
         packer<Stream> &operator()(msgpack::packer<Stream> &O, ProcessingUnit::StartMessage const &Msg) const
         {
-            json JsonMessage = Msg;
+            json JsonMessage = ProcessingUnit::MessageInfoJson(Msg);
             O.pack_map(1);
             O.pack(ProcessingUnit::Message::GetInfoLabel());
             O.pack(JsonMessage.dump(0));
@@ -259,7 +363,7 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
         template <typename Stream>
         packer<Stream> &operator()(msgpack::packer<Stream> &O, ProcessingUnit::ReadyMessage const &Msg) const
         {
-            json JsonMessage = Msg;
+            json JsonMessage = ProcessingUnit::MessageInfoJson(Msg);
             O.pack_map(1);
             O.pack(ProcessingUnit::Message::GetInfoLabel());
             O.pack(JsonMessage.dump(0));
@@ -274,12 +378,8 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
         template <typename Stream>
         packer<Stream> &operator()(msgpack::packer<Stream> &O, ProcessingUnit::DataMessage const &Msg) const
         {
-            json JsonMessage = Msg;
-            O.pack_map(2);
-            O.pack(ProcessingUnit::Message::GetInfoLabel());
-            O.pack(JsonMessage.dump(0));
-            O.pack(ProcessingUnit::Message::GetPayloadLabel());
-            O.pack(Msg.GetPayloadData());
+            ProcessingUnit::PackDataMessageHeader(O, Msg);
+            O.pack_bin_body(Msg.GetPayload().data(), uint32_t(Msg.GetPayloadSize()));
 
             return O;
         }
@@ -291,7 +391,7 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
         template <typename Stream>
         packer<Stream> &operator()(msgpack::packer<Stream> &O, ProcessingUnit::ContinueMessage const &Msg) const
         {
-            json JsonMessage = Msg;
+            json JsonMessage = ProcessingUnit::MessageInfoJson(Msg);
             O.pack_map(1);
             O.pack(ProcessingUnit::Message::GetInfoLabel());
             O.pack(JsonMessage.dump(0));
@@ -306,7 +406,22 @@ MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
         template <typename Stream>
         packer<Stream> &operator()(msgpack::packer<Stream> &O, ProcessingUnit::EndMessage const &Msg) const
         {
-            json JsonMessage = Msg;
+            json JsonMessage = ProcessingUnit::MessageInfoJson(Msg);
+            O.pack_map(1);
+            O.pack(ProcessingUnit::Message::GetInfoLabel());
+            O.pack(JsonMessage.dump(0));
+
+            return O;
+        }
+    };
+
+    template <>
+    struct pack<ProcessingUnit::StatsMessage>
+    {
+        template <typename Stream>
+        packer<Stream> &operator()(msgpack::packer<Stream> &O, ProcessingUnit::StatsMessage const &Msg) const
+        {
+            json JsonMessage = ProcessingUnit::MessageInfoJson(Msg);
             O.pack_map(1);
             O.pack(ProcessingUnit::Message::GetInfoLabel());
             O.pack(JsonMessage.dump(0));
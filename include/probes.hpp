@@ -0,0 +1,69 @@
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+#include <cstdint>
+#include <string>
+
+/*!
+    USDT probes on the frame path, for perf / bpftrace / systemtap on a running server.
+    Built in when sys/sdt.h is found (PU_HAVE_SDT), empty otherwise.
+
+    Every probe of the "processing_unit" provider carries the same four arguments:
+        arg0  connection id: address of the JobConnection (or other JobHost) of the job
+        arg1  job id, a C string
+        arg2  frame sequence number within the job, the message type for message probes,
+              the isReady flag for job_ready, the Continue count for continue probes
+        arg3  byte count: payload or message size, 0 where there is none
+
+    Each probe has a semaphore, its arguments are only evaluated while a tracer is
+    attached, so an idle probe costs a not taken branch. The library is static, the
+    probes end up in the server binary linking it, ./my_server below.
+
+    bpftrace -e 'usdt:./my_server:processing_unit:frame_enqueued { @t[arg0, arg2] = nsecs; }
+                 usdt:./my_server:processing_unit:processor_out /@t[arg0, arg2]/ {
+                     @us = hist((nsecs - @t[arg0, arg2]) / 1000); delete(@t[arg0, arg2]); }'
+*/
+#define PU_PROBE_LIST(X)   \
+    X(message_received)    \
+    X(job_start)           \
+    X(job_ready)           \
+    X(job_end_received)    \
+    X(job_end_sent)        \
+    X(frame_enqueued)      \
+    X(frame_dequeued)      \
+    X(processor_in)        \
+    X(processor_out)       \
+    X(continue_sent)       \
+    X(continue_received)   \
+    X(send_complete)
+
+#ifdef PU_HAVE_SDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PU_PROBE_SEMAPHORE_DECLARE(name) extern volatile unsigned short processing_unit_##name##_semaphore;
+extern "C"
+{
+    PU_PROBE_LIST(PU_PROBE_SEMAPHORE_DECLARE)
+}
+
+#define PU_PROBE_ENABLED(name) __builtin_expect(processing_unit_##name##_semaphore != 0, 0)
+#define PU_PROBE(name, Host, JobId, Seq, Bytes)                                                   \
+    do                                                                                            \
+    {                                                                                             \
+        if (PU_PROBE_ENABLED(name))                                                               \
+        {                                                                                         \
+            const std::string PuProbeJobId(JobId);                                                \
+            STAP_PROBE4(processing_unit, name, reinterpret_cast<uintptr_t>(Host),                 \
+                        PuProbeJobId.c_str(), static_cast<uint64_t>(Seq), static_cast<uint64_t>(Bytes)); \
+        }                                                                                         \
+    } while (0)
+#else
+#define PU_PROBE_ENABLED(name) false
+#define PU_PROBE(name, Host, JobId, Seq, Bytes) \
+    do                                          \
+    {                                           \
+    } while (0)
+#endif
+
+#endif // _PROBES_H_
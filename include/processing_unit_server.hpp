@@ -6,6 +6,7 @@
 #include <msgpack.hpp>
 #include <iostream>
 
+#include "json/jsonconfig.hpp"
 
 
 namespace ProcessingUnit
@@ -26,13 +27,41 @@ public:
 		} 
 	};
 
+	// Pool config file used to prewarm processors when the server starts
+	void SetProcessorPoolConfig(const std::string &ConfigPath) { _processor_pool_config = ConfigPath; }
+
+	// Records the traffic of every job to <Directory>/<jobId>-<time>.pucap, empty disables recording
+	void SetRecordingDirectory(const std::string &Directory);
+
+	// Default cpu / NUMA placement of the io, connection and processing threads, see thread_placement.hpp
+	void SetThreadPlacement(const json &Config);
+
+	// Load limits above which new jobs are refused, see admission_controller.hpp
+	void SetAdmissionLimits(const json &Limits);
+
+	// Budget for frame payloads queued across all jobs, see memory_governor.hpp
+	void SetMemoryBudget(const json &Config);
+
+	// How long jobs of dropped connections wait to be resumed, see session_registry.hpp
+	void SetSessionResumption(const json &Config);
+
+	// Chrome trace event timeline of the frame path, see frame_tracer.hpp
+	void SetFrameTracing(const json &Config);
+
+	// Tuning file applied at start and reloaded on SIGHUP, see tuning_config.hpp
+	bool LoadTuningConfig(const std::string &Path);
+
 	bool StartProcessingUnitServer();
 	void StopProcessingUnitServer();
 
+	// Runtime statistics of the shared processing resources
+	json GetStats() const;
+
 private:
 	VmsAgent *vmsAgent;
 	const std::string _host;
 	const int _port;
+	std::string _processor_pool_config;
 };
 
 } // namespace ProcessingUnit
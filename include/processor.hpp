@@ -0,0 +1,72 @@
+#ifndef _PROCESSOR_H_
+#define _PROCESSOR_H_
+
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "observable.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Processor that is driven directly by the framework instead of through the
+    input / processor result observables.
+
+    A processor implementation registers a factory under a name, a job selects it
+    through the "processor" field of the Start info:
+
+    ProcessorRegistry::Register("detector", [](const json &Config) {
+        return std::make_shared<Detector>(Config);
+    });
+*/
+class IProcessor
+{
+public:
+    virtual ~IProcessor() {}
+
+    // Process a single frame, an empty Output means there is no result for this frame
+    virtual void Process(const DataPtr &Input, DataPtr &Output) = 0;
+
+    // Process several frames in one call, Outputs[i] is the result of Inputs[i].
+    // Default implementation falls back to one Process call per frame.
+    virtual void ProcessBatch(const std::vector<DataPtr> &Inputs, std::vector<DataPtr> &Outputs);
+
+    // Called when the job using this instance ended and the instance goes back to the
+    // processor pool, clear per-stream state here (trackers, background models, ...)
+    virtual void Reset() {}
+};
+
+typedef std::function<std::shared_ptr<IProcessor>(const json &Config)> ProcessorFactory;
+
+class ProcessorRegistry
+{
+public:
+    static void Register(const std::string &Name, ProcessorFactory Factory);
+    static void Unregister(const std::string &Name);
+
+    // Name of the processor requested in the Start info, empty when none was requested
+    static std::string GetProcessorName(const json &Config);
+    static bool IsRegistered(const std::string &Name);
+
+    // Creates the processor requested in the Start info, nullptr when it isn't registered
+    static std::shared_ptr<IProcessor> Create(const json &Config);
+
+private:
+    ProcessorRegistry() {}
+
+    static ProcessorRegistry &getInstance()
+    {
+        static ProcessorRegistry instance;
+        return instance;
+    }
+
+    std::mutex m_Mutex;
+    std::map<std::string, ProcessorFactory> m_Factories;
+};
+} // namespace ProcessingUnit
+#endif // _PROCESSOR_H_
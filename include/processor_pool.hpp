@@ -0,0 +1,79 @@
+#ifndef _PROCESSOR_POOL_H_
+#define _PROCESSOR_POOL_H_
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "processor.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Cache of initialized processor instances keyed by the Start info. The hash of
+    the info only narrows the search, an instance is handed out on an equal info.
+    A Job takes an instance on Start and hands it back on End, so a reconnecting
+    camera with the same configuration skips model loading / calibration.
+
+    Only idle instances live in the pool, when there are more than the capacity
+    the least recently returned instance is destroyed.
+
+    Pool config file:
+    {
+        "capacity": 16,
+        "prewarm": [ { "info": { "processor": "detector", ... }, "count": 2 } ]
+    }
+*/
+class ProcessorPool
+{
+public:
+    // Idle instance for this Start info, or a freshly created one on a miss
+    static std::shared_ptr<IProcessor> Acquire(const json &Config);
+    // Returns an instance to the pool once its job ended
+    static void Release(const json &Config, std::shared_ptr<IProcessor> Processor);
+
+    // Creates the instances listed in the pool config file, returns false when the file is invalid
+    static bool Prewarm(const std::string &ConfigPath);
+    static void SetCapacity(std::size_t Capacity);
+    static void Clear();
+
+    static json GetStats();
+
+private:
+    struct PoolKey
+    {
+        std::size_t Hash;
+        std::string Config; // Dumped Start info
+        bool operator==(const PoolKey &Other) const { return Hash == Other.Hash && Config == Other.Config; }
+    };
+
+    struct IdleProcessor
+    {
+        PoolKey Key;
+        std::shared_ptr<IProcessor> Processor;
+    };
+
+    ProcessorPool() : m_Hits(0), m_Misses(0), m_Evictions(0) {}
+
+    static ProcessorPool &getInstance()
+    {
+        static ProcessorPool instance;
+        return instance;
+    }
+
+    static PoolKey MakeKey(const json &Config);
+    void Insert(const PoolKey &Key, std::shared_ptr<IProcessor> Processor);
+
+    std::mutex m_Mutex;
+    std::list<IdleProcessor> m_Idle; // most recently returned first
+    std::size_t m_Capacity = 8;
+
+    std::atomic<uint64_t> m_Hits;
+    std::atomic<uint64_t> m_Misses;
+    std::atomic<uint64_t> m_Evictions;
+};
+} // namespace ProcessingUnit
+#endif // _PROCESSOR_POOL_H_
@@ -0,0 +1,110 @@
+#ifndef _RADIOMETRIC_PREPROCESSOR_H_
+#define _RADIOMETRIC_PREPROCESSOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "observable.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+struct PreprocessSettings
+{
+    enum class PixelFormat
+    {
+        Mono8,
+        Mono16 // little endian, as sent by the cameras
+    };
+    enum class Agc
+    {
+        None,      // full range of the pixel format
+        Linear,    // stretch min..max of the frame
+        Histogram  // histogram equalization
+    };
+    enum class Resize
+    {
+        Nearest,
+        Bilinear
+    };
+    enum class OutputType
+    {
+        UInt8,  // 0..255
+        Float32 // 0..1
+    };
+    enum class Layout
+    {
+        Hwc,
+        Chw
+    };
+
+    std::size_t Width = 0;
+    std::size_t Height = 0;
+    PixelFormat Format = PixelFormat::Mono16;
+    Agc AgcMode = Agc::Linear;
+    Resize ResizeMode = Resize::Bilinear;
+    // 0 keeps the input size
+    std::size_t OutputWidth = 0;
+    std::size_t OutputHeight = 0;
+    OutputType Type = OutputType::Float32;
+    Layout TensorLayout = Layout::Chw;
+    // 3 replicates the gray image for networks trained on rgb
+    std::size_t Channels = 1;
+};
+
+/*!
+    Turns raw radiometric frames into the tensor a processor expects, so processors
+    don't each carry their own scalar conversion code. Runs in the Job between
+    readData and the processor.
+
+    Enabled per job through the Start info:
+    "preprocess": { "width": 640, "height": 512, "pixelFormat": "mono16", "agc": "linear",
+                    "resize": "bilinear", "outputWidth": 320, "outputHeight": 256,
+                    "outputType": "float32", "layout": "chw", "channels": 3 }
+
+    The frame is resized first and the AGC statistics are taken on the resized image.
+    Min / max search and the linear mapping use SSE2 or NEON. Histogram equalization
+    and resizing use lookup tables built once. All intermediate buffers live as long as
+    the preprocessor, so a stable stream doesn't allocate per frame.
+*/
+class RadiometricPreprocessor
+{
+public:
+    // Throws std::runtime_error on an invalid configuration
+    explicit RadiometricPreprocessor(const json &Config);
+
+    static bool IsRequested(const json &Config);
+
+    // Replaces Frame by the tensor, Frame's old buffer is kept for the next output
+    void Run(DataPtr &Frame);
+
+    const PreprocessSettings &GetSettings() const { return m_Settings; }
+    std::size_t GetOutputSize() const;
+
+private:
+    void BuildResizeTables();
+    void ResizeFrame(const uint16_t *Input);
+    void MapToOutput(const uint16_t *Input, std::size_t Pixels, char *Output);
+    void ExpandChannels(char *Output, std::size_t Pixels);
+
+    PreprocessSettings m_Settings;
+    std::size_t m_OutWidth = 0;
+    std::size_t m_OutHeight = 0;
+
+    // Resize tables: source index and fixed point weight per output column / row
+    std::vector<uint32_t> m_ColumnIndex;
+    std::vector<uint16_t> m_ColumnWeight;
+    std::vector<uint32_t> m_RowIndex;
+    std::vector<uint16_t> m_RowWeight;
+
+    std::vector<uint16_t> m_Widened;
+    std::vector<uint16_t> m_Resized;
+    std::vector<uint32_t> m_Histogram;
+    std::vector<float> m_Lut;
+    std::vector<char> m_Plane;
+    DataPtr m_Output;
+};
+} // namespace ProcessingUnit
+#endif // _RADIOMETRIC_PREPROCESSOR_H_
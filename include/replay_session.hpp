@@ -0,0 +1,72 @@
+#ifndef _REPLAY_SESSION_H_
+#define _REPLAY_SESSION_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "capture_reader.hpp"
+#include "job.hpp"
+#include "job_host.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+struct ReplayOptions
+{
+    // Feed frames at the pace they were recorded instead of as fast as the job takes them
+    bool RealTime = false;
+    // Pace multiplier for RealTime, 2.0 replays twice as fast as recorded
+    double Speed = 1.0;
+    // Number of times the Data frames of the capture are fed to the job
+    int Loops = 1;
+};
+
+/*!
+    Drives a Job straight from a capture file without any network: the recorded
+    Start creates the Job, recorded Data frames are fed to it and the recorded End
+    stops it. Flow control mimics a client, the next frame is only fed once the Job
+    sent Continue for the previous one.
+
+    ReplaySession Session("camera1.pucap");
+    json Report = Session.Run(); // fps, per frame latency percentiles, ...
+*/
+class ReplaySession : public JobHost
+{
+public:
+    ReplaySession(const std::string &CapturePath, const ReplayOptions &Options = ReplayOptions());
+
+    // Replays the whole capture, returns the report or a json with an "error" field
+    json Run();
+
+    std::string GetJobId() const override { return m_Reader.GetJobId(); }
+    void SendContinue() override;
+    void SendData(std::vector<char> &data) override;
+    void OnFrameProcessed(std::chrono::microseconds ProcessingTime) override;
+
+private:
+    void WaitForContinue();
+    void WaitUntilIdle();
+    json MakeReport(std::chrono::steady_clock::duration Elapsed);
+
+    const std::string m_CapturePath;
+    const ReplayOptions m_Options;
+    CaptureReader m_Reader;
+
+    std::mutex m_Protector;
+    std::condition_variable m_ConVar;
+    int m_Credits = 1;
+    std::deque<std::chrono::steady_clock::time_point> m_InFlight;
+    std::vector<uint64_t> m_LatenciesUs;
+    std::vector<uint64_t> m_ProcessingUs;
+    uint64_t m_FramesFed = 0;
+    uint64_t m_Results = 0;
+    uint64_t m_ResultBytes = 0;
+    uint64_t m_InputBytes = 0;
+};
+} // namespace ProcessingUnit
+#endif // _REPLAY_SESSION_H_
@@ -0,0 +1,77 @@
+#ifndef _SESSION_REGISTRY_H_
+#define _SESSION_REGISTRY_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "job_connection.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Keeps jobs whose websocket dropped alive for a grace period, so a client that
+    reconnects continues with the same processor state (trackers, background models)
+    and gets the results that were queued meanwhile, instead of a cold restart.
+
+    Ready carries a resume token, the client resumes by sending its Start again on the
+    new socket with "resumeToken" in the info. Jobs not resumed in time are ended.
+
+    {"gracePeriodSeconds": 30}, 0 ends jobs as soon as their socket closes
+*/
+class SessionRegistry
+{
+public:
+    static void SetResumption(const json &Config);
+    static bool IsEnabled();
+    static std::string NewToken();
+
+    // The socket of a resumable job closed, it was detached already
+    static void Park(std::shared_ptr<JobConnection> Session);
+    // Detached job with this token and job id, nullptr when there is none (anymore)
+    static std::shared_ptr<JobConnection> Claim(const std::string &Token, const std::string &JobId);
+    // Ends the job of a connection that is no longer used, it is destroyed once its threads are done
+    static void Retire(std::shared_ptr<JobConnection> Session);
+
+    // The jobs waiting to be resumed
+    static std::vector<std::shared_ptr<JobConnection>> GetParked();
+
+    static json GetStats();
+
+private:
+    struct ParkedSession
+    {
+        std::shared_ptr<JobConnection> Session;
+        std::chrono::steady_clock::time_point Expiry;
+    };
+
+    SessionRegistry();
+    ~SessionRegistry();
+
+    static SessionRegistry &getInstance()
+    {
+        static SessionRegistry instance;
+        return instance;
+    }
+
+    void Reap();
+
+    std::mutex m_Mutex;
+    std::condition_variable m_ConVarReaper;
+    bool m_Stop = false;
+    std::chrono::seconds m_GracePeriod;
+    std::map<std::string, ParkedSession> m_Parked;
+    std::vector<std::shared_ptr<JobConnection>> m_Retiring;
+    uint64_t m_ParkedTotal = 0;
+    uint64_t m_Resumed = 0;
+    uint64_t m_Expired = 0;
+    std::thread m_ReaperThread;
+};
+} // namespace ProcessingUnit
+#endif // _SESSION_REGISTRY_H_
@@ -0,0 +1,153 @@
+#ifndef _STREAM_RECORDER_H_
+#define _STREAM_RECORDER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "osprey_ws_protocol.hpp"
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Records the messages of a job to an append-only capture file (.pucap) so real
+    traffic can be replayed for benchmarking and debugging.
+
+    All integers are little-endian, every block starts on an 8 byte boundary so a
+    reader can map the file and use the structs and msgpack frames in place.
+
+    CaptureFileHeader                    (64 bytes, at offset 0)
+    {
+        CaptureRecordHeader              (24 bytes)
+        msgpack frame                    (Size bytes, exactly as sent on the websocket)
+        zero padding                     (up to the next multiple of 8)
+    } * FrameCount
+    CaptureIndexEntry * FrameCount       (16 bytes each, at IndexOffset)
+    CaptureFileTrailer                   (24 bytes, last bytes of the file)
+
+    Frame numbers count every recorded message (Start, Ready, Data, Continue, End) in
+    the order they were received or sent. To seek to frame N map the file, read the
+    trailer at FileSize - sizeof(CaptureFileTrailer) and use Index[N].Offset.
+    The index and trailer are written when the recorder closes. When a capture lacks
+    a valid trailer (process killed) the reader walks the record headers from
+    HeaderSize onwards, each record is sizeof(CaptureRecordHeader) + Size rounded up to 8.
+*/
+#pragma pack(push, 1)
+struct CaptureFileHeader
+{
+    char Magic[8];         // "PUCAP\0\0\0"
+    uint32_t Version;      // CaptureFormatVersion
+    uint32_t HeaderSize;   // sizeof(CaptureFileHeader), offset of the first record
+    uint64_t StartTimeNs;  // wall clock at recorder creation, ns since unix epoch
+    char JobId[40];        // zero padded, truncated when longer
+};
+
+struct CaptureRecordHeader
+{
+    uint32_t Magic;        // CaptureRecordMagic
+    uint8_t Direction;     // CaptureDirection
+    uint8_t MessageType;   // Message::MessageType
+    uint16_t Reserved;
+    uint64_t TimestampNs;  // since StartTimeNs
+    uint32_t Size;         // msgpack frame size in bytes
+    uint32_t Reserved2;
+};
+
+struct CaptureIndexEntry
+{
+    uint64_t Offset;       // file offset of the CaptureRecordHeader
+    uint64_t TimestampNs;
+};
+
+struct CaptureFileTrailer
+{
+    uint64_t IndexOffset;
+    uint64_t FrameCount;
+    uint32_t Magic;        // CaptureTrailerMagic
+    uint32_t Reserved;
+};
+#pragma pack(pop)
+
+const uint32_t CaptureFormatVersion = 1;
+const uint32_t CaptureRecordMagic = 0x52435550;  // "PUCR"
+const uint32_t CaptureTrailerMagic = 0x49435550; // "PUCI"
+const char CaptureFileMagic[8] = {'P', 'U', 'C', 'A', 'P', 0, 0, 0};
+
+enum CaptureDirection : uint8_t
+{
+    CaptureReceived = 0, // client -> processing unit
+    CaptureSent = 1      // processing unit -> client
+};
+
+class StreamRecorder
+{
+public:
+    StreamRecorder(const std::string &FilePath, const std::string &JobId);
+    ~StreamRecorder();
+    StreamRecorder(const StreamRecorder &) = delete;
+    StreamRecorder &operator=(const StreamRecorder &) = delete;
+
+    bool IsOpen() const { return m_isOpen; }
+
+    /*!
+        Queues a copy of the frame, the file is written from the recorder thread.
+        While more than the max queued bytes wait for a slow disk frames are dropped
+        and counted, the capture then has gaps and won't replay exactly.
+    */
+    void Record(CaptureDirection Direction, Message::MessageType Type, const char *Data, std::size_t Size);
+    // Same for a frame that is sent in two parts, they are recorded as one frame
+    void Record(CaptureDirection Direction, Message::MessageType Type, const char *Head, std::size_t HeadSize,
+                const char *Tail, std::size_t TailSize);
+
+    // Directory the captures are written to, recording is disabled while empty
+    static void SetOutputDirectory(const std::string &Directory);
+    static std::string GetOutputDirectory();
+    // Bound of the frames a recorder queues for its writer thread
+    static void SetMaxQueuedBytes(std::size_t MaxQueuedBytes);
+    // Recorder for this job when recording is enabled, the Start info can opt out with "record": false
+    static std::shared_ptr<StreamRecorder> Create(const std::string &JobId, const json &Config);
+
+    // Frames dropped over all recorders
+    static json GetStats();
+
+private:
+    struct PendingRecord
+    {
+        CaptureRecordHeader Header;
+        std::vector<char> Frame;
+    };
+
+    void Writing();
+    void Write(const PendingRecord &Record);
+    void WriteIndex();
+
+    std::ofstream m_File;
+    bool m_isOpen = false;
+    uint64_t m_Offset = 0;
+    std::vector<CaptureIndexEntry> m_Index;
+    const std::chrono::steady_clock::time_point m_Start;
+
+    std::mutex m_QueueProtector;
+    std::condition_variable m_ConVarQueue;
+    std::deque<PendingRecord> m_Queue;
+    std::size_t m_QueuedBytes = 0; // Includes frames being copied into the queue
+    uint64_t m_Dropped = 0;
+    bool m_isStopSignaled = false;
+    std::thread m_WriterThread;
+
+    static std::mutex s_DirectoryMutex;
+    static std::string s_OutputDirectory;
+    static std::atomic<std::size_t> s_MaxQueuedBytes;
+    static std::atomic<uint64_t> s_DroppedFrames;
+};
+} // namespace ProcessingUnit
+#endif // _STREAM_RECORDER_H_
@@ -0,0 +1,123 @@
+#ifndef _THREAD_PLACEMENT_H_
+#define _THREAD_PLACEMENT_H_
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    CPU / NUMA pinning of the threads we create.
+
+    Server wide defaults per thread role, set through ProcessingUnitServer::SetThreadPlacement:
+    {
+        "io":         { "policy": "node", "node": 0 },
+        "connection": { "policy": "node", "node": 0 },
+        "processing": { "policy": "spread", "numaLocalBuffers": true }
+    }
+    A job can override its processing thread in the Start info with the same
+    "threadPlacement": { "processing": { ... } } block.
+
+    Policies:
+    "none"    - leave placement to the OS (default)
+    "cpus"    - run on any of the listed "cpus": [0, 1, 2]
+    "node"    - run on any cpu of NUMA "node"
+    "spread"  - each new thread goes to the next NUMA node, round robin
+    "compact" - each new thread gets its own cpu, round robin over all cpus
+
+    "numaLocalBuffers" makes processing threads copy incoming payloads into memory
+    allocated on their own node when the frame was received on another node.
+*/
+enum class ThreadRole
+{
+    Io,
+    Connection,
+    Processing
+};
+
+struct PlacementPolicy
+{
+    enum Kind
+    {
+        None,
+        Cpus,
+        Node,
+        Spread,
+        Compact
+    };
+
+    Kind Policy = None;
+    std::vector<int> CpuList;
+    int NumaNode = -1;
+    bool NumaLocalBuffers = false;
+};
+
+class ThreadPlacement
+{
+public:
+    static void SetDefaults(const json &Config);
+    // Server default for the role, overridden by the "threadPlacement" block of a Start info
+    static PlacementPolicy GetPolicy(ThreadRole Role, const json &JobConfig = json());
+
+    // NUMA node of the cpu the calling thread runs on, -1 when unknown
+    static int CurrentNode();
+    // Nodes with cpus, their ids need not be contiguous
+    static int GetNodeCount();
+
+    // Pins an io thread of the websocket server the first time it calls in
+    static void PlaceIoThread();
+
+    static void CountCrossNodeFrame(std::size_t Bytes);
+    static json GetStats();
+
+    /*!
+        Pins the calling thread for its lifetime and keeps the per role / node thread
+        counts in the stats up to date.
+    */
+    class Scope
+    {
+    public:
+        Scope(ThreadRole Role, const PlacementPolicy &Policy);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+        // Node the thread was pinned to, -1 when it isn't bound to a single node
+        int GetNode() const { return m_Node; }
+
+    private:
+        ThreadRole m_Role;
+        int m_Node;
+    };
+
+private:
+    ThreadPlacement();
+
+    static ThreadPlacement &getInstance()
+    {
+        static ThreadPlacement instance;
+        return instance;
+    }
+
+    static PlacementPolicy ParsePolicy(const json &Config, const PlacementPolicy &Default);
+    std::vector<int> ResolveCpus(const PlacementPolicy &Policy, int &Node);
+    bool Pin(const std::vector<int> &Cpus);
+
+    std::mutex m_Mutex;
+    std::map<ThreadRole, PlacementPolicy> m_Defaults;
+    // Kernel node id to its cpus, nodes without cpus are left out
+    std::map<int, std::vector<int>> m_NodeCpus;
+    std::map<int, int> m_CpuToNode;
+    std::map<std::string, std::map<int, int>> m_ThreadsPerNode;
+    std::atomic<uint64_t> m_RoundRobin;
+    std::atomic<uint64_t> m_PinFailures;
+    std::atomic<uint64_t> m_CrossNodeFrames;
+    std::atomic<uint64_t> m_CrossNodeBytes;
+};
+} // namespace ProcessingUnit
+#endif // _THREAD_PLACEMENT_H_
@@ -0,0 +1,92 @@
+#ifndef _TUNING_CONFIG_H_
+#define _TUNING_CONFIG_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "json/jsonconfig.hpp"
+
+namespace ProcessingUnit
+{
+/*!
+    Server wide tuning file, one section per component:
+
+    {
+        "server": { "host": "", "port": 8080, "endpoint": "^/$", "ioThreads": 1 },
+        "logging": { "level": "info", "consoleLevel": "warn", "fileLevel": "trace", "file": "log.txt" },
+        "threadPlacement": { ... see thread_placement.hpp },
+        "processorPool": { "capacity": 4, "prewarm": "pool.json" },
+        "scheduling": { "slots": 8, "agingMs": 1000 },
+        "batching": { "maxBatchSize": 8, "maxWaitMs": 5 },
+        "pipeline": { "workers": 1, "queueSize": 4 },
+        "fanOutPool": { "workers": 4 },
+        "flowControl": { "sendHighWaterBytes": 16777216, "sendHighWaterMessages": 64, "sendFinRsvOpcode": 130 },
+        "admission": { ... see admission_controller.hpp },
+        "memory": { ... see memory_governor.hpp },
+        "sessions": { ... see session_registry.hpp },
+        "recording": { "directory": "", "maxQueuedBytes": 67108864 },
+        "protocol": { "maxPayloadBytes": 268435456 },
+        "tracing": { ... see frame_tracer.hpp }
+    }
+
+    batching, pipeline and flowControl are defaults, the Start info of a job overrides them.
+    The port given to ProcessingUnitServer wins over server.port, a different one is
+    logged and ignored.
+
+    On SIGHUP the file is read again and the sections that are safe to change on a
+    running server are applied: log levels, slots, pool capacity, batching, pipeline,
+    fan out workers, flow control, admission, memory, sessions, recording, protocol
+    and tracing. They take effect for new jobs, running jobs and their connections
+    are left alone.
+    server, threadPlacement, logging.file and processorPool.prewarm need a restart.
+*/
+class TuningConfig
+{
+public:
+    // Reads and applies the whole file, false when it can't be read or parsed
+    static bool Load(const std::string &Path);
+    // Reads the file again and applies the safe sections, false and the previous file
+    // stays current when it can't be read or a section is invalid
+    static bool Reload();
+    // Reloads whenever the process gets SIGHUP, until the process ends
+    static void WatchSighup();
+
+    // Current content of a section, a null json when it isn't configured
+    static json Get(const std::string &Section);
+    // Applies the log levels to the main logger, for when it is created after loading
+    static void ApplyLogLevels();
+
+    static json GetStats();
+
+private:
+    TuningConfig() {}
+    ~TuningConfig();
+
+    static TuningConfig &getInstance()
+    {
+        static TuningConfig instance;
+        return instance;
+    }
+
+    // Throws on an invalid section, Load and Reload commit the file only when it went through
+    void Apply(const json &Config, bool Startup);
+    static void ApplyLogLevels(const json &Logging);
+    void Watch();
+
+    std::mutex m_ReloadMutex;
+    std::mutex m_Mutex;
+    std::string m_Path;
+    json m_Config;
+    uint64_t m_Reloads = 0;
+    uint64_t m_Failures = 0;
+
+    std::mutex m_WatchMutex;
+    std::condition_variable m_ConVarWatch;
+    bool m_StopWatch = false;
+    std::thread m_WatchThread;
+};
+} // namespace ProcessingUnit
+#endif // _TUNING_CONFIG_H_
@@ -27,9 +27,12 @@ namespace ProcessingUnit
       bool start(
           const std::string& host,
           int port,
-          const std::string& endpoint_reg_ex = "^/$"
+          const std::string& endpoint_reg_ex = "^/$",
+          std::size_t io_threads = 1
           );
 
+      json GetStats() { return m_ConnectionManager.GetStats(); }
+
     private:
       enum class ConnectionState { socket_opened, job_started, job_started_end_received, job_work_finished, job_ended, error };
       typedef SimpleWeb::SocketServer<SimpleWeb::WS> WsServer;
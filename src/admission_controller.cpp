@@ -0,0 +1,151 @@
+#include "admission_controller.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+#include "load_monitor.hpp"
+
+namespace ProcessingUnit
+{
+const std::string MaxJobsLabel("maxJobs");
+const std::string MaxQueuedFramesLabel("maxQueuedFrames");
+const std::string MaxCpuUtilisationLabel("maxCpuUtilisation");
+const std::string MaxP99LatencyUsLabel("maxP99LatencyUs");
+
+void AdmissionController::SetLimits(const json &Limits)
+{
+    AdmissionLimits NewLimits;
+    if (Limits.is_object())
+    {
+        fetch(Limits, MaxJobsLabel, NewLimits.MaxJobs);
+        fetch(Limits, MaxQueuedFramesLabel, NewLimits.MaxQueuedFrames);
+        fetch(Limits, MaxCpuUtilisationLabel, NewLimits.MaxCpuUtilisation);
+        fetch(Limits, MaxP99LatencyUsLabel, NewLimits.MaxP99LatencyUs);
+    }
+
+    AdmissionController &Controller = getInstance();
+    std::lock_guard<std::mutex> lock(Controller.m_Mutex);
+    Controller.m_Limits = NewLimits;
+}
+
+AdmissionLimits AdmissionController::GetLimits()
+{
+    AdmissionController &Controller = getInstance();
+    std::lock_guard<std::mutex> lock(Controller.m_Mutex);
+    return Controller.m_Limits;
+}
+
+bool AdmissionController::Admit(std::string &Reason)
+{
+    AdmissionController &Controller = getInstance();
+    // Reserving first, concurrent Starts each see the ones before them
+    const uint64_t Reserved = ++Controller.m_Reserved;
+    if (Check(Reason, Reserved))
+    {
+        return true;
+    }
+    Controller.m_Reserved--;
+
+    Controller.m_Rejected++;
+    std::lock_guard<std::mutex> lock(Controller.m_Mutex);
+    Controller.m_LastRejection = Reason;
+    return false;
+}
+
+void AdmissionController::Confirm()
+{
+    AdmissionController &Controller = getInstance();
+    // The job counts in LoadMonitor's active jobs now
+    Controller.m_Reserved--;
+    Controller.m_Admitted++;
+}
+
+void AdmissionController::Withdraw()
+{
+    getInstance().m_Reserved--;
+}
+
+bool AdmissionController::WouldAdmit(std::string &Reason)
+{
+    return Check(Reason, getInstance().m_Reserved.load() + 1);
+}
+
+bool AdmissionController::Check(std::string &Reason, uint64_t Reserved)
+{
+    const AdmissionLimits Limits = GetLimits();
+    std::ostringstream Refusal;
+
+    const uint64_t ActiveJobs = LoadMonitor::GetActiveJobs();
+    const int64_t QueuedFrames = LoadMonitor::GetQueuedFrames();
+    if (Limits.MaxJobs && ActiveJobs + Reserved > Limits.MaxJobs)
+    {
+        Refusal << "Too many jobs: " << ActiveJobs << " running, " << Reserved - 1 << " starting, limit " << Limits.MaxJobs;
+    }
+    else if (Limits.MaxQueuedFrames && QueuedFrames > Limits.MaxQueuedFrames)
+    {
+        Refusal << "Too many queued frames: " << QueuedFrames << ", limit " << Limits.MaxQueuedFrames;
+    }
+    else if (Limits.MaxCpuUtilisation > 0.0 && LoadMonitor::GetCpuUtilisation() > Limits.MaxCpuUtilisation)
+    {
+        Refusal << "Cpu utilisation " << LoadMonitor::GetCpuUtilisation() << " above limit " << Limits.MaxCpuUtilisation;
+    }
+    else if (Limits.MaxP99LatencyUs && LoadMonitor::GetLatencyPercentileUs(0.99) > Limits.MaxP99LatencyUs)
+    {
+        Refusal << "Processing latency p99 " << LoadMonitor::GetLatencyPercentileUs(0.99) << "us above limit " << Limits.MaxP99LatencyUs << "us";
+    }
+
+    Reason = Refusal.str();
+    return Reason.empty();
+}
+
+json AdmissionController::GetCapacity()
+{
+    const AdmissionLimits Limits = GetLimits();
+    std::string Reason;
+    json Capacity;
+    Capacity["acceptingJobs"] = WouldAdmit(Reason);
+    if (!Reason.empty())
+    {
+        Capacity["reason"] = Reason;
+    }
+    // Only limits that are set have a headroom, the others are left out
+    if (Limits.MaxJobs)
+    {
+        const uint64_t ActiveJobs = LoadMonitor::GetActiveJobs() + getInstance().m_Reserved.load();
+        Capacity["freeJobs"] = ActiveJobs < Limits.MaxJobs ? Limits.MaxJobs - ActiveJobs : 0;
+    }
+    if (Limits.MaxQueuedFrames)
+    {
+        Capacity["freeQueuedFrames"] = std::max<int64_t>(Limits.MaxQueuedFrames - LoadMonitor::GetQueuedFrames(), 0);
+    }
+    if (Limits.MaxCpuUtilisation > 0.0)
+    {
+        Capacity["cpuHeadroom"] = std::max(Limits.MaxCpuUtilisation - LoadMonitor::GetCpuUtilisation(), 0.0);
+    }
+    if (Limits.MaxP99LatencyUs)
+    {
+        const uint64_t P99 = LoadMonitor::GetLatencyPercentileUs(0.99);
+        Capacity["latencyHeadroomUs"] = P99 < Limits.MaxP99LatencyUs ? Limits.MaxP99LatencyUs - P99 : 0;
+    }
+    return Capacity;
+}
+
+json AdmissionController::GetStats()
+{
+    AdmissionController &Controller = getInstance();
+    std::lock_guard<std::mutex> lock(Controller.m_Mutex);
+
+    json Limits;
+    Limits[MaxJobsLabel] = Controller.m_Limits.MaxJobs;
+    Limits[MaxQueuedFramesLabel] = Controller.m_Limits.MaxQueuedFrames;
+    Limits[MaxCpuUtilisationLabel] = Controller.m_Limits.MaxCpuUtilisation;
+    Limits[MaxP99LatencyUsLabel] = Controller.m_Limits.MaxP99LatencyUs;
+
+    json Stats;
+    Stats["limits"] = Limits;
+    Stats["admitted"] = Controller.m_Admitted.load();
+    Stats["rejected"] = Controller.m_Rejected.load();
+    Stats["lastRejection"] = Controller.m_LastRejection;
+    return Stats;
+}
+} // namespace ProcessingUnit
@@ -0,0 +1,237 @@
+#include "batch_scheduler.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+
+#include "spdlog/spdlog.h"
+#include "thread_placement.hpp"
+#include "tuning_config.hpp"
+
+namespace ProcessingUnit
+{
+const std::string BatchingLabel("batching");
+const std::string BatchKeyLabel("key");
+const std::string MaxBatchSizeLabel("maxBatchSize");
+const std::string MaxWaitMsLabel("maxWaitMs");
+
+std::mutex BatchScheduler::s_RegistryMutex;
+std::map<std::string, std::weak_ptr<BatchScheduler>> BatchScheduler::s_Registry;
+
+BatchScheduler::BatchScheduler(const std::string &Key, std::shared_ptr<IProcessor> Processor, const BatchSettings &Settings)
+    : m_Key(Key), m_Processor(Processor), m_Settings(Settings),
+      m_Batches(0), m_Frames(0), m_TotalQueueDelayUs(0), m_MaxQueueDelayUs(0), m_TotalProcessUs(0)
+{
+    spdlog::get("MainLogger")->info("[BatchScheduler]: created for key " + m_Key);
+    m_BatchThread = std::thread(&BatchScheduler::Run, this);
+}
+
+BatchScheduler::~BatchScheduler()
+{
+    std::unique_lock<std::mutex> queue_lock(m_QueueProtector);
+    m_isStopSignaled = true;
+    queue_lock.unlock();
+    m_ConVarQueue.notify_one();
+    m_BatchThread.join();
+    spdlog::get("MainLogger")->info("[BatchScheduler]: destroyed for key " + m_Key);
+}
+
+void BatchScheduler::Submit(DataPtr &Data, ResultCallback Callback)
+{
+    PendingFrame Frame;
+    Frame.Data.swap(Data);
+    Frame.Callback = Callback;
+    Frame.Enqueued = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> queue_lock(m_QueueProtector);
+    m_Queue.push_back(std::move(Frame));
+    queue_lock.unlock();
+    m_ConVarQueue.notify_one();
+}
+
+void BatchScheduler::Run()
+{
+    ThreadPlacement::Scope Placement(ThreadRole::Processing, ThreadPlacement::GetPolicy(ThreadRole::Processing));
+    while (true)
+    {
+        std::deque<PendingFrame> Batch;
+        {
+            std::unique_lock<std::mutex> queue_lock(m_QueueProtector);
+            m_ConVarQueue.wait(queue_lock, [&] { return m_isStopSignaled || !m_Queue.empty(); });
+            if (m_Queue.empty())
+            {
+                break;
+            }
+
+            // Wait for the batch to fill up, but never longer than the oldest frame is allowed to wait
+            const auto Deadline = m_Queue.front().Enqueued + m_Settings.MaxWait;
+            m_ConVarQueue.wait_until(queue_lock, Deadline, [&] {
+                return m_isStopSignaled || m_Queue.size() >= m_Settings.MaxBatchSize;
+            });
+
+            const std::size_t BatchSize = std::min(m_Queue.size(), m_Settings.MaxBatchSize);
+            for (std::size_t Index = 0; Index < BatchSize; ++Index)
+            {
+                Batch.push_back(std::move(m_Queue.front()));
+                m_Queue.pop_front();
+            }
+        }
+        RunBatch(Batch);
+    }
+}
+
+void BatchScheduler::RunBatch(std::deque<PendingFrame> &Batch)
+{
+    const auto Start = std::chrono::steady_clock::now();
+
+    std::vector<DataPtr> Inputs(Batch.size());
+    for (std::size_t Index = 0; Index < Batch.size(); ++Index)
+    {
+        Inputs[Index].swap(Batch[Index].Data);
+
+        const uint64_t DelayUs = std::chrono::duration_cast<std::chrono::microseconds>(Start - Batch[Index].Enqueued).count();
+        m_TotalQueueDelayUs += DelayUs;
+        uint64_t PrevMax = m_MaxQueueDelayUs.load();
+        while (DelayUs > PrevMax && !m_MaxQueueDelayUs.compare_exchange_weak(PrevMax, DelayUs))
+        {
+        }
+    }
+
+    std::vector<DataPtr> Outputs;
+    try
+    {
+        m_Processor->ProcessBatch(Inputs, Outputs);
+    }
+    catch (const std::exception &e)
+    {
+        spdlog::get("MainLogger")->error("[BatchScheduler]: processor failed for key " + m_Key + ": " + e.what());
+        Outputs.clear();
+    }
+    // Every job waits for its result, a missing output is delivered as an empty result
+    Outputs.resize(Batch.size());
+
+    m_TotalProcessUs += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Start).count();
+    m_Batches++;
+    m_Frames += Batch.size();
+
+    for (std::size_t Index = 0; Index < Batch.size(); ++Index)
+    {
+        try
+        {
+            Batch[Index].Callback(Outputs[Index]);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "[BatchScheduler]: Error: " << e.what() << std::endl;
+        }
+    }
+}
+
+json BatchScheduler::GetStats() const
+{
+    const uint64_t Batches = m_Batches.load();
+    const uint64_t Frames = m_Frames.load();
+    json Stats;
+    Stats["key"] = m_Key;
+    Stats["maxBatchSize"] = m_Settings.MaxBatchSize;
+    Stats["maxWaitUs"] = m_Settings.MaxWait.count();
+    Stats["batches"] = Batches;
+    Stats["frames"] = Frames;
+    Stats["avgBatchSize"] = Batches ? double(Frames) / Batches : 0.0;
+    Stats["avgBatchFill"] = Batches ? double(Frames) / (Batches * m_Settings.MaxBatchSize) : 0.0;
+    Stats["avgQueueDelayUs"] = Frames ? double(m_TotalQueueDelayUs.load()) / Frames : 0.0;
+    Stats["maxQueueDelayUs"] = m_MaxQueueDelayUs.load();
+    Stats["avgBatchProcessUs"] = Batches ? double(m_TotalProcessUs.load()) / Batches : 0.0;
+    return Stats;
+}
+
+bool BatchScheduler::IsRequested(const json &Config)
+{
+    return Config.is_object() && Config.count(BatchingLabel) != 0 && Config[BatchingLabel].is_object() &&
+           ProcessorRegistry::IsRegistered(ProcessorRegistry::GetProcessorName(Config));
+}
+
+std::string BatchScheduler::MakeKey(const json &Config)
+{
+    std::string Key;
+    fetch(Config[BatchingLabel], BatchKeyLabel, Key);
+    if (!Key.empty())
+    {
+        return Key;
+    }
+
+    // Jobs only share a batch when they run the same processor with the same configuration
+    json KeyConfig = Config;
+    KeyConfig.erase(BatchingLabel);
+    std::ostringstream KeyStream;
+    KeyStream << ProcessorRegistry::GetProcessorName(Config) << "/" << std::hex << std::hash<std::string>()(KeyConfig.dump());
+    return KeyStream.str();
+}
+
+BatchSettings BatchScheduler::ReadSettings(const json &Config)
+{
+    BatchSettings Settings;
+    int MaxWaitMs = int(Settings.MaxWait.count() / 1000);
+    const json Defaults = TuningConfig::Get(BatchingLabel);
+    fetch(Defaults, MaxBatchSizeLabel, Settings.MaxBatchSize);
+    fetch(Defaults, MaxWaitMsLabel, MaxWaitMs);
+    fetch(Config[BatchingLabel], MaxBatchSizeLabel, Settings.MaxBatchSize);
+    fetch(Config[BatchingLabel], MaxWaitMsLabel, MaxWaitMs);
+    Settings.MaxBatchSize = std::max<std::size_t>(Settings.MaxBatchSize, 1);
+    Settings.MaxWait = std::chrono::microseconds(std::max(MaxWaitMs, 0) * 1000);
+    return Settings;
+}
+
+std::shared_ptr<BatchScheduler> BatchScheduler::Acquire(const json &Config)
+{
+    const std::string Key = MakeKey(Config);
+    {
+        std::lock_guard<std::mutex> lock(s_RegistryMutex);
+        std::shared_ptr<BatchScheduler> Scheduler = s_Registry[Key].lock();
+        if (Scheduler)
+        {
+            return Scheduler;
+        }
+    }
+
+    // The first job of a key decides the batch settings and provides the processor instance.
+    // Loading the model takes long, the other Starts and the stats don't wait for it.
+    std::shared_ptr<IProcessor> Processor = ProcessorRegistry::Create(Config);
+    if (!Processor)
+    {
+        throw std::runtime_error("batching: processor '" + ProcessorRegistry::GetProcessorName(Config) + "' could not be created");
+    }
+    std::shared_ptr<BatchScheduler> Created = std::make_shared<BatchScheduler>(Key, Processor, ReadSettings(Config));
+
+    std::lock_guard<std::mutex> lock(s_RegistryMutex);
+    std::shared_ptr<BatchScheduler> Scheduler = s_Registry[Key].lock();
+    if (Scheduler)
+    {
+        // Another job of the key got there first, the batches go to its scheduler
+        return Scheduler;
+    }
+    s_Registry[Key] = Created;
+    return Created;
+}
+
+json BatchScheduler::GetAllStats()
+{
+    json Stats = json::array();
+    std::lock_guard<std::mutex> lock(s_RegistryMutex);
+    for (auto Iter = s_Registry.begin(); Iter != s_Registry.end();)
+    {
+        std::shared_ptr<BatchScheduler> Scheduler = Iter->second.lock();
+        if (Scheduler)
+        {
+            Stats.push_back(Scheduler->GetStats());
+            ++Iter;
+        }
+        else
+        {
+            Iter = s_Registry.erase(Iter);
+        }
+    }
+    return Stats;
+}
+} // namespace ProcessingUnit
@@ -0,0 +1,172 @@
+#include "capture_reader.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ProcessingUnit
+{
+CaptureReader::~CaptureReader()
+{
+    Close();
+}
+
+bool CaptureReader::Open(const std::string &FilePath)
+{
+    Close();
+
+#ifdef _WIN32
+    std::ifstream File(FilePath, std::ios::binary);
+    if (!File.is_open())
+    {
+        return false;
+    }
+    m_FileContents.assign(std::istreambuf_iterator<char>(File), std::istreambuf_iterator<char>());
+    m_Data = m_FileContents.data();
+    m_Size = m_FileContents.size();
+#else
+    const int Fd = ::open(FilePath.c_str(), O_RDONLY);
+    if (Fd < 0)
+    {
+        return false;
+    }
+    struct stat FileStat;
+    if (::fstat(Fd, &FileStat) != 0 || FileStat.st_size == 0)
+    {
+        ::close(Fd);
+        return false;
+    }
+    void *Mapping = ::mmap(nullptr, FileStat.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+    ::close(Fd);
+    if (Mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    m_Data = static_cast<const char *>(Mapping);
+    m_Size = FileStat.st_size;
+#endif
+
+    const CaptureFileHeader *Header = reinterpret_cast<const CaptureFileHeader *>(m_Data);
+    if (m_Size < sizeof(CaptureFileHeader) || std::memcmp(Header->Magic, CaptureFileMagic, sizeof(Header->Magic)) != 0 ||
+        Header->Version != CaptureFormatVersion)
+    {
+        Close();
+        return false;
+    }
+
+    if (!ReadIndex())
+    {
+        ScanRecords();
+    }
+    return true;
+}
+
+void CaptureReader::Close()
+{
+#ifdef _WIN32
+    m_FileContents.clear();
+#else
+    if (m_Data)
+    {
+        ::munmap(const_cast<char *>(m_Data), m_Size);
+    }
+#endif
+    m_Data = nullptr;
+    m_Size = 0;
+    m_HasIndex = false;
+    m_Offsets.clear();
+}
+
+bool CaptureReader::ReadIndex()
+{
+    if (m_Size < sizeof(CaptureFileHeader) + sizeof(CaptureFileTrailer))
+    {
+        return false;
+    }
+
+    CaptureFileTrailer Trailer;
+    std::memcpy(&Trailer, m_Data + m_Size - sizeof(CaptureFileTrailer), sizeof(Trailer));
+    const uint64_t IndexEnd = m_Size - sizeof(CaptureFileTrailer);
+    const uint64_t HeaderSize = reinterpret_cast<const CaptureFileHeader *>(m_Data)->HeaderSize;
+    // Written so that a corrupt trailer can't overflow the checks
+    if (Trailer.Magic != CaptureTrailerMagic || Trailer.IndexOffset < HeaderSize || Trailer.IndexOffset > IndexEnd ||
+        Trailer.FrameCount != (IndexEnd - Trailer.IndexOffset) / sizeof(CaptureIndexEntry) ||
+        (IndexEnd - Trailer.IndexOffset) % sizeof(CaptureIndexEntry) != 0)
+    {
+        return false;
+    }
+
+    std::vector<uint64_t> Offsets(Trailer.FrameCount);
+    for (uint64_t FrameNr = 0; FrameNr < Trailer.FrameCount; ++FrameNr)
+    {
+        CaptureIndexEntry Entry;
+        std::memcpy(&Entry, m_Data + Trailer.IndexOffset + FrameNr * sizeof(CaptureIndexEntry), sizeof(Entry));
+        // Every record has to lie between the file header and the index
+        if (Entry.Offset < HeaderSize || Entry.Offset > Trailer.IndexOffset ||
+            Trailer.IndexOffset - Entry.Offset < sizeof(CaptureRecordHeader))
+        {
+            return false;
+        }
+        const CaptureRecordHeader *Record = reinterpret_cast<const CaptureRecordHeader *>(m_Data + Entry.Offset);
+        if (Record->Magic != CaptureRecordMagic || Record->Size > Trailer.IndexOffset - Entry.Offset - sizeof(CaptureRecordHeader))
+        {
+            return false;
+        }
+        Offsets[FrameNr] = Entry.Offset;
+    }
+    m_Offsets.swap(Offsets);
+    m_HasIndex = true;
+    return true;
+}
+
+void CaptureReader::ScanRecords()
+{
+    // Recorder didn't close cleanly, rebuild the index from the record headers
+    uint64_t Offset = std::max<uint64_t>(reinterpret_cast<const CaptureFileHeader *>(m_Data)->HeaderSize, sizeof(CaptureFileHeader));
+    while (Offset <= m_Size && m_Size - Offset >= sizeof(CaptureRecordHeader))
+    {
+        const CaptureRecordHeader *Record = reinterpret_cast<const CaptureRecordHeader *>(m_Data + Offset);
+        const uint64_t FrameSize = sizeof(CaptureRecordHeader) + Record->Size;
+        if (Record->Magic != CaptureRecordMagic || FrameSize > m_Size - Offset)
+        {
+            break;
+        }
+        m_Offsets.push_back(Offset);
+        Offset += FrameSize + (8 - (FrameSize % 8)) % 8;
+    }
+}
+
+std::string CaptureReader::GetJobId() const
+{
+    if (!m_Data)
+    {
+        return "";
+    }
+    const CaptureFileHeader *Header = reinterpret_cast<const CaptureFileHeader *>(m_Data);
+    return std::string(Header->JobId, strnlen(Header->JobId, sizeof(Header->JobId)));
+}
+
+uint64_t CaptureReader::GetStartTimeNs() const
+{
+    return m_Data ? reinterpret_cast<const CaptureFileHeader *>(m_Data)->StartTimeNs : 0;
+}
+
+CaptureFrame CaptureReader::GetFrame(std::size_t FrameNr) const
+{
+    CaptureFrame Frame;
+    if (FrameNr < m_Offsets.size())
+    {
+        Frame.Header = reinterpret_cast<const CaptureRecordHeader *>(m_Data + m_Offsets[FrameNr]);
+        Frame.Data = m_Data + m_Offsets[FrameNr] + sizeof(CaptureRecordHeader);
+    }
+    return Frame;
+}
+} // namespace ProcessingUnit
@@ -0,0 +1,208 @@
+#include "channel_mux.hpp"
+
+#include <sstream>
+
+#include "spdlog/spdlog.h"
+#include "stream_recorder.hpp"
+#include "thread_placement.hpp"
+#include "load_monitor.hpp"
+#include "frame_tracer.hpp"
+
+namespace ProcessingUnit
+{
+const std::string MultiplexLabel("multiplex");
+// All channels of a socket share these, so they are larger than the per job defaults
+const std::size_t MuxSendHighWaterBytes = 64 * 1024 * 1024;
+const std::size_t MuxSendHighWaterMessages = 256;
+
+bool ChannelMux::IsRequested(const std::string &QueryString)
+{
+    std::istringstream Query(QueryString);
+    std::string Parameter;
+    while (std::getline(Query, Parameter, '&'))
+    {
+        if (Parameter == MultiplexLabel || Parameter == MultiplexLabel + "=1" || Parameter == MultiplexLabel + "=true")
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+ChannelMux::ChannelMux(ConnectionPtr Conn)
+    : m_Connection(Conn), m_SendHighWaterBytes(MuxSendHighWaterBytes), m_SendHighWaterMessages(MuxSendHighWaterMessages)
+{
+    m_OutputThread = std::thread(&ChannelMux::Output, this);
+}
+
+ChannelMux::~ChannelMux()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_SendState->Mutex);
+        m_Stop = true;
+    }
+    m_SendState->ConVarDrained.notify_all();
+    m_OutputThread.join();
+
+    // Channels still stopping their job wake us on the way out, they go before the rest of the mux
+    std::lock_guard<std::mutex> lock(m_ChannelsMutex);
+    m_Channels.clear();
+}
+
+void ChannelMux::OnMessage(std::shared_ptr<WsServer::Message> Message)
+{
+    std::string Bytes;
+    MessageReader Reader;
+    if (!JobConnection::ReadMessage(Message, Reader, Bytes, !StreamRecorder::GetOutputDirectory().empty()))
+    {
+        spdlog::get("MainLogger")->error("ChannelMux: could not parse message");
+        return;
+    }
+    const std::string Channel = Reader.GetChannel();
+    if (Reader.GetMessageType() == Message::Stats)
+    {
+        json Stats = m_StatsProvider ? m_StatsProvider() : GetLoad();
+        FrameTracer::HandleStatsRequest(Reader.GetStatsMessage()->GetStats(), Stats);
+        StatsMessage RespMsg(Stats);
+        RespMsg.SetChannel(Channel);
+        JobConnection::SendStatsReply(m_Connection, RespMsg, m_SendState);
+        return;
+    }
+
+    std::shared_ptr<JobConnection> Hosted;
+    {
+        std::lock_guard<std::mutex> lock(m_ChannelsMutex);
+        auto Iter = m_Channels.find(Channel);
+        if (Reader.GetMessageType() == Message::Start &&
+            (Iter == m_Channels.end() || Iter->second->GetState() == ConnectionState::job_ended))
+        {
+            std::shared_ptr<JobConnection> Opened = std::make_shared<JobConnection>();
+            Opened->InitHosted(m_Connection, Channel, m_SendState, [this] { Wake(); });
+            m_Channels[Channel] = Opened;
+            Iter = m_Channels.find(Channel);
+            m_OpenedChannels++;
+        }
+        if (Iter != m_Channels.end())
+        {
+            Hosted = Iter->second;
+        }
+    }
+    if (!Hosted)
+    {
+        spdlog::get("MainLogger")->error("ChannelMux: message for unknown channel '" + Channel + "'");
+        return;
+    }
+
+    // Unlocked: a Start creates the job and its processor, the output of the other channels goes on meanwhile.
+    // A broken stream only takes down its own channel, the other jobs on the socket go on.
+    try
+    {
+        Hosted->OnParsedMessage(Reader, Bytes);
+    }
+    catch (const std::exception &Exc)
+    {
+        m_ChannelErrors++;
+        spdlog::get("MainLogger")->error("ChannelMux: channel '" + Channel + "': " + Exc.what());
+    }
+}
+
+void ChannelMux::Wake()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_SendState->Mutex);
+        m_OutputPending = true;
+    }
+    m_SendState->ConVarDrained.notify_all();
+}
+
+void ChannelMux::Output()
+{
+    LoadMonitor::LiveThread Live;
+    ThreadPlacement::Scope Placement(ThreadRole::Connection, ThreadPlacement::GetPolicy(ThreadRole::Connection));
+    FrameTracer::SetThreadName("mux_output");
+    std::unique_lock<std::mutex> lock(m_SendState->Mutex);
+    auto has_capacity = [&] {
+        return m_SendState->OutstandingBytes < m_SendHighWaterBytes &&
+               m_SendState->OutstandingMessages < m_SendHighWaterMessages;
+    };
+    while (!m_Stop)
+    {
+        if (m_OutputPending && !has_capacity())
+        {
+            m_SendState->HighWaterStalls++;
+        }
+        m_SendState->ConVarDrained.wait(lock, [&] { return m_Stop || (m_OutputPending && has_capacity()); });
+        if (m_Stop)
+        {
+            break;
+        }
+        m_OutputPending = false;
+        lock.unlock();
+        const bool Sent = PumpChannels();
+        lock.lock();
+        if (Sent)
+        {
+            // Channels may have more queued, go round again
+            m_OutputPending = true;
+        }
+    }
+}
+
+bool ChannelMux::PumpChannels()
+{
+    bool Sent = false;
+    std::lock_guard<std::mutex> lock(m_ChannelsMutex);
+    for (auto Iter = m_Channels.begin(); Iter != m_Channels.end();)
+    {
+        if (Iter->second->PumpOutput())
+        {
+            Sent = true;
+        }
+        if (Iter->second->GetState() == ConnectionState::job_ended)
+        {
+            Iter = m_Channels.erase(Iter);
+        }
+        else
+        {
+            ++Iter;
+        }
+    }
+    return Sent;
+}
+
+json ChannelMux::GetLoad()
+{
+    json Load = json::array();
+    std::lock_guard<std::mutex> lock(m_ChannelsMutex);
+    for (auto Iter = m_Channels.begin(); Iter != m_Channels.end(); ++Iter)
+    {
+        Load.push_back(Iter->second->GetLoad());
+    }
+    return Load;
+}
+
+json ChannelMux::GetStats()
+{
+    json Stats;
+    Stats["multiplexed"] = true;
+    json Channels = json::array();
+    {
+        std::lock_guard<std::mutex> lock(m_ChannelsMutex);
+        for (auto Iter = m_Channels.begin(); Iter != m_Channels.end(); ++Iter)
+        {
+            Channels.push_back(Iter->second->GetStats());
+        }
+        Stats["openedChannels"] = m_OpenedChannels;
+        Stats["channelErrors"] = m_ChannelErrors.load();
+    }
+    Stats["channels"] = Channels;
+    std::lock_guard<std::mutex> lock(m_SendState->Mutex);
+    Stats["sendOutstandingBytes"] = m_SendState->OutstandingBytes;
+    Stats["sendOutstandingMessages"] = m_SendState->OutstandingMessages;
+    Stats["sendHighWaterStalls"] = m_SendState->HighWaterStalls;
+    Stats["sentBytes"] = m_SendState->SentBytes;
+    Stats["sentMessages"] = m_SendState->SentMessages;
+    Stats["sendErrors"] = m_SendState->SendErrors;
+    return Stats;
+}
+} // namespace ProcessingUnit
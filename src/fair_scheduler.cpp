@@ -0,0 +1,230 @@
+#include "fair_scheduler.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace ProcessingUnit
+{
+const std::string PriorityLabel("priority");
+const std::string WeightLabel("weight");
+const std::chrono::milliseconds DefaultAging(1000);
+
+FairScheduler::FairScheduler() : m_Slots(std::max(1u, std::thread::hardware_concurrency())), m_Aging(DefaultAging)
+{
+}
+
+FairScheduler::JobHandle FairScheduler::Register(const std::string &JobId, const json &Config)
+{
+    JobEntry Entry;
+    Entry.JobId = JobId;
+    if (Config.is_object())
+    {
+        fetch(Config, PriorityLabel, Entry.Priority);
+        fetch(Config, WeightLabel, Entry.Weight);
+    }
+    Entry.Weight = std::max(Entry.Weight, 0.01);
+
+    FairScheduler &Scheduler = getInstance();
+    std::lock_guard<std::mutex> lock(Scheduler.m_Mutex);
+    // New jobs start at the current virtual time, they don't get credit for the past
+    Entry.VirtualTime = Scheduler.m_VirtualClock;
+    const JobHandle Handle = Scheduler.m_NextHandle++;
+    Scheduler.m_Jobs[Handle] = Entry;
+    return Handle;
+}
+
+void FairScheduler::Unregister(JobHandle Handle)
+{
+    FairScheduler &Scheduler = getInstance();
+    std::unique_lock<std::mutex> lock(Scheduler.m_Mutex);
+    Scheduler.m_Jobs.erase(Handle);
+    lock.unlock();
+    Scheduler.m_ConVarSlots.notify_all();
+}
+
+int64_t FairScheduler::EffectivePriority(const JobEntry &Entry, std::chrono::steady_clock::time_point Now) const
+{
+    if (!Entry.Waiting || m_Aging.count() <= 0)
+    {
+        return Entry.Priority;
+    }
+    return Entry.Priority + (Now - Entry.WaitStart) / m_Aging;
+}
+
+bool FairScheduler::IsNext(JobHandle Handle, std::chrono::steady_clock::time_point Now) const
+{
+    const JobEntry &Candidate = m_Jobs.at(Handle);
+    const int64_t CandidatePriority = EffectivePriority(Candidate, Now);
+    for (auto Iter = m_Jobs.begin(); Iter != m_Jobs.end(); ++Iter)
+    {
+        const JobEntry &Other = Iter->second;
+        if (Iter->first == Handle || !Other.Waiting)
+        {
+            continue;
+        }
+        const int64_t OtherPriority = EffectivePriority(Other, Now);
+        if (OtherPriority > CandidatePriority ||
+            (OtherPriority == CandidatePriority && Other.VirtualTime < Candidate.VirtualTime) ||
+            (OtherPriority == CandidatePriority && Other.VirtualTime == Candidate.VirtualTime && Iter->first < Handle))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FairScheduler::Acquire(JobHandle Handle)
+{
+    FairScheduler &Scheduler = getInstance();
+    std::unique_lock<std::mutex> lock(Scheduler.m_Mutex);
+    auto Iter = Scheduler.m_Jobs.find(Handle);
+    if (Iter == Scheduler.m_Jobs.end())
+    {
+        Scheduler.m_Busy++;
+        return true;
+    }
+
+    JobEntry &Entry = Iter->second;
+    if (Entry.Cancelled)
+    {
+        return false;
+    }
+    // A job that was idle doesn't get to catch up on the time it didn't use
+    Entry.VirtualTime = std::max(Entry.VirtualTime, Scheduler.m_VirtualClock);
+
+    const auto WaitStart = std::chrono::steady_clock::now();
+    const bool Contended = Scheduler.m_Busy >= Scheduler.m_Slots;
+    if (Entry.Waiting++ == 0)
+    {
+        Entry.WaitStart = WaitStart;
+    }
+    Scheduler.m_ConVarSlots.wait(lock, [&] {
+        return Entry.Cancelled || (Scheduler.m_Busy < Scheduler.m_Slots && Scheduler.IsNext(Handle, std::chrono::steady_clock::now()));
+    });
+    if (Entry.Cancelled)
+    {
+        Entry.Waiting--;
+        return false;
+    }
+    // The other waiters of the job age from this grant on, a job with steady waiters
+    // mustn't climb above every priority
+    Entry.Waiting--;
+    Entry.WaitStart = std::chrono::steady_clock::now();
+    Scheduler.m_Busy++;
+    // Only the next job passes the wait, with slots left over the one after it may go too
+    const bool SlotsLeft = Scheduler.m_Busy < Scheduler.m_Slots;
+    Scheduler.m_VirtualClock = std::max(Scheduler.m_VirtualClock, Entry.VirtualTime);
+
+    const uint64_t WaitUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - WaitStart).count();
+    Entry.Grants++;
+    Entry.TotalWaitUs += WaitUs;
+    Entry.MaxWaitUs = std::max(Entry.MaxWaitUs, WaitUs);
+    if (Contended)
+    {
+        Scheduler.m_ContendedGrants++;
+    }
+    lock.unlock();
+    if (SlotsLeft)
+    {
+        Scheduler.m_ConVarSlots.notify_all();
+    }
+    return true;
+}
+
+void FairScheduler::Release(JobHandle Handle, std::chrono::microseconds Used)
+{
+    FairScheduler &Scheduler = getInstance();
+    std::unique_lock<std::mutex> lock(Scheduler.m_Mutex);
+    Scheduler.m_Busy--;
+    auto Iter = Scheduler.m_Jobs.find(Handle);
+    if (Iter != Scheduler.m_Jobs.end())
+    {
+        Iter->second.UsedUs += Used.count();
+        Iter->second.VirtualTime += Used.count() / Iter->second.Weight;
+    }
+    lock.unlock();
+    Scheduler.m_ConVarSlots.notify_all();
+}
+
+void FairScheduler::Cancel(JobHandle Handle)
+{
+    FairScheduler &Scheduler = getInstance();
+    std::unique_lock<std::mutex> lock(Scheduler.m_Mutex);
+    auto Iter = Scheduler.m_Jobs.find(Handle);
+    if (Iter == Scheduler.m_Jobs.end())
+    {
+        return;
+    }
+    Iter->second.Cancelled = true;
+    lock.unlock();
+    Scheduler.m_ConVarSlots.notify_all();
+}
+
+void FairScheduler::SetSlots(std::size_t Slots)
+{
+    FairScheduler &Scheduler = getInstance();
+    std::unique_lock<std::mutex> lock(Scheduler.m_Mutex);
+    Scheduler.m_Slots = std::max<std::size_t>(Slots, 1);
+    lock.unlock();
+    Scheduler.m_ConVarSlots.notify_all();
+}
+
+void FairScheduler::SetAging(std::chrono::milliseconds Aging)
+{
+    FairScheduler &Scheduler = getInstance();
+    std::unique_lock<std::mutex> lock(Scheduler.m_Mutex);
+    Scheduler.m_Aging = std::max(Aging, std::chrono::milliseconds(0));
+    lock.unlock();
+    Scheduler.m_ConVarSlots.notify_all();
+}
+
+json FairScheduler::GetStats()
+{
+    FairScheduler &Scheduler = getInstance();
+    std::lock_guard<std::mutex> lock(Scheduler.m_Mutex);
+
+    uint64_t TotalUsedUs = 0;
+    for (auto Iter = Scheduler.m_Jobs.begin(); Iter != Scheduler.m_Jobs.end(); ++Iter)
+    {
+        TotalUsedUs += Iter->second.UsedUs;
+    }
+
+    json Jobs = json::array();
+    for (auto Iter = Scheduler.m_Jobs.begin(); Iter != Scheduler.m_Jobs.end(); ++Iter)
+    {
+        const JobEntry &Entry = Iter->second;
+        json Job;
+        Job["jobId"] = Entry.JobId;
+        Job["priority"] = Entry.Priority;
+        Job["weight"] = Entry.Weight;
+        Job["frames"] = Entry.Grants;
+        Job["processorUs"] = Entry.UsedUs;
+        Job["share"] = TotalUsedUs ? double(Entry.UsedUs) / TotalUsedUs : 0.0;
+        Job["avgWaitUs"] = Entry.Grants ? double(Entry.TotalWaitUs) / Entry.Grants : 0.0;
+        Job["maxWaitUs"] = Entry.MaxWaitUs;
+        Jobs.push_back(Job);
+    }
+
+    json Stats;
+    Stats["slots"] = Scheduler.m_Slots;
+    Stats["busy"] = Scheduler.m_Busy;
+    Stats["agingMs"] = Scheduler.m_Aging.count();
+    Stats["contendedGrants"] = Scheduler.m_ContendedGrants;
+    Stats["jobs"] = Jobs;
+    return Stats;
+}
+
+FairScheduler::Grant::Grant(JobHandle Handle) : m_Handle(Handle), m_Granted(Acquire(Handle))
+{
+    m_Start = std::chrono::steady_clock::now();
+}
+
+FairScheduler::Grant::~Grant()
+{
+    if (!m_Granted)
+    {
+        return;
+    }
+    Release(m_Handle, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_Start));
+}
+} // namespace ProcessingUnit
@@ -0,0 +1,212 @@
+#include "fan_out.hpp"
+
+#include <algorithm>
+#include <msgpack.hpp>
+
+#include "spdlog/spdlog.h"
+#include "frame_tracer.hpp"
+#include "load_monitor.hpp"
+#include "thread_placement.hpp"
+
+namespace ProcessingUnit
+{
+const std::string FanOutLabel("fanOut");
+const std::string WorkersLabel("workers");
+const std::string ResultTimeoutMsLabel("resultTimeoutMs");
+const std::size_t DefaultFanOutWorkers = 4;
+const std::chrono::milliseconds DefaultResultTimeout(1000);
+
+FanOutPool::FanOutPool() : m_TargetWorkers(DefaultFanOutWorkers)
+{
+}
+
+FanOutPool::~FanOutPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_ConVarWork.notify_all();
+    for (std::thread &Thread : m_Workers)
+    {
+        Thread.join();
+    }
+}
+
+void FanOutPool::SetWorkers(const json &Config)
+{
+    FanOutPool &Pool = getInstance();
+    std::lock_guard<std::mutex> lock(Pool.m_Mutex);
+    std::size_t Workers = Pool.m_TargetWorkers;
+    fetch(Config, WorkersLabel, Workers);
+    Workers = std::max<std::size_t>(Workers, 1);
+    if (!Pool.m_Workers.empty() && Workers > Pool.m_Workers.size())
+    {
+        Pool.StartWorkers(Workers - Pool.m_Workers.size());
+    }
+    else if (Workers < Pool.m_Workers.size())
+    {
+        spdlog::get("MainLogger")->warn("[FanOutPool]: fewer workers take effect after a restart");
+    }
+    Pool.m_TargetWorkers = Workers;
+}
+
+void FanOutPool::StartWorkers(std::size_t Workers)
+{
+    for (std::size_t Index = 0; Index < Workers; ++Index)
+    {
+        m_Workers.emplace_back(&FanOutPool::Worker, this);
+    }
+}
+
+void FanOutPool::Run(std::vector<std::function<void()>> &Tasks)
+{
+    FanOutPool &Pool = getInstance();
+    if (Tasks.empty())
+    {
+        return;
+    }
+    Pool.m_FanOuts++;
+    Pool.m_Tasks += Tasks.size();
+    if (Tasks.size() == 1)
+    {
+        Pool.m_TasksOnCaller++;
+        Tasks.front()();
+        return;
+    }
+
+    std::shared_ptr<Batch> Work = std::make_shared<Batch>();
+    Work->Tasks = &Tasks;
+    Work->Count = Tasks.size();
+    {
+        std::lock_guard<std::mutex> lock(Pool.m_Mutex);
+        if (Pool.m_Workers.empty())
+        {
+            Pool.StartWorkers(Pool.m_TargetWorkers);
+        }
+        // One entry per task left to the workers, the caller takes the first one itself
+        for (std::size_t Index = 1; Index < Tasks.size(); ++Index)
+        {
+            Pool.m_Queue.push_back(Work);
+        }
+    }
+    Pool.m_ConVarWork.notify_all();
+
+    Pool.m_TasksOnCaller += Drain(*Work);
+    std::unique_lock<std::mutex> lock(Work->Mutex);
+    Work->ConVarDone.wait(lock, [&] { return Work->Done == Work->Count; });
+    if (Work->Error)
+    {
+        Pool.m_Errors++;
+        std::rethrow_exception(Work->Error);
+    }
+}
+
+std::size_t FanOutPool::Drain(Batch &Work)
+{
+    std::size_t Ran = 0;
+    while (true)
+    {
+        // Tasks is only touched for claimed indices, Run doesn't return before they are done
+        const std::size_t Index = Work.Next++;
+        if (Index >= Work.Count)
+        {
+            break;
+        }
+        std::exception_ptr Error;
+        try
+        {
+            (*Work.Tasks)[Index]();
+        }
+        catch (...)
+        {
+            Error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(Work.Mutex);
+            if (Error && !Work.Error)
+            {
+                Work.Error = Error;
+            }
+            Work.Done++;
+        }
+        Work.ConVarDone.notify_all();
+        Ran++;
+    }
+    return Ran;
+}
+
+void FanOutPool::Worker()
+{
+    LoadMonitor::LiveThread Live;
+    ThreadPlacement::Scope Placement(ThreadRole::Processing, ThreadPlacement::GetPolicy(ThreadRole::Processing));
+    FrameTracer::SetThreadName("fan_out");
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (true)
+    {
+        m_ConVarWork.wait(lock, [&] { return m_Stop || !m_Queue.empty(); });
+        if (m_Queue.empty())
+        {
+            break;
+        }
+        // The batch may be done already, the caller drained it meanwhile
+        std::shared_ptr<Batch> Work = m_Queue.front();
+        m_Queue.pop_front();
+        lock.unlock();
+        Drain(*Work);
+        lock.lock();
+    }
+}
+
+json FanOutPool::GetStats()
+{
+    FanOutPool &Pool = getInstance();
+    json Stats;
+    {
+        std::lock_guard<std::mutex> lock(Pool.m_Mutex);
+        Stats["workers"] = Pool.m_Workers.size();
+        Stats["queued"] = Pool.m_Queue.size();
+    }
+    Stats["fanOuts"] = Pool.m_FanOuts.load();
+    Stats["tasks"] = Pool.m_Tasks.load();
+    Stats["tasksOnCaller"] = Pool.m_TasksOnCaller.load();
+    Stats["errors"] = Pool.m_Errors.load();
+    return Stats;
+}
+
+FanOut::FanOut(const json &Config) : m_ResultTimeout(DefaultResultTimeout)
+{
+    if (Config.is_object() && Config.count(FanOutLabel) && Config[FanOutLabel].is_object())
+    {
+        int64_t ResultTimeoutMs = m_ResultTimeout.count();
+        fetch(Config[FanOutLabel], ResultTimeoutMsLabel, ResultTimeoutMs);
+        m_ResultTimeout = std::chrono::milliseconds(std::max<int64_t>(ResultTimeoutMs, 0));
+    }
+}
+
+bool FanOut::IsRequested(const json &Config)
+{
+    return Config.is_object() && Config.count(FanOutLabel) && Config[FanOutLabel].is_object();
+}
+
+DataPtr FanOut::Merge(const std::vector<DataPtr> &Results)
+{
+    const std::size_t Count = std::count_if(Results.begin(), Results.end(), [](const DataPtr &Result) { return !Result.empty(); });
+    if (Count == 0)
+    {
+        return DataPtr();
+    }
+    msgpack::sbuffer Buffer;
+    msgpack::packer<msgpack::sbuffer> Packer(Buffer);
+    Packer.pack_array(Count);
+    for (const DataPtr &Result : Results)
+    {
+        if (!Result.empty())
+        {
+            Packer.pack_bin(Result.size());
+            Packer.pack_bin_body(Result.data(), Result.size());
+        }
+    }
+    return DataPtr(Buffer.data(), Buffer.data() + Buffer.size());
+}
+} // namespace ProcessingUnit
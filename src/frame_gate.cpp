@@ -0,0 +1,164 @@
+#include "frame_gate.hpp"
+
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PU_FRAME_GATE_X86
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define PU_FRAME_GATE_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PU_FRAME_GATE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace ProcessingUnit
+{
+const std::string FrameGateLabel("frameGate");
+const std::string ThresholdLabel("threshold");
+const std::string MaxSkippedLabel("maxSkipped");
+
+// Bytes compared between early exit checks
+const std::size_t SadBlockSize = 64 * 1024;
+
+std::atomic<uint64_t> FrameGate::s_Checked(0);
+std::atomic<uint64_t> FrameGate::s_Skipped(0);
+
+static uint64_t SumAbsDiffScalar(const uint8_t *A, const uint8_t *B, std::size_t Size)
+{
+    uint64_t Sum = 0;
+    for (std::size_t Index = 0; Index < Size; ++Index)
+    {
+        Sum += A[Index] > B[Index] ? A[Index] - B[Index] : B[Index] - A[Index];
+    }
+    return Sum;
+}
+
+#if defined(PU_FRAME_GATE_X86)
+static uint64_t SumAbsDiffSse2(const uint8_t *A, const uint8_t *B, std::size_t Size)
+{
+    __m128i Sum = _mm_setzero_si128();
+    std::size_t Index = 0;
+    for (; Index + 16 <= Size; Index += 16)
+    {
+        const __m128i VecA = _mm_loadu_si128(reinterpret_cast<const __m128i *>(A + Index));
+        const __m128i VecB = _mm_loadu_si128(reinterpret_cast<const __m128i *>(B + Index));
+        Sum = _mm_add_epi64(Sum, _mm_sad_epu8(VecA, VecB));
+    }
+    uint64_t Lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(Lanes), Sum);
+    return Lanes[0] + Lanes[1] + SumAbsDiffScalar(A + Index, B + Index, Size - Index);
+}
+#endif
+
+#if defined(PU_FRAME_GATE_AVX2)
+static __attribute__((target("avx2"))) uint64_t SumAbsDiffAvx2(const uint8_t *A, const uint8_t *B, std::size_t Size)
+{
+    __m256i Sum = _mm256_setzero_si256();
+    std::size_t Index = 0;
+    for (; Index + 32 <= Size; Index += 32)
+    {
+        const __m256i VecA = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(A + Index));
+        const __m256i VecB = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(B + Index));
+        Sum = _mm256_add_epi64(Sum, _mm256_sad_epu8(VecA, VecB));
+    }
+    uint64_t Lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(Lanes), Sum);
+    return Lanes[0] + Lanes[1] + Lanes[2] + Lanes[3] + SumAbsDiffScalar(A + Index, B + Index, Size - Index);
+}
+#endif
+
+#if defined(PU_FRAME_GATE_NEON)
+static uint64_t SumAbsDiffNeon(const uint8_t *A, const uint8_t *B, std::size_t Size)
+{
+    uint64x2_t Sum = vdupq_n_u64(0);
+    std::size_t Index = 0;
+    for (; Index + 16 <= Size; Index += 16)
+    {
+        const uint8x16_t Diff = vabdq_u8(vld1q_u8(A + Index), vld1q_u8(B + Index));
+        Sum = vpadalq_u32(Sum, vpaddlq_u16(vpaddlq_u8(Diff)));
+    }
+    return vgetq_lane_u64(Sum, 0) + vgetq_lane_u64(Sum, 1) + SumAbsDiffScalar(A + Index, B + Index, Size - Index);
+}
+#endif
+
+typedef uint64_t (*SumAbsDiffKernel)(const uint8_t *, const uint8_t *, std::size_t);
+
+static SumAbsDiffKernel SelectSumAbsDiffKernel()
+{
+#if defined(PU_FRAME_GATE_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return SumAbsDiffAvx2;
+    }
+#endif
+#if defined(PU_FRAME_GATE_X86)
+    return SumAbsDiffSse2;
+#elif defined(PU_FRAME_GATE_NEON)
+    return SumAbsDiffNeon;
+#else
+    return SumAbsDiffScalar;
+#endif
+}
+
+uint64_t FrameGate::SumAbsDiff(const uint8_t *A, const uint8_t *B, std::size_t Size, uint64_t Limit)
+{
+    static const SumAbsDiffKernel Kernel = SelectSumAbsDiffKernel();
+    uint64_t Sum = 0;
+    for (std::size_t Offset = 0; Offset < Size && Sum <= Limit; Offset += SadBlockSize)
+    {
+        const std::size_t Block = Size - Offset < SadBlockSize ? Size - Offset : SadBlockSize;
+        Sum += Kernel(A + Offset, B + Offset, Block);
+    }
+    return Sum;
+}
+
+FrameGate::FrameGate(const json &Config)
+{
+    if (Config.is_object() && Config.count(FrameGateLabel))
+    {
+        fetch(Config[FrameGateLabel], ThresholdLabel, m_Threshold);
+        fetch(Config[FrameGateLabel], MaxSkippedLabel, m_MaxSkipped);
+    }
+}
+
+bool FrameGate::IsRequested(const json &Config)
+{
+    return Config.is_object() && Config.count(FrameGateLabel) && Config[FrameGateLabel].is_object();
+}
+
+bool FrameGate::IsUnchanged(const DataPtr &Frame)
+{
+    s_Checked++;
+    const bool may_skip = m_HasReference && Frame.size() == m_Reference.size() && !Frame.empty() &&
+                          (m_MaxSkipped == 0 || m_Skipped < m_MaxSkipped);
+    if (may_skip)
+    {
+        const uint64_t Limit = uint64_t(m_Threshold * Frame.size());
+        const uint64_t Sum = SumAbsDiff(reinterpret_cast<const uint8_t *>(Frame.data()),
+                                        reinterpret_cast<const uint8_t *>(m_Reference.data()), Frame.size(), Limit);
+        if (Sum < Limit)
+        {
+            m_Skipped++;
+            s_Skipped++;
+            return true;
+        }
+    }
+
+    // Reuses the reference buffer, no allocation once the frame size is stable
+    m_Reference.assign(Frame.begin(), Frame.end());
+    m_HasReference = true;
+    m_Skipped = 0;
+    return false;
+}
+
+json FrameGate::GetStats()
+{
+    json Stats;
+    Stats["checked"] = s_Checked.load();
+    Stats["skipped"] = s_Skipped.load();
+    return Stats;
+}
+} // namespace ProcessingUnit
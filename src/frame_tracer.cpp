@@ -0,0 +1,333 @@
+#include "frame_tracer.hpp"
+
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+#include "spdlog/spdlog.h"
+
+namespace ProcessingUnit
+{
+const std::string EnabledLabel("enabled");
+const std::string CapacityLabel("capacity");
+const std::string DirectoryLabel("directory");
+const std::string WindowMsLabel("windowMs");
+const std::string DumpTraceLabel("dumpTrace");
+const std::string TraceFileLabel("traceFile");
+const std::size_t DefaultTraceCapacity = 262144;
+const std::size_t MinTraceCapacity = 1024;
+const std::chrono::milliseconds TraceSignalPollInterval(250);
+
+// Marks a slot a writer claimed, no event has this index + 1
+const uint64_t WritingStamp = ~uint64_t(0);
+
+static volatile std::sig_atomic_t s_TraceDumpRequested = 0;
+
+static void OnTraceSignal(int)
+{
+    s_TraceDumpRequested = 1;
+}
+
+static std::atomic<uint32_t> s_NextThreadId{1};
+static thread_local uint32_t t_ThreadId = 0;
+static thread_local const char *t_ThreadName = nullptr;
+
+const uint64_t FrameTracer::NoSeq;
+
+FrameTracer::FrameTracer() : m_Epoch(std::chrono::steady_clock::now()) {}
+
+FrameTracer::~FrameTracer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_ConVarWatch.notify_all();
+    if (m_WatchThread.joinable())
+    {
+        m_WatchThread.join();
+    }
+}
+
+void FrameTracer::SetTracing(const json &Config)
+{
+    FrameTracer &Tracer = getInstance();
+    std::lock_guard<std::mutex> lock(Tracer.m_Mutex);
+    bool Enabled = Tracer.m_Enabled;
+    std::size_t Capacity = Tracer.m_Capacity ? Tracer.m_Capacity : DefaultTraceCapacity;
+    int64_t WindowMs = Tracer.m_Window.count();
+    fetch(Config, EnabledLabel, Enabled);
+    fetch(Config, CapacityLabel, Capacity);
+    fetch(Config, DirectoryLabel, Tracer.m_Directory);
+    fetch(Config, WindowMsLabel, WindowMs);
+    Tracer.m_Window = std::chrono::milliseconds(std::max<int64_t>(WindowMs, 0));
+
+    if (Enabled && !Tracer.m_Events)
+    {
+        // A power of two, so the slot of an event is a mask of its index
+        std::size_t Rounded = MinTraceCapacity;
+        while (Rounded < Capacity)
+        {
+            Rounded <<= 1;
+        }
+        Tracer.m_Events.reset(new TraceEvent[Rounded]);
+        Tracer.m_Capacity = Rounded;
+    }
+    else if (Tracer.m_Events && Capacity > Tracer.m_Capacity)
+    {
+        spdlog::get("MainLogger")->warn("[FrameTracer]: a larger capacity takes effect after a restart");
+    }
+
+    if (Enabled && !Tracer.m_Enabled && Tracer.m_Window.count() > 0)
+    {
+        Tracer.m_WindowEnd = std::chrono::steady_clock::now() + Tracer.m_Window;
+    }
+    // Publishes the buffer to the threads that see tracing on
+    Tracer.m_Enabled.store(Enabled, std::memory_order_release);
+
+    if (!Tracer.m_WatchThread.joinable())
+    {
+#ifdef SIGUSR2
+        std::signal(SIGUSR2, OnTraceSignal);
+#endif
+        // Writing the file allocates and locks, the handler only raises a flag for this thread
+        Tracer.m_WatchThread = std::thread(&FrameTracer::Watch, &Tracer);
+    }
+    Tracer.m_ConVarWatch.notify_all();
+}
+
+void FrameTracer::SetThreadName(const char *Name)
+{
+    t_ThreadName = Name;
+}
+
+FrameTracer::Span::Span(const char *Name, const JobHost *Host, uint64_t Seq)
+    : m_Name(IsEnabled() ? Name : nullptr), m_Host(Host), m_Seq(Seq), m_StartNs(m_Name ? Now() : 0)
+{
+}
+
+FrameTracer::Span::~Span()
+{
+    if (m_Name)
+    {
+        getInstance().Record(m_Name, m_Host, m_Seq, m_StartNs, Now());
+    }
+}
+
+uint64_t FrameTracer::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - getInstance().m_Epoch).count();
+}
+
+void FrameTracer::Record(const char *Name, const JobHost *Host, uint64_t Seq, uint64_t StartNs, uint64_t EndNs)
+{
+    if (!m_Enabled.load(std::memory_order_acquire))
+    {
+        return;
+    }
+    if (!t_ThreadId)
+    {
+        t_ThreadId = s_NextThreadId++;
+    }
+    const char *JobId = Host ? Host->GetCachedJobId() : "";
+
+    const uint64_t Index = m_Head.fetch_add(1, std::memory_order_relaxed);
+    TraceEvent &Event = m_Events[Index & (m_Capacity - 1)];
+    // Any older event in the slot may be overwritten, one being written or a newer one is kept
+    uint64_t Stamp = Event.Stamp.load(std::memory_order_relaxed);
+    do
+    {
+        if (Stamp == WritingStamp || Stamp >= Index + 1)
+        {
+            m_Dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    } while (!Event.Stamp.compare_exchange_weak(Stamp, WritingStamp, std::memory_order_relaxed));
+    // Same scheme as a seqlock: a dump skips slots whose stamp changed while it copied them
+    std::atomic_thread_fence(std::memory_order_release);
+    Event.Name = Name;
+    Event.ThreadName = t_ThreadName;
+    Event.ThreadId = t_ThreadId;
+    Event.Seq = Seq;
+    Event.StartNs = StartNs;
+    Event.DurationNs = EndNs - StartNs;
+    const std::size_t Length = strnlen(JobId, JobIdSize - 1);
+    std::memcpy(Event.JobId, JobId, Length);
+    Event.JobId[Length] = '\0';
+    Event.Stamp.store(Index + 1, std::memory_order_release);
+}
+
+std::string FrameTracer::NextDumpPath() const
+{
+    const int64_t WallMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    return (m_Directory.empty() ? std::string(".") : m_Directory) + "/trace-" + std::to_string(WallMs) + ".json";
+}
+
+std::string FrameTracer::Dump()
+{
+    FrameTracer &Tracer = getInstance();
+    std::string Path;
+    {
+        std::lock_guard<std::mutex> lock(Tracer.m_Mutex);
+        if (!Tracer.m_Events)
+        {
+            return std::string();
+        }
+        Path = Tracer.NextDumpPath();
+    }
+    return Tracer.WriteDump(Path) ? Path : std::string();
+}
+
+bool FrameTracer::WriteDump(const std::string &Path)
+{
+    std::ofstream File(Path);
+    if (!File)
+    {
+        spdlog::get("MainLogger")->error("[FrameTracer]: could not write " + Path);
+        return false;
+    }
+
+    // Writers go on meanwhile, only the events that were complete and not overwritten are taken
+    const uint64_t Head = m_Head.load(std::memory_order_acquire);
+    const uint64_t Count = std::min<uint64_t>(Head, m_Capacity);
+    std::map<uint32_t, const char *> Threads;
+    File << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool First = true;
+    for (uint64_t Index = Head - Count; Index < Head; ++Index)
+    {
+        TraceEvent &Slot = m_Events[Index & (m_Capacity - 1)];
+        const uint64_t Stamp = Slot.Stamp.load(std::memory_order_acquire);
+        if (Stamp != Index + 1)
+        {
+            continue;
+        }
+        const char *Name = Slot.Name;
+        const char *ThreadName = Slot.ThreadName;
+        const uint32_t ThreadId = Slot.ThreadId;
+        const uint64_t Seq = Slot.Seq;
+        const uint64_t StartNs = Slot.StartNs;
+        const uint64_t DurationNs = Slot.DurationNs;
+        char JobId[JobIdSize];
+        std::memcpy(JobId, Slot.JobId, JobIdSize);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (Slot.Stamp.load(std::memory_order_relaxed) != Stamp)
+        {
+            continue;
+        }
+        JobId[JobIdSize - 1] = '\0';
+        if (ThreadName)
+        {
+            Threads[ThreadId] = ThreadName;
+        }
+
+        File << (First ? "" : ",") << "\n{\"name\":\"" << Name << "\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ThreadId
+             << ",\"ts\":" << StartNs / 1000.0 << ",\"dur\":" << DurationNs / 1000.0
+             << ",\"args\":{\"jobId\":" << json(std::string(JobId)).dump();
+        if (Seq != NoSeq)
+        {
+            File << ",\"seq\":" << Seq;
+        }
+        File << "}}";
+        First = false;
+    }
+    for (auto Iter = Threads.begin(); Iter != Threads.end(); ++Iter)
+    {
+        File << (First ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << Iter->first
+             << ",\"args\":{\"name\":\"" << Iter->second << "\"}}";
+        First = false;
+    }
+    File << "\n]}\n";
+    File.close();
+    if (!File)
+    {
+        spdlog::get("MainLogger")->error("[FrameTracer]: could not write " + Path);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Dumps++;
+        m_LastDump = Path;
+    }
+    spdlog::get("MainLogger")->info("[FrameTracer]: wrote " + std::to_string(Count) + " events to " + Path);
+    return true;
+}
+
+void FrameTracer::HandleStatsRequest(const json &Request, json &Reply)
+{
+    bool DumpTrace = false;
+    if (Request.is_object())
+    {
+        fetch(Request, DumpTraceLabel, DumpTrace);
+    }
+    if (!DumpTrace || !Reply.is_object())
+    {
+        return;
+    }
+    // Writing the buffer takes long, the watch thread does it and the reply only names the file
+    FrameTracer &Tracer = getInstance();
+    std::string Path;
+    {
+        std::lock_guard<std::mutex> lock(Tracer.m_Mutex);
+        if (Tracer.m_Events)
+        {
+            if (Tracer.m_RequestedDump.empty())
+            {
+                Tracer.m_RequestedDump = Tracer.NextDumpPath();
+            }
+            Path = Tracer.m_RequestedDump;
+        }
+    }
+    Tracer.m_ConVarWatch.notify_all();
+    Reply[TraceFileLabel] = Path;
+}
+
+void FrameTracer::Watch()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (!m_Stop)
+    {
+        m_ConVarWatch.wait_for(lock, TraceSignalPollInterval);
+        bool WindowEnded = false;
+        if (m_Enabled && m_Window.count() > 0 && std::chrono::steady_clock::now() >= m_WindowEnd)
+        {
+            m_Enabled = false;
+            WindowEnded = true;
+        }
+        if (!m_RequestedDump.empty())
+        {
+            std::string Path;
+            Path.swap(m_RequestedDump);
+            lock.unlock();
+            WriteDump(Path);
+            lock.lock();
+        }
+        if (WindowEnded || s_TraceDumpRequested)
+        {
+            s_TraceDumpRequested = 0;
+            lock.unlock();
+            Dump();
+            lock.lock();
+        }
+    }
+}
+
+json FrameTracer::GetStats()
+{
+    FrameTracer &Tracer = getInstance();
+    const uint64_t Head = Tracer.m_Head;
+    std::lock_guard<std::mutex> lock(Tracer.m_Mutex);
+    json Stats;
+    Stats["enabled"] = Tracer.m_Enabled.load();
+    Stats["capacity"] = Tracer.m_Capacity;
+    Stats["recorded"] = Head;
+    Stats["overwritten"] = Head > Tracer.m_Capacity ? Head - Tracer.m_Capacity : 0;
+    Stats["dropped"] = Tracer.m_Dropped.load();
+    Stats["dumps"] = Tracer.m_Dumps;
+    Stats["lastDump"] = Tracer.m_LastDump;
+    return Stats;
+}
+} // namespace ProcessingUnit
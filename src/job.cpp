@@ -1,35 +1,126 @@
 
+#include <algorithm>
 #include <thread>
 #include <chrono>
 
 #include "spdlog/spdlog.h" // logging
 #include "job.hpp"
-#include "job_connection.hpp"
+#include "processor_pool.hpp"
+#include "load_monitor.hpp"
+#include "probes.hpp"
+#include "frame_tracer.hpp"
 
 namespace ProcessingUnit
 {
 const std::string NameLogger("MainLogger");
 
-Job::Job(const json &config, JobConnection *job_con) : m_JobConnection(job_con)
+Job::Job(const json &config, JobHost *host) : m_Host(host), m_Config(config)
 {
 	spdlog::get(NameLogger)->trace(config.dump(4));
 	std::string jsonString(config.dump());
+	// First, it throws on a bad configuration before anything is acquired.
+	// A pipeline runs the preprocessing as one of its stages.
+	if (RadiometricPreprocessor::IsRequested(config) && !JobPipeline::IsRequested(config))
+	{
+		m_Preprocessor.reset(new RadiometricPreprocessor(config));
+	}
+	if (FrameGate::IsRequested(config))
+	{
+		m_FrameGate.reset(new FrameGate(config));
+	}
+	if (FanOut::IsRequested(config))
+	{
+		m_FanOut.reset(new FanOut(config));
+	}
+	// Everything acquired from here on may throw, the scheduler entry must not outlive a refused Start
+	m_SchedulerHandle = FairScheduler::Register(m_Host->GetJobId(), config);
+	try
+	{
+		if (JobPipeline::IsRequested(config))
+		{
+			m_Pipeline.reset(new JobPipeline(config, m_SchedulerHandle, [this](DataPtr &result, std::chrono::microseconds latency) {
+				{
+					std::lock_guard<std::mutex> lck(m_DataProtector);
+					FrameTracer::Span result_span("pipeline_result", m_Host, m_PipelineSeq);
+					// Results come in submission order, one per frame
+					PU_PROBE(processor_out, m_Host, m_Host->GetJobId(), m_PipelineSeq++, result.size());
+					if (!result.empty())
+					{
+						writeData(result);
+					}
+				}
+				LoadMonitor::RecordProcessingLatency(latency);
+				m_Host->OnFrameProcessed(latency);
+			}));
+		}
+		else if (BatchScheduler::IsRequested(config))
+		{
+			m_BatchScheduler = BatchScheduler::Acquire(config);
+		}
+		else if (ProcessorRegistry::IsRegistered(ProcessorRegistry::GetProcessorName(config)))
+		{
+			// Reuses a warm instance with the same Start info when there is one
+			m_Processor = ProcessorPool::Acquire(config);
+		}
+	}
+	catch (...)
+	{
+		FairScheduler::Unregister(m_SchedulerHandle);
+		throw;
+	}
+	LoadMonitor::JobStarted();
 	m_ProcessThread = std::thread(&Job::Processing, this);
 }
 
 Job::~Job()
 {
 	spdlog::get(NameLogger)->trace("[Job::process]: Job just destructed");
-	m_JobConnection->UnsubscribeProcessorResult(_callback_identifier);
+	if (m_ProcessThread.joinable())
+	{
+		// The connection went away without an End
+		cancelJob();
+		m_ProcessThread.join();
+	}
+	m_Pipeline.reset();
+	if (_is_subscribed)
+	{
+		m_Host->UnsubscribeProcessorResult(_callback_identifier);
+	}
+	FairScheduler::Unregister(m_SchedulerHandle);
+	LoadMonitor::FramesQueued(-int64_t(m_InputData.size()));
+	LoadMonitor::JobEnded();
+}
+
+json Job::GetStats() const
+{
+	json stats = json::object();
+	if (m_Pipeline)
+	{
+		stats["pipeline"] = m_Pipeline->GetStats();
+	}
+	return stats;
 }
 
 json Job::process(DataPtr &data)
 {
 	spdlog::get(NameLogger)->trace("[Job::process]: adding data to process");
-	m_DataProtector.lock();
-	m_InputData.push(data);
+	InputFrame frame;
+	frame.Data.swap(data);
+	frame.Node = ThreadPlacement::CurrentNode();
+	const std::size_t bytes = frame.Data.size();
+	{
+		// Only this thread numbers frames, the lock is for the queue
+		FrameTracer::Span lock_wait("lock_wait", m_Host, m_NextSeq);
+		m_DataProtector.lock();
+	}
+	frame.Seq = m_NextSeq++;
+	const uint64_t seq = frame.Seq;
+	m_InputData.push(std::move(frame));
 	m_isJobEmpty = false;
 	m_DataProtector.unlock();
+	PU_PROBE(frame_enqueued, m_Host, m_Host->GetJobId(), seq, bytes);
+	m_QueuedFrames++;
+	LoadMonitor::FramesQueued(1);
 	m_ConditionVariable.notify_one();
 	return json{{"OK", "Echoing"}};
 }
@@ -45,14 +136,33 @@ bool Job::readData(DataPtr *data)
 	if (m_InputData.size())
 	{
 		spdlog::get(NameLogger)->trace("[Job::process]: processing read");
-		*data = m_InputData.front();
+		InputFrame &frame = m_InputData.front();
+		const int frame_node = frame.Node;
+		data->swap(frame.Data);
+		m_CurrentSeq = frame.Seq;
 		m_InputData.pop();
 		if (m_InputData.size() == 0)
 		{
 			m_isJobEmpty = true;
 		}
 		data_protector_mutex.unlock();
-		m_JobConnection->SendContinue();
+
+		// Only this thread sets the processing node, the copy doesn't need the lock
+		const int processing_node = m_ProcessingNode >= 0 ? m_ProcessingNode : ThreadPlacement::CurrentNode();
+		if (frame_node >= 0 && processing_node >= 0 && frame_node != processing_node)
+		{
+			ThreadPlacement::CountCrossNodeFrame(data->size());
+			if (m_NumaLocalBuffers)
+			{
+				// First touch from this thread puts the copy on the processing node
+				*data = DataPtr(data->begin(), data->end());
+			}
+		}
+		m_QueuedFrames--;
+		LoadMonitor::FramesQueued(-1);
+		PU_PROBE(frame_dequeued, m_Host, m_Host->GetJobId(), m_CurrentSeq.load(), data->size());
+		m_Host->OnFrameDequeued(data->size());
+		m_Host->SendContinue();
 		return true;
 	}
 
@@ -62,7 +172,11 @@ bool Job::readData(DataPtr *data)
 void Job::writeData(DataPtr &data)
 {
 	spdlog::get(NameLogger)->trace("[Job::process]: processing write result");
-	m_JobConnection->SendData(data);
+	if (m_FrameGate)
+	{
+		m_FrameGate->SetResult(data);
+	}
+	m_Host->SendData(data);
 }
 
 void Job::stopJob()
@@ -72,7 +186,43 @@ void Job::stopJob()
 	m_isStopJobSignaled = true;
 	data_protector_mutex.unlock();
 	m_ConditionVariable.notify_one();
-	m_ProcessThread.join();
+	if (m_ProcessThread.joinable())
+	{
+		m_ProcessThread.join();
+	}
+
+	// The job ended cleanly, its processor can serve the next job with the same config
+	if (!m_isCancelled)
+	{
+		ProcessorPool::Release(m_Config, m_Processor);
+	}
+	m_Processor.reset();
+}
+
+void Job::cancelJob()
+{
+	spdlog::get(NameLogger)->trace("[Job::process]: cancelling Job");
+	std::unique_lock<std::mutex> data_protector_mutex(m_DataProtector);
+	m_isCancelled = true;
+	m_isStopJobSignaled = true;
+	const int64_t dropped_frames = m_InputData.size();
+	std::queue<InputFrame>().swap(m_InputData);
+	m_isJobEmpty = true;
+	data_protector_mutex.unlock();
+	m_QueuedFrames -= dropped_frames;
+	LoadMonitor::FramesQueued(-dropped_frames);
+	{
+		std::lock_guard<std::mutex> wait_lck(m_BatchWait->Mutex);
+		m_BatchWait->Cancelled = true;
+	}
+	if (m_Pipeline)
+	{
+		// The frames in the stages are dropped too, Drain doesn't wait for their results
+		m_Pipeline->Cancel();
+	}
+	FairScheduler::Cancel(m_SchedulerHandle);
+	m_ConditionVariable.notify_one();
+	m_ConVarVARecived.notify_one();
 }
 
 bool Job::isStoped()
@@ -84,12 +234,50 @@ bool Job::isStoped()
 void Job::Processing()
 {
 	spdlog::get(NameLogger)->trace("[Job::process]: Thread started");
+	LoadMonitor::LiveThread live_thread;
+	FrameTracer::SetThreadName("job");
+
+	const PlacementPolicy placement_policy = ThreadPlacement::GetPolicy(ThreadRole::Processing, m_Config);
+	ThreadPlacement::Scope placement(ThreadRole::Processing, placement_policy);
+	{
+		std::lock_guard<std::mutex> lck(m_DataProtector);
+		m_ProcessingNode = placement.GetNode();
+		m_NumaLocalBuffers = placement_policy.NumaLocalBuffers;
+	}
 
 	auto processor_result_callback = [&](ObserverDataMessage &result_data_message) {
 		try
 		{
+			FrameTracer::Span result_span("processor_result", m_Host, m_CurrentSeq);
 			std::unique_lock<std::mutex> lck(m_DataProtector);
+			if (result_data_message.frame_origin)
+			{
+				// Tagged results answer a fanned out frame, only the one of this job in flight counts
+				if (result_data_message.frame_origin != this)
+				{
+					return;
+				}
+				if (!m_FanOutActive || result_data_message.frame_seq != m_FanOutSeq)
+				{
+					spdlog::get(NameLogger)->debug("[Job::process]: dropped a late result of frame " + std::to_string(result_data_message.frame_seq));
+					return;
+				}
+				m_FanOutResults.push_back(result_data_message.message_payload);
+				m_FanOutAnswered.insert(result_data_message.subscriber_id);
+				lck.unlock();
+				m_ConVarVARecived.notify_one();
+				return;
+			}
+			if (m_FanOutActive)
+			{
+				// Untagged, joined with the results of the other subscribers by ProcessFannedOut
+				m_FanOutResults.push_back(result_data_message.message_payload);
+				lck.unlock();
+				m_ConVarVARecived.notify_one();
+				return;
+			}
 
+			m_LastResultBytes = result_data_message.message_payload.size();
 			if (result_data_message.message_payload != DataPtr())
 			{
 				writeData(result_data_message.message_payload);
@@ -104,22 +292,118 @@ void Job::Processing()
 		}
 	};
 
-	_callback_identifier = m_JobConnection->SubscribeProcessorResult(processor_result_callback);
+	// Pipelines, batched and registered processors hand their results back directly
+	if (!m_Pipeline && !m_BatchScheduler && !m_Processor)
+	{
+		_callback_identifier = m_Host->SubscribeProcessorResult(processor_result_callback);
+		_is_subscribed = true;
+	}
 
-	while (!m_isStopJobSignaled || !m_isJobEmpty)
+	while ((!m_isStopJobSignaled || !m_isJobEmpty) && !m_isCancelled)
 	{
 		std::unique_lock<std::mutex> data_protector_lck(m_DataProtector);
 		m_ConditionVariable.wait(data_protector_lck, [&] { return m_isStopJobSignaled || !m_isJobEmpty; });
 		data_protector_lck.unlock();
 		DataPtr data;
+		const auto frame_start = std::chrono::steady_clock::now();
+		FrameTracer::Span frame_span("frame", m_Host);
 		try
 		{
-			if (readData(&data))
+			if (!readData(&data))
+			{
+				continue;
+			}
+			frame_span.SetSeq(m_CurrentSeq);
+			m_LastResultBytes = 0;
+
+			const bool unchanged = m_FrameGate && m_FrameGate->IsUnchanged(data);
+			if (!unchanged && m_Preprocessor)
+			{
+				// Processors get the ready tensor, in a buffer reused across frames
+				FrameTracer::Span preprocess_span("preprocess", m_Host, m_CurrentSeq);
+				m_Preprocessor->Run(data);
+			}
+			PU_PROBE(processor_in, m_Host, m_Host->GetJobId(), m_CurrentSeq.load(), data.size());
+
+			if (m_Pipeline)
+			{
+				if (unchanged)
+				{
+					DataPtr result;
+					{
+						std::lock_guard<std::mutex> lck(m_DataProtector);
+						result = m_FrameGate->GetLastResult();
+					}
+					m_Pipeline->Bypass(result);
+				}
+				else
+				{
+					m_Pipeline->Submit(data);
+				}
+				// The pipeline reports the frame once its result is out
+				continue;
+			}
+
+			if (unchanged)
 			{
+				// Static scene, the result of the reference frame still holds
+				DataPtr result;
+				{
+					std::lock_guard<std::mutex> lck(m_DataProtector);
+					result = m_FrameGate->GetLastResult();
+				}
+				m_LastResultBytes = result.size();
+				if (!result.empty())
+				{
+					m_Host->SendData(result);
+				}
+			}
+			else if (m_BatchScheduler)
+			{
+				FrameTracer::Span batch_span("batch", m_Host, m_CurrentSeq);
+				ProcessBatched(data);
+			}
+			else if (m_Processor)
+			{
+				FairScheduler::Grant grant(m_SchedulerHandle);
+				if (!grant)
+				{
+					// Cancelled while waiting for a slot
+					continue;
+				}
+				FrameTracer::Span process_span("process", m_Host, m_CurrentSeq);
+				DataPtr result;
+				m_Processor->Process(data, result);
+				m_LastResultBytes = result.size();
+				if (!result.empty())
+				{
+					std::lock_guard<std::mutex> lck(m_DataProtector);
+					writeData(result);
+				}
+			}
+			else if (m_FanOut)
+			{
+				FairScheduler::Grant grant(m_SchedulerHandle);
+				if (!grant)
+				{
+					continue;
+				}
+				FrameTracer::Span fan_out_span("fan_out", m_Host, m_CurrentSeq);
+				ProcessFannedOut(data);
+			}
+			else
+			{
+				FairScheduler::Grant grant(m_SchedulerHandle);
+				if (!grant)
+				{
+					continue;
+				}
+				FrameTracer::Span observers_span("observers", m_Host, m_CurrentSeq);
 				ObserverDataMessage input_data_message = ObserverDataMessage(data);
-				m_JobConnection->NotifyInputData(input_data_message);
+				m_Host->NotifyInputData(input_data_message);
 				std::unique_lock<std::mutex> lck(m_DataProtector);
-				m_ConVarVARecived.wait(lck, [&] { return m_isVARecived; });
+				// The result of a cancelled job is dropped, the subscription ends with the job
+				m_ConVarVARecived.wait(lck, [&] { return m_isVARecived || m_isCancelled; });
 				m_isVARecived = false;
 			}
 		}
@@ -127,11 +411,88 @@ void Job::Processing()
 		{
 			std::cerr << "[Job::process]: Error: " << e.what() << std::endl;
 		}
+		const auto processing_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - frame_start);
+		PU_PROBE(processor_out, m_Host, m_Host->GetJobId(), m_CurrentSeq.load(), m_LastResultBytes);
+		LoadMonitor::RecordProcessingLatency(processing_time);
+		m_Host->OnFrameProcessed(processing_time);
 	}
 
-	DataPtr data;
-	ObserverDataMessage input_data_message = ObserverDataMessage(data);
-	m_JobConnection->NotifyInputData(input_data_message);
+	if (m_Pipeline)
+	{
+		m_Pipeline->Drain();
+	}
+
+	if (_is_subscribed)
+	{
+		DataPtr data;
+		ObserverDataMessage input_data_message = ObserverDataMessage(data);
+		m_Host->NotifyInputData(input_data_message);
+	}
 	spdlog::get(NameLogger)->trace("[Job::process]: Ending processing thread");
 }
+
+void Job::ProcessBatched(DataPtr &data)
+{
+	std::shared_ptr<BatchWait> batch_wait = m_BatchWait;
+	m_BatchScheduler->Submit(data, [this, batch_wait](DataPtr &result) {
+		// A cancelled job may be gone by now, cancelJob waits for a callback that already runs
+		std::lock_guard<std::mutex> wait_lck(batch_wait->Mutex);
+		if (batch_wait->Cancelled)
+		{
+			return;
+		}
+		std::unique_lock<std::mutex> lck(m_DataProtector);
+		if (!result.empty())
+		{
+			writeData(result);
+		}
+		m_isVARecived = true;
+		lck.unlock();
+		m_ConVarVARecived.notify_one();
+	});
+
+	std::unique_lock<std::mutex> lck(m_DataProtector);
+	m_ConVarVARecived.wait(lck, [&] { return m_isVARecived || m_isCancelled; });
+	m_isVARecived = false;
+}
+
+void Job::ProcessFannedOut(DataPtr &data)
+{
+	const uint64_t seq = m_CurrentSeq;
+	{
+		std::lock_guard<std::mutex> lck(m_DataProtector);
+		m_FanOutResults.clear();
+		m_FanOutAnswered.clear();
+		m_FanOutSeq = seq;
+		m_FanOutActive = true;
+	}
+	// One payload shared by all subscribers, none of them may change it
+	const ObserverDataMessage input_data_message(std::make_shared<const DataPtr>(std::move(data)), this, seq);
+	std::vector<uint32_t> deferred_subscribers;
+	try
+	{
+		m_Host->FanOutInputData(input_data_message, deferred_subscribers);
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lck(m_DataProtector);
+		m_FanOutActive = false;
+		throw;
+	}
+
+	std::unique_lock<std::mutex> lck(m_DataProtector);
+	// A subscriber is done once its callback returned, unless it deferred its result
+	m_ConVarVARecived.wait_for(lck, m_FanOut->GetResultTimeout(), [&] {
+		return m_isCancelled || std::all_of(deferred_subscribers.begin(), deferred_subscribers.end(),
+		                                    [&](uint32_t subscriber) { return m_FanOutAnswered.count(subscriber) > 0; });
+	});
+	m_FanOutActive = false;
+	DataPtr merged = FanOut::Merge(m_FanOutResults);
+	m_FanOutResults.clear();
+	m_LastResultBytes = merged.size();
+	if (!merged.empty())
+	{
+		writeData(merged);
+	}
+}
 } // namespace ProcessingUnit
\ No newline at end of file
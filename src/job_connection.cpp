@@ -7,6 +7,13 @@
 #include "spdlog/spdlog.h"
 
 #include "job.hpp"
+#include "thread_placement.hpp"
+#include "admission_controller.hpp"
+#include "session_registry.hpp"
+#include "load_monitor.hpp"
+#include "tuning_config.hpp"
+#include "probes.hpp"
+#include "frame_tracer.hpp"
 
 namespace ProcessingUnit
 {
@@ -77,33 +84,137 @@ std::string ToString(int Nr)
     return ss.str();
 }
 
-template <class CertainMessageType>
-void SendMessage(std::shared_ptr<SimpleWeb::SocketServer<SimpleWeb::WS>::Connection> &Conn,
-                 CertainMessageType &Msg)
+// Output pauses once this much data is waiting in the websocket send buffer
+const std::size_t DefaultSendHighWaterBytes = 16 * 1024 * 1024;
+const std::size_t DefaultSendHighWaterMessages = 64;
+const std::string FlowControlLabel("flowControl");
+const std::string SendHighWaterBytesLabel("sendHighWaterBytes");
+const std::string SendHighWaterMessagesLabel("sendHighWaterMessages");
+// Messages from this size on are parsed from the websocket stream without a string copy
+const std::size_t StreamingReceiveThreshold = 64 * 1024;
+
+const std::string SendFinRsvOpcodeLabel("sendFinRsvOpcode");
+// Final fragment of a binary message
+const unsigned char DefaultSendFinRsvOpcode = 130;
+
+void SendPacked(std::shared_ptr<SimpleWeb::SocketServer<SimpleWeb::WS>::Connection> &Conn,
+                std::shared_ptr<SimpleWeb::SocketServer<SimpleWeb::WS>::SendStream> SendStream,
+                const Message &Msg, std::shared_ptr<SendQueueState> State, unsigned char FinRsvOpcode,
+                const JobHost *ProbeHost)
 {
-    auto SendStream = std::make_shared<SimpleWeb::SocketServer<SimpleWeb::WS>::SendStream>();
-    msgpack::pack(*SendStream, Msg);
+    const std::size_t Bytes = SendStream->size();
+    const std::string MessageType = Msg.GetMessageTypeAsString();
+    const Message::MessageType Type = Msg.GetMessageType();
+    // The host may be gone when the send completes, keep its address as an id only
+    const void *ProbeId = ProbeHost;
+    std::string ProbeJobId;
+    if (ProbeHost && PU_PROBE_ENABLED(send_complete))
+    {
+        ProbeJobId = ProbeHost->GetJobId();
+    }
+    {
+        std::lock_guard<std::mutex> lock(State->Mutex);
+        State->OutstandingBytes += Bytes;
+        State->OutstandingMessages++;
+    }
 
+    // The message is gone by the time the send completes, only capture by value
     Conn->send(
-        SendStream, [&](const SimpleWeb::error_code &Err) {
+        SendStream, [State, Bytes, MessageType, Type, ProbeId, ProbeJobId](const SimpleWeb::error_code &Err) {
+            std::unique_lock<std::mutex> lock(State->Mutex);
+            State->OutstandingBytes -= Bytes;
+            State->OutstandingMessages--;
+            if (Err)
+            {
+                State->SendErrors++;
+            }
+            else
+            {
+                State->SentBytes += Bytes;
+                State->SentMessages++;
+            }
+            lock.unlock();
+            State->ConVarDrained.notify_all();
+
+            if (ProbeId && !Err)
+            {
+                PU_PROBE(send_complete, ProbeId, ProbeJobId, Type, Bytes);
+            }
+
             if (Err)
             {
                 std::ostringstream ErrStr;
-                ErrStr << "Error sending message: " << Err << " - " << Msg.GetMessageTypeAsString();
+                ErrStr << "Error sending message: " << Err << " - " << MessageType;
                 spdlog::get("MainLogger")->error(ErrStr.str());
             }
         },
-        130);
+        FinRsvOpcode);
+}
+
+template <class CertainMessageType>
+void SendMessage(std::shared_ptr<SimpleWeb::SocketServer<SimpleWeb::WS>::Connection> &Conn,
+                 CertainMessageType &Msg, std::shared_ptr<SendQueueState> State,
+                 std::shared_ptr<StreamRecorder> Recorder = nullptr,
+                 unsigned char FinRsvOpcode = DefaultSendFinRsvOpcode,
+                 const JobHost *ProbeHost = nullptr)
+{
+    auto SendStream = std::make_shared<SimpleWeb::SocketServer<SimpleWeb::WS>::SendStream>();
+    if (Recorder)
+    {
+        // Pack once and hand the same bytes to the socket and the recorder
+        msgpack::sbuffer Buffer;
+        msgpack::pack(Buffer, Msg);
+        SendStream->write(Buffer.data(), Buffer.size());
+        Recorder->Record(CaptureSent, Msg.GetMessageType(), Buffer.data(), Buffer.size());
+    }
+    else
+    {
+        msgpack::pack(*SendStream, Msg);
+    }
+    SendPacked(Conn, SendStream, Msg, State, FinRsvOpcode, ProbeHost);
+}
+
+/*!
+    Results can be large, only their header is packed. The payload is written into the
+    socket buffer straight from the message, the socket has no gather write to spare
+    that last copy. The recorder gets header and payload as two parts of one frame.
+*/
+template <>
+void SendMessage<DataMessage>(std::shared_ptr<SimpleWeb::SocketServer<SimpleWeb::WS>::Connection> &Conn,
+                              DataMessage &Msg, std::shared_ptr<SendQueueState> State,
+                              std::shared_ptr<StreamRecorder> Recorder, unsigned char FinRsvOpcode,
+                              const JobHost *ProbeHost)
+{
+    msgpack::sbuffer Header;
+    msgpack::packer<msgpack::sbuffer> Packer(Header);
+    PackDataMessageHeader(Packer, Msg);
+    const std::vector<char> &Payload = Msg.GetPayload();
+
+    auto SendStream = std::make_shared<SimpleWeb::SocketServer<SimpleWeb::WS>::SendStream>();
+    SendStream->write(Header.data(), Header.size());
+    SendStream->write(Payload.data(), Payload.size());
+    if (Recorder)
+    {
+        Recorder->Record(CaptureSent, Msg.GetMessageType(), Header.data(), Header.size(), Payload.data(), Payload.size());
+    }
+    SendPacked(Conn, SendStream, Msg, State, FinRsvOpcode, ProbeHost);
 }
 
 JobConnection::JobConnection()
-    : m_Valid(false)
+    : m_Valid(false), m_SendHighWaterBytes(DefaultSendHighWaterBytes), m_SendHighWaterMessages(DefaultSendHighWaterMessages), m_Processing(false)
 {
+    LoadMonitor::JobConnectionCreated();
+    // Server wide defaults from the tuning file, the Start info of the job can override the high water marks
+    const json FlowControl = TuningConfig::Get(FlowControlLabel);
+    SetSendHighWater(FlowControl);
+    int FinRsvOpcode = m_SendFinRsvOpcode;
+    fetch(FlowControl, SendFinRsvOpcodeLabel, FinRsvOpcode);
+    m_SendFinRsvOpcode = static_cast<unsigned char>(FinRsvOpcode);
 }
 
 JobConnection::~JobConnection()
 {
-    m_Processing = false;
+    Shutdown();
 
     if (m_OutputMessages.size())
     {
@@ -115,34 +226,110 @@ JobConnection::~JobConnection()
         spdlog::get("MainLogger")->warn("Not all input messages were processed");
     }
     spdlog::get("MainLogger")->info("Destroying job & connection");
+    LoadMonitor::JobConnectionDestroyed();
 }
 
 void JobConnection::Init(ConnectionPtr Conn)
 {
     m_Info.connection = Conn;
+    m_Link->Set(Conn);
     m_Valid = true;
     m_Processing = true;
     SetState(ConnectionState::socket_opened);
 
-    std::thread InputThreadOrg([this, Conn] { Input(Conn); });
-    std::thread OutputThreadOrg([this, Conn] { Output(Conn); });
-
-    InputThreadOrg.detach();
-    OutputThreadOrg.detach();
+    m_InputThread = std::thread([this, Conn] { Input(Conn); });
+    m_OutputThread = std::thread([this, Conn] { Output(Conn); });
 
     // std::shared_ptr<cortex::NNTCPublisherResolver> nntc_pub_resolver;
     // _input_pub = nntc_pub_resolver->getInputPublisher();
     // _nntc_va_report_pub = nntc_pub_resolver->getVAReportPublisher();
 }
 
+void JobConnection::InitHosted(ConnectionPtr Conn, const std::string &Channel, std::shared_ptr<SendQueueState> SendState,
+                               std::function<void()> WakeOutput)
+{
+    m_Info.connection = Conn;
+    m_Link->Set(Conn);
+    m_Channel = Channel;
+    m_SendState = SendState;
+    m_WakeOutput = WakeOutput;
+    m_Hosted = true;
+    m_Valid = true;
+    m_Processing = true;
+    SetState(ConnectionState::socket_opened);
+}
+
+template <class CertainMessageType>
+void JobConnection::Send(CertainMessageType &Msg)
+{
+    ConnectionPtr Conn = m_Link->Get();
+    if (!Conn)
+    {
+        LogTrace("-> " + Msg.GetMessageTypeAsString() + " dropped, job is detached");
+        return;
+    }
+    Msg.SetChannel(m_Channel);
+    SendMessage<CertainMessageType>(Conn, Msg, m_SendState, std::atomic_load(&m_Recorder), m_SendFinRsvOpcode, this);
+}
+
+void JobConnection::NotifyOutput()
+{
+    m_ConVarOutputQueue.notify_one();
+    if (m_WakeOutput)
+    {
+        m_WakeOutput();
+    }
+}
+
+void JobConnection::Shutdown()
+{
+    m_Processing = false;
+    // Taking each mutex once makes sure no waiter misses the flag between its check and its wait
+    {
+        std::lock_guard<std::mutex> lock(m_DataProtectorInputQueue);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_DataProtectorOutputQueue);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_SendState->Mutex);
+    }
+    m_ConVarInputQueue.notify_all();
+    m_ConVarOutputQueue.notify_all();
+    m_SendState->ConVarDrained.notify_all();
+    if (m_Job)
+    {
+        m_Job->cancelJob();
+    }
+
+    for (std::thread *Thread : {&m_InputThread, &m_OutputThread, &m_StopThread})
+    {
+        if (Thread->joinable())
+        {
+            Thread->join();
+        }
+    }
+    // The job calls back into this connection until its thread is joined, it goes first
+    m_Job.reset();
+}
+
 void JobConnection::Input(ConnectionPtr Conn)
 {
     LogTrace("#Input thread created", Conn);
+    LoadMonitor::LiveThread Live;
+    ThreadPlacement::Scope Placement(ThreadRole::Connection, ThreadPlacement::GetPolicy(ThreadRole::Connection));
+    FrameTracer::SetThreadName("input");
+    // Frames are numbered in the order they are handed to the job, as the job does
+    uint64_t InputSeq = 0;
     while (m_Processing)
     {
         LogTrace("#Input acq lock", Conn);
         std::unique_lock<std::mutex> input_queue_lock(m_DataProtectorInputQueue);
-        m_ConVarInputQueue.wait(input_queue_lock, [&] { return !m_isInputQueueEmpty; });
+        m_ConVarInputQueue.wait(input_queue_lock, [&] { return !m_isInputQueueEmpty || !m_Processing; });
+        if (m_isInputQueueEmpty)
+        {
+            break;
+        }
         std::unique_ptr<Message> Msg(std::move(m_InputMessages.front()));
         m_InputMessages.pop();
         m_isInputQueueEmpty = m_InputMessages.empty();
@@ -154,12 +341,17 @@ void JobConnection::Input(ConnectionPtr Conn)
         {
             LogTrace("#Input we would process this data", Conn);
             std::unique_ptr<DataMessage> DataMsg = static_cast_ptr<DataMessage>(Msg); //!TOOD: does this point to bad design? Downcasting here
+            FrameTracer::Span InputSpan("input", this, InputSeq++);
             ProcessData(std::move(DataMsg));
         }
         else if (Msg->GetMessageType() == Message::End)
         {
             //  LogTrace("#Input we would add this end message to the output queue", Conn);
-            m_Job->stopJob();
+            // A refused Start leaves no job to stop
+            if (m_Job)
+            {
+                m_Job->stopJob();
+            }
             std::unique_lock<std::mutex> output_queue_lock(m_DataProtectorOutputQueue);
             m_isJobStoped = true;
             output_queue_lock.unlock();
@@ -173,42 +365,51 @@ void JobConnection::Input(ConnectionPtr Conn)
     LogTrace("#Input thread destroyed", Conn);
 }
 
+void JobConnection::SetSendHighWater(const json &FlowControl)
+{
+    std::size_t Bytes = m_SendHighWaterBytes;
+    std::size_t Messages = m_SendHighWaterMessages;
+    fetch(FlowControl, SendHighWaterBytesLabel, Bytes);
+    fetch(FlowControl, SendHighWaterMessagesLabel, Messages);
+    m_SendHighWaterBytes = Bytes;
+    m_SendHighWaterMessages = Messages;
+}
+
+void JobConnection::WaitForSendCapacity()
+{
+    std::unique_lock<std::mutex> lock(m_SendState->Mutex);
+    auto has_capacity = [&] {
+        return !m_Processing || (m_SendState->OutstandingBytes < m_SendHighWaterBytes &&
+                                 m_SendState->OutstandingMessages < m_SendHighWaterMessages);
+    };
+    if (!has_capacity())
+    {
+        m_SendState->HighWaterStalls++;
+        FrameTracer::Span Stall("send_stall", this);
+        m_SendState->ConVarDrained.wait(lock, has_capacity);
+    }
+}
+
 void JobConnection::Output(ConnectionPtr Conn)
 {
+    LoadMonitor::LiveThread Live;
+    ThreadPlacement::Scope Placement(ThreadRole::Connection, ThreadPlacement::GetPolicy(ThreadRole::Connection));
+    FrameTracer::SetThreadName("output");
     while (m_Processing)
     {
+        // Slow clients throttle us here instead of piling up data in the send buffer
+        WaitForSendCapacity();
+
         LogTrace("#Output called...locking", Conn);
         std::unique_lock<std::mutex> output_queue_lock(m_DataProtectorOutputQueue);
-        auto condition_var_predicate = [&] {
-            return (m_isJobStoped && m_isOutputQueueEmpty) || (m_isContinueMessageRecived && !m_isOutputQueueEmpty);
-        };
-        m_ConVarOutputQueue.wait(output_queue_lock, condition_var_predicate);
-        std::ostringstream Msg;
-
-        if (m_isContinueMessageRecived && !m_isOutputQueueEmpty)
         {
-            std::unique_ptr<Message> Msg(std::move(m_OutputMessages.front()));
-            m_OutputMessages.pop();
-            m_isOutputQueueEmpty = m_OutputMessages.empty();
-            LogTrace(std::string("-> ") + Msg->GetMessageTypeAsString() + std::string("(#Output)"), Conn);
-            if (Msg->GetMessageType() == Message::Data)
-            {
-                LogTrace("  #Output data", Conn);
-                std::unique_ptr<DataMessage> DataMsg = static_cast_ptr<DataMessage>(Msg);
-                SendMessage<DataMessage>(Conn, *DataMsg);
-                // m_ReceivedData = false;
-            }
-
-            m_isContinueMessageRecived = false;
+            // Results are ready but the client didn't ask for more yet
+            const bool ContinueStall = !m_isOutputQueueEmpty && !m_isContinueMessageRecived;
+            FrameTracer::Span Stall(ContinueStall ? "continue_stall" : nullptr, this, m_OutputSeq);
+            m_ConVarOutputQueue.wait(output_queue_lock, [&] { return HasOutputReady() || !m_Processing; });
         }
-
-        if (m_isJobStoped && m_isOutputQueueEmpty)
+        if (!m_Processing || SendNextOutput())
         {
-            LogTrace("  #Output end", Conn);
-            EndMessage Msg;
-            SendMessage<EndMessage>(Conn, Msg);
-            SetState(ConnectionState::job_ended);
-            m_Processing = false;
             break;
         }
 
@@ -222,20 +423,104 @@ void JobConnection::Output(ConnectionPtr Conn)
     LogTrace("#Output destroyed", Conn);
 }
 
+bool JobConnection::HasOutputReady() const
+{
+    return (m_isJobStoped && m_isOutputQueueEmpty) || (m_isContinueMessageRecived && !m_isOutputQueueEmpty && !m_Detached);
+}
+
+bool JobConnection::SendNextOutput()
+{
+    if (m_isContinueMessageRecived && !m_isOutputQueueEmpty && !m_Detached)
+    {
+        std::unique_ptr<Message> Msg(std::move(m_OutputMessages.front()));
+        m_OutputMessages.pop();
+        m_OutputDepth--;
+        m_isOutputQueueEmpty = m_OutputMessages.empty();
+        LogTrace(std::string("-> ") + Msg->GetMessageTypeAsString() + std::string("(#Output)"), GetConnection());
+        if (Msg->GetMessageType() == Message::Data)
+        {
+            LogTrace("  #Output data", GetConnection());
+            std::unique_ptr<DataMessage> DataMsg = static_cast_ptr<DataMessage>(Msg);
+            FrameTracer::Span SendSpan("send", this, m_OutputSeq++);
+            Send<DataMessage>(*DataMsg);
+            m_MemoryAccount->Release(DataMsg->GetPayloadSize());
+            // m_ReceivedData = false;
+        }
+
+        m_isContinueMessageRecived = false;
+    }
+
+    if (m_isJobStoped && m_isOutputQueueEmpty)
+    {
+        LogTrace("  #Output end", GetConnection());
+        EndMessage Msg;
+        Send<EndMessage>(Msg);
+        PU_PROBE(job_end_sent, this, GetJobId(), 0, 0);
+        SetState(ConnectionState::job_ended);
+        m_Processing = false;
+        return true;
+    }
+    return false;
+}
+
+bool JobConnection::PumpOutput()
+{
+    std::lock_guard<std::mutex> output_queue_lock(m_DataProtectorOutputQueue);
+    if (GetState() == ConnectionState::job_ended || !HasOutputReady())
+    {
+        return false;
+    }
+    SendNextOutput();
+    return true;
+}
+
 void JobConnection::OnMessage(std::shared_ptr<WsServer::Message> Message)
+{
+    LogTrace(std::string("Message received: ") + ToString(Message->size()), GetConnection()); // +connection.get());
+
+    std::string Bytes;
+    MessageReader Reader;
+    bool CouldParse = ReadMessage(Message, Reader, Bytes, std::atomic_load(&m_Recorder) != nullptr);
+    OnParsedMessage(Reader, Bytes);
+}
+
+bool JobConnection::ReadMessage(std::shared_ptr<WsServer::Message> Message, MessageReader &Reader, std::string &Bytes,
+                                bool KeepBytes)
+{
+    if (KeepBytes || Message->size() < StreamingReceiveThreshold)
+    {
+        Bytes = Message->string();
+        return Reader.Parse(Bytes);
+    }
+    return Reader.Parse(*Message);
+}
+
+void JobConnection::OnParsedMessage(MessageReader &Reader, const std::string &Bytes)
 {
     if (m_Info.state == ConnectionState::error)
     {
         throw std::runtime_error("Got message for connection in error state");
     }
 
-    const std::string Bytes = Message->string();
-    LogTrace(std::string("Message received: ") + ToString(Bytes.size()), m_Info.connection); // +connection.get());
+    Message::MessageType Type = Reader.GetMessageType();
+    PU_PROBE(message_received, this, GetJobId(), Type, Bytes.empty() ? Reader.GetPayloadSize() : Bytes.size());
 
-    MessageReader Reader;
-    bool CouldParse = Reader.Parse(Bytes);
+    std::unique_ptr<StartMessage> StartMsg;
+    if (Type == Message::Start)
+    {
+        // Open the recorder first so the capture starts with the Start message
+        StartMsg = Reader.GetStartMessage();
+        if (!std::atomic_load(&m_Recorder) && GetState() == ConnectionState::socket_opened)
+        {
+            std::atomic_store(&m_Recorder, StreamRecorder::Create(StartMsg->GetJobId(), StartMsg->GetInfoJson()));
+        }
+    }
 
-    Message::MessageType Type = Reader.GetMessageType();
+    std::shared_ptr<StreamRecorder> Recorder = std::atomic_load(&m_Recorder);
+    if (Recorder)
+    {
+        Recorder->Record(CaptureReceived, Type, Bytes.data(), Bytes.size());
+    }
 
     switch (Type)
     {
@@ -244,8 +529,7 @@ void JobConnection::OnMessage(std::shared_ptr<WsServer::Message> Message)
         ConnectionState State = GetState();
         std::cout << int(State) << std::endl;
         chk_throw(GetState() == ConnectionState::socket_opened, "Got start message after initial handshake was complete");
-        std::unique_ptr<StartMessage> Msg = Reader.GetStartMessage();
-        HandleStartMessage(std::move(Msg));
+        HandleStartMessage(std::move(StartMsg));
     }
     break;
 
@@ -261,6 +545,7 @@ void JobConnection::OnMessage(std::shared_ptr<WsServer::Message> Message)
         chk_throw(GetJobId() != "", "No job id for this connection");
 
         std::unique_ptr<DataMessage> Msg = Reader.GetDataMessage();
+        m_MemoryAccount->Charge(Msg->GetPayloadSize());
         HandleMessage(std::move(Msg));
     }
     break;
@@ -271,9 +556,25 @@ void JobConnection::OnMessage(std::shared_ptr<WsServer::Message> Message)
     }
     break;
 
+    case Message::Stats:
+    {
+        LogInfo("<- *Stats received*", GetConnection());
+        json Stats = m_StatsProvider ? m_StatsProvider() : GetLoad();
+        FrameTracer::HandleStatsRequest(Reader.GetStatsMessage()->GetStats(), Stats);
+        StatsMessage RespMsg(Stats);
+        Send<StatsMessage>(RespMsg);
+    }
+    break;
+
     case Message::End:
     {
-        chk_throw(GetState() <= ConnectionState::job_ended, "Got end message but job was not started");
+        chk_throw(GetState() != ConnectionState::socket_opened, "Got end message but job was not started");
+        if (GetState() >= ConnectionState::job_started_end_received)
+        {
+            spdlog::get("MainLogger")->warn("Got end message but the job is already ending, ignored");
+            break;
+        }
+        PU_PROBE(job_end_received, this, GetJobId(), 0, 0);
         HandleEndMessage();
     }
     break;
@@ -286,24 +587,68 @@ void JobConnection::OnMessage(std::shared_ptr<WsServer::Message> Message)
 
 void JobConnection::HandleStartMessage(std::unique_ptr<StartMessage> Msg)
 {
-    LogInfo("<- *Start received*", m_Info.connection);
+    LogInfo("<- *Start received*", GetConnection());
     if (Msg->GetMessageType() == Message::Start)
     {
         const std::string JobId = Msg->GetJobId();
         const json Config = Msg->GetInfoJson();
-        std::cout << Config << std::endl;
         SetJobId(JobId);
+        PU_PROBE(job_start, this, JobId, 0, 0);
+
+        if (Config.is_object() && Config.count(FlowControlLabel))
+        {
+            SetSendHighWater(Config[FlowControlLabel]);
+        }
 
         std::ostringstream JobInfo;
-        JobInfo << "-Connection Jobid: " << JobId << " conn: " << m_Info.connection;
-        LogTrace(JobInfo.str(), m_Info.connection);
+        JobInfo << "-Connection Jobid: " << JobId << " conn: " << GetConnection();
+        LogTrace(JobInfo.str(), GetConnection());
 
-        bool ConfigSuccess = true;
         std::string ErrorMessage;
+        bool ConfigSuccess = AdmissionController::Admit(ErrorMessage);
 
-        m_Job = std::make_shared<Job>(Msg->GetInfoJson(), this);
+        if (ConfigSuccess)
+        {
+            // Continues withheld for memory are sent by whoever frees enough of it
+            std::shared_ptr<ConnectionLink> Link = m_Link;
+            std::shared_ptr<SendQueueState> SendState = m_SendState;
+            std::shared_ptr<StreamRecorder> Recorder = std::atomic_load(&m_Recorder);
+            const std::string Channel = m_Channel;
+            const unsigned char FinRsvOpcode = m_SendFinRsvOpcode;
+            std::shared_ptr<std::atomic<uint64_t>> ContinuesSent = m_ContinuesSent;
+            const void *ProbeId = this;
+            m_MemoryAccount.reset(new MemoryGovernor::Account(JobId, [Link, SendState, Recorder, Channel, FinRsvOpcode, ContinuesSent, ProbeId, JobId]() {
+                ConnectionPtr Conn = Link->Get();
+                if (!Conn)
+                {
+                    return;
+                }
+                ContinueMessage ContinueMsg;
+                ContinueMsg.SetChannel(Channel);
+                SendMessage<ContinueMessage>(Conn, ContinueMsg, SendState, Recorder, FinRsvOpcode);
+                PU_PROBE(continue_sent, ProbeId, JobId, ++*ContinuesSent, 0);
+            }));
+            try
+            {
+                m_Job = std::make_shared<Job>(Msg->GetInfoJson(), this);
+                AdmissionController::Confirm();
+                SetState(ConnectionState::job_started);
+            }
+            catch (const std::exception &Exc)
+            {
+                AdmissionController::Withdraw();
+                ConfigSuccess = false;
+                ErrorMessage = Exc.what();
+                m_MemoryAccount.reset();
+            }
+        }
 
-        SetState(ConnectionState::job_started);
+        if (!ConfigSuccess)
+        {
+            // No job is created, Data and End are refused and the VMS places the job elsewhere
+            spdlog::get("MainLogger")->warn("Refusing job " + JobId + ": " + ErrorMessage);
+            SetJobId("");
+        }
 
         if (ConfigSuccess)
         {
@@ -311,15 +656,82 @@ void JobConnection::HandleStartMessage(std::unique_ptr<StartMessage> Msg)
             // auto startData = DataPtr(); //Need to contain the json config of nntc
             //end part
             ReadyMessage RespMsg(true);
+            if (!m_Hosted && SessionRegistry::IsEnabled())
+            {
+                m_ResumeToken = SessionRegistry::NewToken();
+                RespMsg.SetResumeToken(m_ResumeToken);
+            }
 
-            SendMessage<ReadyMessage>(m_Info.connection, RespMsg);
+            Send<ReadyMessage>(RespMsg);
+            PU_PROBE(job_ready, this, GetJobId(), 1, 0);
         }
         else
         {
             ReadyMessage RespMsg(false, ErrorMessage);
-            SendMessage<ReadyMessage>(m_Info.connection, RespMsg);
+            Send<ReadyMessage>(RespMsg);
+            PU_PROBE(job_ready, this, GetJobId(), 0, 0);
+        }
+    }
+}
+
+void JobConnection::Detach()
+{
+    m_Link->Set(nullptr);
+    std::lock_guard<std::mutex> output_queue_lock(m_DataProtectorOutputQueue);
+    m_Detached = true;
+}
+
+void JobConnection::Reattach(ConnectionPtr Conn)
+{
+    LogInfo("<- *Start received*, resuming job " + GetJobId(), Conn);
+    {
+        // Other threads read the socket through the link, m_Info follows it under its lock
+        std::lock_guard<std::mutex> link_lock(m_Link->Mutex);
+        m_Link->Connection = Conn;
+        m_Info.connection = Conn;
+    }
+    {
+        std::lock_guard<std::mutex> output_queue_lock(m_DataProtectorOutputQueue);
+        m_Detached = false;
+        // A Continue the client sent before the drop may be lost, start over like a new job
+        m_isContinueMessageRecived = true;
+    }
+    ReadyMessage RespMsg(true);
+    RespMsg.SetResumeToken(m_ResumeToken);
+    RespMsg.SetResumed(true);
+    Send<ReadyMessage>(RespMsg);
+    PU_PROBE(job_ready, this, GetJobId(), 1, 0);
+    NotifyOutput();
+}
+
+void JobConnection::Abandon()
+{
+    std::size_t DroppedBytes = 0;
+    {
+        std::lock_guard<std::mutex> output_queue_lock(m_DataProtectorOutputQueue);
+        // Results still coming from the job are dropped as well, nobody will read them
+        m_Abandoned = true;
+        while (!m_OutputMessages.empty())
+        {
+            if (m_OutputMessages.front()->GetMessageType() == Message::Data)
+            {
+                DroppedBytes += static_cast<DataMessage &>(*m_OutputMessages.front()).GetPayloadSize();
+            }
+            m_OutputMessages.pop();
         }
+        m_OutputDepth = 0;
+        m_isOutputQueueEmpty = true;
+    }
+    if (m_MemoryAccount)
+    {
+        m_MemoryAccount->Release(DroppedBytes);
     }
+    // No one waits for the queued frames, drop them instead of draining the job
+    if (m_Job)
+    {
+        m_Job->cancelJob();
+    }
+    HandleEndMessage();
 }
 
 void JobConnection::HandleReadyMessage()
@@ -330,7 +742,20 @@ void JobConnection::HandleReadyMessage()
 
 void JobConnection::HandleMessage(std::unique_ptr<Message> Msg)
 {
-    LogInfo("<- *Data received*", m_Info.connection);
+    LogInfo("<- *Data received*", GetConnection());
+    if (m_Hosted)
+    {
+        // Queueing into the job is cheap, hosted channels skip the Input thread
+        if (Msg->GetMessageType() == Message::Data)
+        {
+            ProcessData(static_cast_ptr<DataMessage>(Msg));
+        }
+        else if (Msg->GetMessageType() == Message::End)
+        {
+            StopHostedJob();
+        }
+        return;
+    }
     // Add message to queue
     std::unique_lock<std::mutex> lck(m_DataProtectorInputQueue);
     m_isInputQueueEmpty = false;
@@ -341,11 +766,11 @@ void JobConnection::HandleMessage(std::unique_ptr<Message> Msg)
 
 void JobConnection::ProcessData(std::unique_ptr<DataMessage> Msg)
 {
-    LogTrace("-- *Data processing* --", m_Info.connection);
+    LogTrace("-- *Data processing* --", GetConnection());
 
     const std::string Metadata = Msg->GetMetaData();
     // Decode data
-    std::vector<char> BufVec = Msg->GetPayloadData();
+    std::vector<char> BufVec = Msg->TakePayload();
     // Process data
     std::vector<std::unique_ptr<DataMessage>> Results;
 
@@ -362,39 +787,164 @@ void JobConnection::ProcessData(std::unique_ptr<DataMessage> Msg)
     }
 
     // Enable our output
-    LogTrace("-- *Finished processing*", m_Info.connection);
+    LogTrace("-- *Finished processing*", GetConnection());
+}
+
+void JobConnection::StopHostedJob()
+{
+    if (m_StopThread.joinable())
+    {
+        // Already stopping
+        return;
+    }
+    // Draining the job can take a while, don't block the socket's other channels
+    m_StopThread = std::thread([this] {
+        LoadMonitor::LiveThread Live;
+        if (m_Job)
+        {
+            m_Job->stopJob();
+        }
+        std::function<void()> Wake = m_WakeOutput;
+        {
+            std::lock_guard<std::mutex> output_queue_lock(m_DataProtectorOutputQueue);
+            m_isJobStoped = true;
+        }
+        Wake();
+    });
 }
 
 void JobConnection::HandleContinueMessage()
 {
     LogInfo("<- *Continue received*");
     std::unique_lock<std::mutex> output_queue_lock(m_DataProtectorOutputQueue);
+    m_ContinuesReceived++;
+    PU_PROBE(continue_received, this, GetJobId(), m_ContinuesReceived, 0);
     m_isContinueMessageRecived = true;
     output_queue_lock.unlock();
-    m_ConVarOutputQueue.notify_one();
+    NotifyOutput();
 }
 
 void JobConnection::HandleEndMessage()
 {
     LogInfo("<- *End received*");
+    {
+        // The client's End and Abandon may both end the job, only the first one counts
+        std::lock_guard<std::mutex> input_queue_lock(m_DataProtectorInputQueue);
+        if (m_isEndMessageReceived)
+        {
+            return;
+        }
+        m_isEndMessageReceived = true;
+        if (GetState() == ConnectionState::job_started)
+        {
+            SetState(ConnectionState::job_started_end_received);
+        }
+    }
     HandleMessage(std::unique_ptr<EndMessage>(new EndMessage()));
 }
 
+void JobConnection::OnFrameDequeued(std::size_t Bytes)
+{
+    m_MemoryAccount->Release(Bytes);
+}
+
 void JobConnection::SendContinue()
 {
-    LogInfo("-> Send Continue message", m_Info.connection);
+    if (!m_MemoryAccount->TryTakeCredit())
+    {
+        LogTrace("-> Continue withheld, memory budget used up", GetConnection());
+        return;
+    }
+    LogInfo("-> Send Continue message", GetConnection());
     ContinueMessage ContinueMsg;
-    SendMessage<ContinueMessage>(m_Info.connection, ContinueMsg);
+    Send<ContinueMessage>(ContinueMsg);
+    PU_PROBE(continue_sent, this, GetJobId(), ++*m_ContinuesSent, 0);
 }
 
 void JobConnection::SendData(std::vector<char> &data)
 {
-    LogTrace("#SendData we would add this data message to the output queue", m_Info.connection);
-    std::unique_lock<std::mutex> output_queue_lock(m_DataProtectorOutputQueue);
+    LogTrace("#SendData we would add this data message to the output queue", GetConnection());
+    m_MemoryAccount->Charge(data.size());
+    std::unique_lock<std::mutex> output_queue_lock(m_DataProtectorOutputQueue, std::defer_lock);
+    {
+        FrameTracer::Span LockWait("output_lock_wait", this);
+        output_queue_lock.lock();
+    }
+    if (m_Abandoned)
+    {
+        // Nobody will read it, and the queue must stay empty for the End to go out
+        output_queue_lock.unlock();
+        m_MemoryAccount->Release(data.size());
+        return;
+    }
     m_OutputMessages.push(std::unique_ptr<DataMessage>(new DataMessage("", data)));
+    m_OutputDepth++;
     LogInfo("#Output queue size is now:" + std::to_string(m_OutputMessages.size()));
     m_isOutputQueueEmpty = false;
     output_queue_lock.unlock();
-    m_ConVarOutputQueue.notify_one();
+    NotifyOutput();
+}
+
+void JobConnection::SendStatsReply(ConnectionPtr Conn, StatsMessage &Msg, std::shared_ptr<SendQueueState> State)
+{
+    SendMessage<StatsMessage>(Conn, Msg, State);
+}
+
+void JobConnection::OnFrameProcessed(std::chrono::microseconds ProcessingTime)
+{
+    m_FrameRate.Tick();
+    m_LastLatencyUs = ProcessingTime.count();
+}
+
+json JobConnection::GetLoad() const
+{
+    json Load;
+    Load["jobId"] = GetJobId();
+    if (m_Hosted)
+    {
+        Load["channel"] = m_Channel;
+    }
+    Load["fps"] = m_FrameRate.GetRate();
+    Load["queuedFrames"] = m_Job ? m_Job->GetQueuedFrames() : 0;
+    Load["outputQueue"] = m_OutputDepth.load();
+    Load["lastLatencyUs"] = m_LastLatencyUs.load();
+    return Load;
+}
+
+json JobConnection::GetStats()
+{
+    json Stats;
+    Stats["jobId"] = GetJobId();
+    if (m_Hosted)
+    {
+        Stats["channel"] = m_Channel;
+    }
+    Stats["state"] = int(GetState());
+    {
+        std::lock_guard<std::mutex> lock(m_DataProtectorOutputQueue);
+        Stats["detached"] = m_Detached;
+    }
+    if (m_Job)
+    {
+        Stats["job"] = m_Job->GetStats();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_DataProtectorInputQueue);
+        Stats["inputQueue"] = m_InputMessages.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_DataProtectorOutputQueue);
+        Stats["outputQueue"] = m_OutputMessages.size();
+    }
+    std::lock_guard<std::mutex> lock(m_SendState->Mutex);
+    Stats["sendOutstandingBytes"] = m_SendState->OutstandingBytes;
+    Stats["sendOutstandingMessages"] = m_SendState->OutstandingMessages;
+    Stats["sendHighWaterBytes"] = m_SendHighWaterBytes.load();
+    Stats["sendHighWaterMessages"] = m_SendHighWaterMessages.load();
+    Stats["sendHighWaterStalls"] = m_SendState->HighWaterStalls;
+    Stats["sentBytes"] = m_SendState->SentBytes;
+    Stats["sentMessages"] = m_SendState->SentMessages;
+    Stats["sendErrors"] = m_SendState->SendErrors;
+    return Stats;
 }
-} // namespace ProcessingUnit
\ No newline at end of file
+} // namespace ProcessingUnit
@@ -4,13 +4,58 @@
 #include <fstream>
 
 #include "spdlog/spdlog.h"
+#include "session_registry.hpp"
+#include "load_monitor.hpp"
+#include "admission_controller.hpp"
 
 namespace ProcessingUnit
 {
+JobConnectionManager::JobConnectionManager() : m_TearDownThread(&JobConnectionManager::TearDown, this)
+{
+}
+
+JobConnectionManager::~JobConnectionManager()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_ClosedMutex);
+        m_StopTearDown = true;
+    }
+    m_ConVarClosed.notify_all();
+    m_TearDownThread.join();
+}
+
+void JobConnectionManager::TearDown()
+{
+    std::unique_lock<std::mutex> lock(m_ClosedMutex);
+    while (true)
+    {
+        m_ConVarClosed.wait(lock, [&] { return m_StopTearDown || !m_Closed.empty(); });
+        if (m_Closed.empty())
+        {
+            break;
+        }
+        std::shared_ptr<void> Closed = std::move(m_Closed.front());
+        m_Closed.pop_front();
+        lock.unlock();
+        Closed.reset();
+        lock.lock();
+    }
+}
+
 void JobConnectionManager::OnOpen(ConnectionPtr conn)
 {
     std::lock_guard<std::mutex> lock(m_ConnectionsMutex);
-    m_Jobs[conn].Init(conn);
+    LoadMonitor::ConnectionOpened();
+    if (ChannelMux::IsRequested(conn->query_string))
+    {
+        m_Muxes[conn] = std::make_shared<ChannelMux>(conn);
+        m_Muxes[conn]->SetStatsProvider([this] { return BuildLoadReport(); });
+        return;
+    }
+    std::shared_ptr<JobConnection> Job = std::make_shared<JobConnection>();
+    Job->SetStatsProvider([this] { return BuildLoadReport(); });
+    Job->Init(conn);
+    m_Jobs[conn] = Job;
 }
 
 void JobConnectionManager::OnMessage(ConnectionPtr conn, std::shared_ptr<WsServer::Message> Message)
@@ -19,11 +64,49 @@ void JobConnectionManager::OnMessage(ConnectionPtr conn, std::shared_ptr<WsServe
     Str << "OnMes " << conn << " ",
 
         spdlog::get("MainLogger")->trace(Str.str() + " Start");
-    std::lock_guard<std::mutex> lock(m_ConnectionsMutex);
-    if (m_Jobs.count(conn))
+    // Dispatched without m_ConnectionsMutex, a Stats request takes it for its report
+    std::shared_ptr<ChannelMux> Mux;
+    std::shared_ptr<JobConnection> Job;
+    {
+        std::lock_guard<std::mutex> lock(m_ConnectionsMutex);
+        auto MuxIter = m_Muxes.find(conn);
+        auto JobIter = m_Jobs.find(conn);
+        if (MuxIter != m_Muxes.end())
+        {
+            Mux = MuxIter->second;
+        }
+        else if (JobIter != m_Jobs.end())
+        {
+            Job = JobIter->second;
+        }
+    }
+    if (Mux)
     {
-        std::cout << int(m_Jobs[conn].GetState()) << std::endl;
-        m_Jobs[conn].OnMessage(Message);
+        Mux->OnMessage(Message);
+    }
+    else if (Job)
+    {
+        std::cout << int(Job->GetState()) << std::endl;
+        if (Job->GetState() != ConnectionState::socket_opened)
+        {
+            Job->OnMessage(Message);
+        }
+        else
+        {
+            // The handshake is small, look at the Start before a job is created for it
+            std::string Bytes;
+            MessageReader Reader;
+            JobConnection::ReadMessage(Message, Reader, Bytes, true);
+            bool Resumed = false;
+            {
+                std::lock_guard<std::mutex> lock(m_ConnectionsMutex);
+                Resumed = TryResume(conn, Reader);
+            }
+            if (!Resumed)
+            {
+                Job->OnParsedMessage(Reader, Bytes);
+            }
+        }
     }
     else
     {
@@ -36,17 +119,113 @@ void JobConnectionManager::OnMessage(ConnectionPtr conn, std::shared_ptr<WsServe
 
 void JobConnectionManager::OnClose(ConnectionPtr conn)
 {
-    std::lock_guard<std::mutex> lock(m_ConnectionsMutex);
-    if (m_Jobs.count(conn))
+    std::shared_ptr<void> Closed;
     {
-        m_Jobs.erase(conn); // PIM : todo idiom erase/remove
+        std::lock_guard<std::mutex> lock(m_ConnectionsMutex);
+        auto Mux = m_Muxes.find(conn);
+        auto Job = m_Jobs.find(conn);
+        if (Mux != m_Muxes.end())
+        {
+            // Its destruction joins the threads of every channel
+            Closed = std::move(Mux->second);
+            m_Muxes.erase(Mux);
+            LoadMonitor::ConnectionClosed();
+        }
+        else if (Job != m_Jobs.end())
+        {
+            if (Job->second->IsResumable())
+            {
+                Job->second->Detach();
+                SessionRegistry::Park(Job->second);
+            }
+            // Unless parked, its destruction joins the connection's threads and cancels its job
+            Closed = std::move(Job->second);
+            m_Jobs.erase(Job);
+            LoadMonitor::ConnectionClosed();
+        }
+        else
+        {
+            std::ostringstream ErrStr;
+            ErrStr << "JobConnectionManager: Could not find job for sending message " << conn;
+            spdlog::get("MainLogger")->error(ErrStr.str());
+            return;
+        }
     }
-    else
     {
-        std::ostringstream ErrStr;
-        ErrStr << "JobConnectionManager: Could not find job for sending message " << conn;
-        spdlog::get("MainLogger")->error(ErrStr.str());
+        std::lock_guard<std::mutex> lock(m_ClosedMutex);
+        m_Closed.push_back(std::move(Closed));
+    }
+    m_ConVarClosed.notify_one();
+}
+
+bool JobConnectionManager::TryResume(ConnectionPtr conn, MessageReader &Reader)
+{
+    if (Reader.GetMessageType() != Message::Start)
+    {
+        return false;
+    }
+    std::unique_ptr<StartMessage> StartMsg = Reader.GetStartMessage();
+    const std::string Token = StartMsg->GetResumeToken();
+    if (Token.empty())
+    {
+        return false;
+    }
+    std::shared_ptr<JobConnection> Resumed = SessionRegistry::Claim(Token, StartMsg->GetJobId());
+    if (!Resumed)
+    {
+        // Expired or unknown, the Start creates a new job and its Ready says it wasn't resumed
+        spdlog::get("MainLogger")->warn("Could not resume job " + StartMsg->GetJobId() + ", starting it anew");
+        return false;
     }
+    // The connection made for this socket never started a job, it only has its threads to end
+    SessionRegistry::Retire(m_Jobs[conn]);
+    m_Jobs[conn] = Resumed;
+    Resumed->Reattach(conn);
+    return true;
+}
+
+json JobConnectionManager::BuildLoadReport()
+{
+    json Report = LoadMonitor::GetStats();
+    Report["capacity"] = AdmissionController::GetCapacity();
+
+    std::vector<std::shared_ptr<JobConnection>> Connections;
+    std::vector<std::shared_ptr<ChannelMux>> Muxes;
+    {
+        // Only the snapshot is taken under the lock, the jobs are asked after it
+        std::lock_guard<std::mutex> lock(m_ConnectionsMutex);
+        for (auto Iter = m_Jobs.begin(); Iter != m_Jobs.end(); ++Iter)
+        {
+            Connections.push_back(Iter->second);
+        }
+        for (auto Iter = m_Muxes.begin(); Iter != m_Muxes.end(); ++Iter)
+        {
+            Muxes.push_back(Iter->second);
+        }
+    }
+
+    json Jobs = json::array();
+    for (const std::shared_ptr<JobConnection> &Connection : Connections)
+    {
+        if (!Connection->GetJobId().empty())
+        {
+            Jobs.push_back(Connection->GetLoad());
+        }
+    }
+    for (const std::shared_ptr<ChannelMux> &Mux : Muxes)
+    {
+        json Channels = Mux->GetLoad();
+        Jobs.insert(Jobs.end(), Channels.begin(), Channels.end());
+    }
+    // Detached jobs still hold their processor and queue, they count towards the load
+    for (const std::shared_ptr<JobConnection> &Parked : SessionRegistry::GetParked())
+    {
+        json Load = Parked->GetLoad();
+        Load["detached"] = true;
+        Jobs.push_back(Load);
+    }
+    Report["jobs"] = Jobs;
+    return Report;
 }
 
 ConnectionState JobConnectionManager::GetConnectionState(ConnectionPtr conn)
@@ -54,7 +233,7 @@ ConnectionState JobConnectionManager::GetConnectionState(ConnectionPtr conn)
     std::lock_guard<std::mutex> lock(m_ConnectionsMutex);
     if (m_Jobs.count(conn))
     {
-        return m_Jobs[conn].GetState(); // PIM : todo idiom erase/remove
+        return m_Jobs[conn]->GetState(); // PIM : todo idiom erase/remove
     }
     else
     {
@@ -70,7 +249,7 @@ void JobConnectionManager::ChangeConnectionState(ConnectionPtr conn, ConnectionS
     std::lock_guard<std::mutex> lock(m_ConnectionsMutex);
     if (m_Jobs.count(conn))
     {
-        return m_Jobs[conn].SetState(state); // PIM : todo idiom erase/remove
+        return m_Jobs[conn]->SetState(state); // PIM : todo idiom erase/remove
     }
     else
     {
@@ -85,7 +264,7 @@ std::string JobConnectionManager::GetJobId(ConnectionPtr conn)
     std::lock_guard<std::mutex> lock(m_ConnectionsMutex);
     if (m_Jobs.count(conn))
     {
-        return m_Jobs[conn].GetJobId(); // PIM : todo idiom erase/remove
+        return m_Jobs[conn]->GetJobId(); // PIM : todo idiom erase/remove
     }
     else
     {
@@ -101,7 +280,7 @@ void JobConnectionManager::AddJobId(ConnectionPtr conn, const std::string &jobId
     std::lock_guard<std::mutex> lock(m_ConnectionsMutex); // not strictly needed
     if (m_Jobs.count(conn))
     {
-        return m_Jobs[conn].SetJobId(jobId); // PIM : todo idiom erase/remove
+        return m_Jobs[conn]->SetJobId(jobId); // PIM : todo idiom erase/remove
     }
     else
     {
@@ -110,4 +289,31 @@ void JobConnectionManager::AddJobId(ConnectionPtr conn, const std::string &jobId
         spdlog::get("MainLogger")->error(ErrStr.str());
     }
 }
-} // namespace ProcessingUnit
\ No newline at end of file
+
+json JobConnectionManager::GetStats()
+{
+    std::vector<std::shared_ptr<JobConnection>> Connections;
+    std::vector<std::shared_ptr<ChannelMux>> Muxes;
+    {
+        std::lock_guard<std::mutex> lock(m_ConnectionsMutex);
+        for (auto Iter = m_Jobs.begin(); Iter != m_Jobs.end(); ++Iter)
+        {
+            Connections.push_back(Iter->second);
+        }
+        for (auto Iter = m_Muxes.begin(); Iter != m_Muxes.end(); ++Iter)
+        {
+            Muxes.push_back(Iter->second);
+        }
+    }
+    json Stats = json::array();
+    for (const std::shared_ptr<JobConnection> &Connection : Connections)
+    {
+        Stats.push_back(Connection->GetStats());
+    }
+    for (const std::shared_ptr<ChannelMux> &Mux : Muxes)
+    {
+        Stats.push_back(Mux->GetStats());
+    }
+    return Stats;
+}
+} // namespace ProcessingUnit
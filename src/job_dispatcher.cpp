@@ -0,0 +1,589 @@
+#include "job_dispatcher.hpp"
+
+#include <algorithm>
+#include <istream>
+#include <streambuf>
+#include <tuple>
+
+#include <msgpack.hpp>
+#include "spdlog/spdlog.h"
+#include "osprey_ws_protocol.hpp"
+#include "thread_placement.hpp"
+
+namespace ProcessingUnit
+{
+const std::string HostLabel("host");
+const std::string PortLabel("port");
+const std::string EndpointLabel("endpoint");
+const std::string IoThreadsLabel("ioThreads");
+const std::string BackendsLabel("backends");
+const std::string PolicyLabel("policy");
+const std::string ProbeIntervalMsLabel("probeIntervalMs");
+const std::string LeastOutstandingPolicy("leastOutstanding");
+const std::string LoadPolicy("load");
+// Longer than any sane resumption grace period of the backends
+const std::chrono::minutes ResumeTokenLifetime(10);
+
+namespace
+{
+/*!
+    Reads a received message in place, peeking at the info must not copy the payload
+*/
+class ByteStreamBuf : public std::streambuf
+{
+public:
+    ByteStreamBuf(const char *Data, std::size_t Size)
+    {
+        char *Begin = const_cast<char *>(Data);
+        setg(Begin, Begin, Begin + Size);
+    }
+};
+
+// A received message is an asio::streambuf holding all of it, its bytes are parsed where they are
+bool PeekInfo(std::istream &Message, MessageReader &Reader)
+{
+    const auto Bytes = static_cast<asio::streambuf *>(Message.rdbuf())->data();
+    ByteStreamBuf Buffer(asio::buffer_cast<const char *>(Bytes), asio::buffer_size(Bytes));
+    std::istream Input(&Buffer);
+    return Reader.ParseInfo(Input);
+}
+
+// Continues also come for frames relayed before a reconnect, don't let the count go negative
+void DecrementIfPositive(std::atomic<int64_t> &Counter)
+{
+    int64_t Value = Counter.load();
+    while (Value > 0 && !Counter.compare_exchange_weak(Value, Value - 1))
+    {
+    }
+}
+
+/*!
+    Starts connecting a client on an io service of its own, the caller runs it on a thread.
+    The io service exists before the client is started, so stopping works at any time.
+*/
+std::shared_ptr<asio::io_service> StartClient(DispatchBackend::WsClient &Client)
+{
+    Client.io_service = std::make_shared<asio::io_service>();
+    // With an io service given to it, start only queues the connect
+    Client.start();
+    return Client.io_service;
+}
+
+void StopClient(DispatchBackend::WsClient &Client)
+{
+    Client.stop();
+    // The client only stops io services it made itself
+    Client.io_service->stop();
+}
+} // namespace
+
+/*!
+    One client socket and the backend socket its job runs on
+*/
+struct DispatchRelay
+{
+    typedef DispatchBackend::WsClient WsClient;
+
+    JobDispatcher::ConnectionPtr Front;
+    DispatchBackend *Backend = nullptr;
+    std::unique_ptr<WsClient> Client;
+    std::thread ClientThread;
+    // Frames relayed to the backend that it didn't answer yet, handed back to the backend count on close
+    std::atomic<int64_t> Outstanding{0};
+
+    std::mutex Mutex;
+    std::shared_ptr<WsClient::Connection> Back;
+    // What the client sent before the backend socket was open
+    std::vector<std::pair<std::shared_ptr<WsClient::SendStream>, unsigned char>> Pending;
+    bool Closed = false;
+
+    // Moves the rest of Message on, one copy from the receive buffer into the send buffer
+    void ToBackend(std::istream &Message, unsigned char FinRsvOpcode)
+    {
+        auto SendStream = std::make_shared<WsClient::SendStream>();
+        *SendStream << Message.rdbuf();
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (Closed)
+        {
+            return;
+        }
+        if (Back)
+        {
+            Back->send(SendStream, nullptr, FinRsvOpcode);
+        }
+        else
+        {
+            Pending.emplace_back(SendStream, FinRsvOpcode);
+        }
+    }
+
+    void OnBackendOpen(std::shared_ptr<WsClient::Connection> Conn)
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (Closed)
+        {
+            Conn->send_close(1000);
+            return;
+        }
+        Back = Conn;
+        for (auto &Message : Pending)
+        {
+            Back->send(Message.first, nullptr, Message.second);
+        }
+        Pending.clear();
+    }
+
+    void OnBackendGone(int Status, const std::string &Reason)
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Back.reset();
+        if (!Closed)
+        {
+            // The client sees the backend's close as if it was talking to it directly
+            Front->send_close(Status, Reason);
+        }
+    }
+
+    // Joins the backend socket, never call it from the backend's own callbacks
+    void Close()
+    {
+        std::shared_ptr<WsClient::Connection> Conn;
+        {
+            std::lock_guard<std::mutex> lock(Mutex);
+            Closed = true;
+            Pending.clear();
+            Conn = Back;
+            Back.reset();
+        }
+        if (Conn)
+        {
+            Conn->send_close(1000);
+        }
+        // Also when the backend socket never opened, the client may still be connecting
+        StopClient(*Client);
+        if (ClientThread.joinable())
+        {
+            ClientThread.join();
+        }
+        Backend->OutstandingFrames -= Outstanding.exchange(0);
+        Backend->Relays--;
+    }
+};
+
+JobDispatcher::JobDispatcher(const json &Config) : m_ProbeInterval(1000)
+{
+    fetch(Config, HostLabel, m_Host);
+    fetch(Config, PortLabel, m_Port);
+    fetch(Config, EndpointLabel, m_Endpoint);
+    fetch(Config, IoThreadsLabel, m_IoThreads);
+    std::string Policy = LoadPolicy;
+    fetch(Config, PolicyLabel, Policy);
+    m_LeastOutstanding = Policy == LeastOutstandingPolicy;
+    int64_t ProbeIntervalMs = m_ProbeInterval.count();
+    fetch(Config, ProbeIntervalMsLabel, ProbeIntervalMs);
+    m_ProbeInterval = std::chrono::milliseconds(std::max<int64_t>(ProbeIntervalMs, 50));
+
+    if (Config.count(BackendsLabel) && Config[BackendsLabel].is_array())
+    {
+        for (const json &Address : Config[BackendsLabel])
+        {
+            std::unique_ptr<DispatchBackend> Backend(new DispatchBackend());
+            Backend->Address = Address.get<std::string>();
+            if (Backend->Address.find('/') == std::string::npos)
+            {
+                Backend->Address += "/";
+            }
+            m_Backends.push_back(std::move(Backend));
+        }
+    }
+}
+
+JobDispatcher::~JobDispatcher()
+{
+    Stop();
+}
+
+bool JobDispatcher::Start()
+{
+    if (m_Backends.empty())
+    {
+        spdlog::get("MainLogger")->error("JobDispatcher: no backends configured");
+        return false;
+    }
+
+    m_Server.config.address = m_Host;
+    m_Server.config.port = m_Port;
+    m_Server.config.thread_pool_size = m_IoThreads;
+    auto &Endpoint = m_Server.endpoint[m_Endpoint];
+    Endpoint.on_open = [this](ConnectionPtr Conn) {
+        ThreadPlacement::PlaceIoThread();
+        OnOpen(Conn);
+    };
+    Endpoint.on_message = [this](ConnectionPtr Conn, std::shared_ptr<WsServer::Message> Message) {
+        ThreadPlacement::PlaceIoThread();
+        OnMessage(Conn, Message);
+    };
+    Endpoint.on_close = [this](ConnectionPtr Conn, int, const std::string &) {
+        OnClose(Conn);
+    };
+    Endpoint.on_error = [this](ConnectionPtr Conn, const SimpleWeb::error_code &Err) {
+        spdlog::get("MainLogger")->warn("JobDispatcher: client connection error: " + Err.message());
+        OnClose(Conn);
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(m_ProbeMutex);
+        m_Stop = false;
+    }
+    m_ProbeThread = std::thread(&JobDispatcher::Probe, this);
+
+    spdlog::get("MainLogger")->info("JobDispatcher: relaying port " + std::to_string(m_Port) + " to " + std::to_string(m_Backends.size()) + " backends");
+    try
+    {
+        m_Server.start();
+    }
+    catch (const std::exception &Exc)
+    {
+        spdlog::get("MainLogger")->error(std::string("JobDispatcher: server couldn't be started: ") + Exc.what());
+        Stop();
+        return false;
+    }
+    return true;
+}
+
+void JobDispatcher::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_ProbeMutex);
+        m_Stop = true;
+    }
+    m_ConVarProbe.notify_all();
+    if (m_ProbeThread.joinable())
+    {
+        m_ProbeThread.join();
+    }
+    m_Server.stop();
+
+    std::map<ConnectionPtr, std::shared_ptr<DispatchRelay>> Relays;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        Relays.swap(m_Relays);
+    }
+    for (auto &Relay : Relays)
+    {
+        Relay.second->Close();
+    }
+    for (auto &Backend : m_Backends)
+    {
+        StopProbe(*Backend);
+    }
+}
+
+void JobDispatcher::OnOpen(ConnectionPtr Conn)
+{
+    // The backend is picked by the Start, a socket without a job costs nothing
+}
+
+void JobDispatcher::OnMessage(ConnectionPtr Conn, std::shared_ptr<WsServer::Message> Message)
+{
+    MessageReader Reader;
+    const bool CouldParse = PeekInfo(*Message, Reader);
+
+    std::shared_ptr<DispatchRelay> Relay;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        auto Iter = m_Relays.find(Conn);
+        if (Iter != m_Relays.end())
+        {
+            Relay = Iter->second;
+        }
+    }
+
+    if (!Relay)
+    {
+        if (!CouldParse)
+        {
+            spdlog::get("MainLogger")->error("JobDispatcher: could not parse message");
+            return;
+        }
+        if (Reader.GetMessageType() == Message::Stats)
+        {
+            StatsMessage RespMsg(GetStats());
+            RespMsg.SetChannel(Reader.GetChannel());
+            auto SendStream = std::make_shared<WsServer::SendStream>();
+            msgpack::pack(*SendStream, RespMsg);
+            Conn->send(SendStream, nullptr, Message->fin_rsv_opcode);
+            return;
+        }
+        if (Reader.GetMessageType() != Message::Start)
+        {
+            spdlog::get("MainLogger")->error("JobDispatcher: " + Reader.GetMessage()->GetMessageTypeAsString() + " before any Start, dropped");
+            return;
+        }
+
+        DispatchBackend *Backend = FindResumeBackend(Reader.GetStartMessage()->GetResumeToken());
+        if (!Backend)
+        {
+            Backend = PickBackend();
+        }
+        Relay = OpenRelay(Conn, Backend);
+    }
+
+    if (CouldParse && Reader.GetMessageType() == Message::Data)
+    {
+        Relay->Outstanding++;
+        Relay->Backend->OutstandingFrames++;
+    }
+    Relay->ToBackend(*Message, Message->fin_rsv_opcode);
+}
+
+void JobDispatcher::OnClose(ConnectionPtr Conn)
+{
+    std::shared_ptr<DispatchRelay> Relay;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        auto Iter = m_Relays.find(Conn);
+        if (Iter == m_Relays.end())
+        {
+            return;
+        }
+        Relay = Iter->second;
+        m_Relays.erase(Iter);
+    }
+    Relay->Close();
+}
+
+std::shared_ptr<DispatchRelay> JobDispatcher::OpenRelay(ConnectionPtr Conn, DispatchBackend *Backend)
+{
+    std::shared_ptr<DispatchRelay> Relay = std::make_shared<DispatchRelay>();
+    Relay->Front = Conn;
+    Relay->Backend = Backend;
+    std::string Address = Backend->Address;
+    if (!Conn->query_string.empty())
+    {
+        Address += "?" + Conn->query_string;
+    }
+    Relay->Client.reset(new DispatchRelay::WsClient(Address));
+
+    // The relay outlives its client thread, Close joins it
+    DispatchRelay *RelayPtr = Relay.get();
+    Relay->Client->on_open = [RelayPtr](std::shared_ptr<DispatchRelay::WsClient::Connection> BackConn) {
+        RelayPtr->OnBackendOpen(BackConn);
+    };
+    Relay->Client->on_message = [this, RelayPtr](std::shared_ptr<DispatchRelay::WsClient::Connection>,
+                                                 std::shared_ptr<DispatchRelay::WsClient::InMessage> Message) {
+        MessageReader Reader;
+        if (PeekInfo(*Message, Reader))
+        {
+            if (Reader.GetMessageType() == Message::Continue)
+            {
+                DecrementIfPositive(RelayPtr->Outstanding);
+                DecrementIfPositive(RelayPtr->Backend->OutstandingFrames);
+            }
+            else if (Reader.GetMessageType() == Message::Ready)
+            {
+                RememberResumeToken(Reader.GetReadyMessage()->GetResumeToken(), RelayPtr->Backend);
+            }
+        }
+        auto SendStream = std::make_shared<WsServer::SendStream>();
+        *SendStream << Message->rdbuf();
+        RelayPtr->Front->send(SendStream, nullptr, Message->fin_rsv_opcode);
+    };
+    Relay->Client->on_close = [RelayPtr](std::shared_ptr<DispatchRelay::WsClient::Connection>, int Status, const std::string &Reason) {
+        RelayPtr->OnBackendGone(Status, Reason);
+    };
+    Relay->Client->on_error = [RelayPtr](std::shared_ptr<DispatchRelay::WsClient::Connection>, const SimpleWeb::error_code &Err) {
+        spdlog::get("MainLogger")->error("JobDispatcher: backend " + RelayPtr->Backend->Address + ": " + Err.message());
+        RelayPtr->OnBackendGone(1011, "processing unit not reachable");
+    };
+
+    Backend->Relays++;
+    Backend->Dispatched++;
+    Backend->StartsSinceReport++;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Relays[Conn] = Relay;
+    }
+    std::shared_ptr<asio::io_service> IoService = StartClient(*Relay->Client);
+    Relay->ClientThread = std::thread([IoService] {
+        ThreadPlacement::Scope Placement(ThreadRole::Connection, ThreadPlacement::GetPolicy(ThreadRole::Connection));
+        IoService->run();
+    });
+    return Relay;
+}
+
+DispatchBackend *JobDispatcher::PickBackend()
+{
+    // Lower is better: refusing or unreachable backends rank behind every healthy one
+    DispatchBackend *Best = nullptr;
+    std::tuple<int, double, int64_t> BestRank;
+    for (auto &Backend : m_Backends)
+    {
+        bool Reachable = false;
+        bool Accepting = true;
+        double ActiveJobs = 0;
+        {
+            std::lock_guard<std::mutex> lock(Backend->Mutex);
+            Reachable = Backend->Reachable;
+            if (Backend->Report.is_object())
+            {
+                ActiveJobs = Backend->Report.value("activeJobs", 0.0);
+                Accepting = Backend->Report.value("capacity", json::object()).value("acceptingJobs", true);
+            }
+        }
+        const int Health = !Reachable ? 2 : (!Accepting ? 1 : 0);
+        const int64_t Outstanding = Backend->OutstandingFrames.load();
+        const double Load = m_LeastOutstanding ? double(Outstanding) : ActiveJobs + Backend->StartsSinceReport.load();
+        const std::tuple<int, double, int64_t> Rank(Health, Load, m_LeastOutstanding ? Backend->Relays.load() : Outstanding);
+        if (!Best || Rank < BestRank)
+        {
+            Best = Backend.get();
+            BestRank = Rank;
+        }
+    }
+    return Best;
+}
+
+DispatchBackend *JobDispatcher::FindResumeBackend(const std::string &ResumeToken)
+{
+    if (ResumeToken.empty())
+    {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    auto Iter = m_ResumeTokens.find(ResumeToken);
+    return Iter != m_ResumeTokens.end() ? Iter->second.first : nullptr;
+}
+
+void JobDispatcher::RememberResumeToken(const std::string &ResumeToken, DispatchBackend *Backend)
+{
+    if (ResumeToken.empty())
+    {
+        return;
+    }
+    const auto Now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (auto Iter = m_ResumeTokens.begin(); Iter != m_ResumeTokens.end();)
+    {
+        if (Now - Iter->second.second > ResumeTokenLifetime)
+        {
+            Iter = m_ResumeTokens.erase(Iter);
+        }
+        else
+        {
+            ++Iter;
+        }
+    }
+    m_ResumeTokens[ResumeToken] = std::make_pair(Backend, Now);
+}
+
+void JobDispatcher::Probe()
+{
+    std::unique_lock<std::mutex> lock(m_ProbeMutex);
+    while (!m_Stop)
+    {
+        lock.unlock();
+        for (auto &Backend : m_Backends)
+        {
+            std::shared_ptr<DispatchBackend::WsClient::Connection> Conn;
+            {
+                std::lock_guard<std::mutex> BackendLock(Backend->Mutex);
+                Conn = Backend->ProbeConnection;
+            }
+            if (Conn)
+            {
+                StatsMessage Request;
+                auto SendStream = std::make_shared<DispatchBackend::WsClient::SendStream>();
+                msgpack::pack(*SendStream, Request);
+                Conn->send(SendStream, nullptr, 130);
+            }
+            else if (!Backend->ProbeRunning)
+            {
+                // Not connected yet or the backend went away, try again
+                StartProbe(*Backend);
+            }
+        }
+        lock.lock();
+        m_ConVarProbe.wait_for(lock, m_ProbeInterval, [this] { return m_Stop; });
+    }
+}
+
+void JobDispatcher::StartProbe(DispatchBackend &Backend)
+{
+    StopProbe(Backend);
+    Backend.ProbeClient.reset(new DispatchBackend::WsClient(Backend.Address));
+    DispatchBackend *BackendPtr = &Backend;
+    Backend.ProbeClient->on_open = [BackendPtr](std::shared_ptr<DispatchBackend::WsClient::Connection> Conn) {
+        std::lock_guard<std::mutex> lock(BackendPtr->Mutex);
+        BackendPtr->ProbeConnection = Conn;
+    };
+    Backend.ProbeClient->on_message = [BackendPtr](std::shared_ptr<DispatchBackend::WsClient::Connection>,
+                                                   std::shared_ptr<DispatchBackend::WsClient::InMessage> Message) {
+        MessageReader Reader;
+        if (!Reader.Parse(Message->string()) || Reader.GetMessageType() != Message::Stats)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(BackendPtr->Mutex);
+        BackendPtr->Report = Reader.GetStatsMessage()->GetStats();
+        BackendPtr->ReportTime = std::chrono::steady_clock::now();
+        BackendPtr->Reachable = true;
+        BackendPtr->StartsSinceReport = 0;
+    };
+    auto Gone = [BackendPtr] {
+        std::lock_guard<std::mutex> lock(BackendPtr->Mutex);
+        BackendPtr->ProbeConnection.reset();
+        BackendPtr->Reachable = false;
+    };
+    Backend.ProbeClient->on_close = [Gone](std::shared_ptr<DispatchBackend::WsClient::Connection>, int, const std::string &) { Gone(); };
+    Backend.ProbeClient->on_error = [Gone](std::shared_ptr<DispatchBackend::WsClient::Connection>, const SimpleWeb::error_code &) { Gone(); };
+
+    Backend.ProbeRunning = true;
+    std::shared_ptr<asio::io_service> IoService = StartClient(*Backend.ProbeClient);
+    Backend.ProbeThread = std::thread([BackendPtr, IoService] {
+        IoService->run();
+        BackendPtr->ProbeRunning = false;
+    });
+}
+
+void JobDispatcher::StopProbe(DispatchBackend &Backend)
+{
+    {
+        std::lock_guard<std::mutex> lock(Backend.Mutex);
+        Backend.ProbeConnection.reset();
+    }
+    if (Backend.ProbeClient)
+    {
+        StopClient(*Backend.ProbeClient);
+    }
+    if (Backend.ProbeThread.joinable())
+    {
+        Backend.ProbeThread.join();
+    }
+}
+
+json JobDispatcher::GetStats()
+{
+    json Backends = json::array();
+    for (auto &Backend : m_Backends)
+    {
+        json Stats;
+        Stats["address"] = Backend->Address;
+        Stats["relays"] = Backend->Relays.load();
+        Stats["dispatched"] = Backend->Dispatched.load();
+        Stats["outstandingFrames"] = Backend->OutstandingFrames.load();
+        std::lock_guard<std::mutex> lock(Backend->Mutex);
+        Stats["reachable"] = Backend->Reachable;
+        Stats["report"] = Backend->Report;
+        Backends.push_back(Stats);
+    }
+
+    json Stats;
+    Stats["policy"] = m_LeastOutstanding ? LeastOutstandingPolicy : LoadPolicy;
+    Stats["backends"] = Backends;
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    Stats["relays"] = m_Relays.size();
+    Stats["resumeTokens"] = m_ResumeTokens.size();
+    return Stats;
+}
+} // namespace ProcessingUnit
@@ -0,0 +1,324 @@
+#include "job_pipeline.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "spdlog/spdlog.h"
+#include "radiometric_preprocessor.hpp"
+#include "thread_placement.hpp"
+#include "load_monitor.hpp"
+#include "tuning_config.hpp"
+
+namespace ProcessingUnit
+{
+const std::string PipelineLabel("pipeline");
+const std::string StageProcessorLabel("processor");
+const std::string StageWorkersLabel("workers");
+const std::string StageQueueSizeLabel("queueSize");
+const std::string PreprocessStageName("preprocess");
+
+// Built in stage running the preprocessing configured for the job
+class PreprocessStage : public IProcessor
+{
+public:
+    explicit PreprocessStage(const json &JobConfig) : m_Preprocessor(JobConfig) {}
+
+    void Process(const DataPtr &Input, DataPtr &Output) override
+    {
+        Output = Input;
+        m_Preprocessor.Run(Output);
+    }
+
+private:
+    RadiometricPreprocessor m_Preprocessor;
+};
+
+JobPipeline::JobPipeline(const json &Config, FairScheduler::JobHandle SchedulerHandle, ResultCallback Callback)
+    : m_SchedulerHandle(SchedulerHandle), m_Config(Config), m_Callback(Callback)
+{
+    std::vector<json> StageConfigs(Config.at(PipelineLabel).begin(), Config.at(PipelineLabel).end());
+    const bool HasPreprocessStage = std::any_of(StageConfigs.begin(), StageConfigs.end(), [](const json &StageConfig) {
+        return ProcessorRegistry::GetProcessorName(StageConfig) == PreprocessStageName;
+    });
+    if (RadiometricPreprocessor::IsRequested(Config) && !HasPreprocessStage)
+    {
+        StageConfigs.insert(StageConfigs.begin(), json{{StageProcessorLabel, PreprocessStageName}});
+    }
+
+    // Create every processor before starting a thread, a bad stage then leaves nothing running
+    std::vector<std::vector<std::shared_ptr<IProcessor>>> Processors;
+    const json StageDefaults = TuningConfig::Get(PipelineLabel);
+    for (const json &StageConfig : StageConfigs)
+    {
+        std::unique_ptr<Stage> NewStage(new Stage());
+        NewStage->Name = ProcessorRegistry::GetProcessorName(StageConfig);
+        NewStage->Config = StageConfig;
+        fetch(StageDefaults, StageWorkersLabel, NewStage->Workers);
+        fetch(StageDefaults, StageQueueSizeLabel, NewStage->QueueSize);
+        fetch(StageConfig, StageWorkersLabel, NewStage->Workers);
+        fetch(StageConfig, StageQueueSizeLabel, NewStage->QueueSize);
+        NewStage->Workers = std::max<std::size_t>(NewStage->Workers, 1);
+        NewStage->QueueSize = std::max<std::size_t>(NewStage->QueueSize, 1);
+
+        // Processors aren't assumed to be thread safe, every worker gets its own instance
+        std::vector<std::shared_ptr<IProcessor>> StageProcessors;
+        for (std::size_t Index = 0; Index < NewStage->Workers; ++Index)
+        {
+            std::shared_ptr<IProcessor> Processor;
+            if (NewStage->Name == PreprocessStageName)
+            {
+                Processor = std::make_shared<PreprocessStage>(Config);
+            }
+            else
+            {
+                Processor = ProcessorRegistry::Create(StageConfig);
+            }
+            if (!Processor)
+            {
+                throw std::runtime_error("pipeline: processor '" + NewStage->Name + "' is not registered");
+            }
+            StageProcessors.push_back(Processor);
+        }
+        Processors.push_back(StageProcessors);
+        m_Stages.push_back(std::move(NewStage));
+    }
+    if (m_Stages.empty())
+    {
+        throw std::runtime_error("pipeline: no stages configured");
+    }
+
+    for (std::size_t StageIndex = 0; StageIndex < m_Stages.size(); ++StageIndex)
+    {
+        for (std::shared_ptr<IProcessor> &Processor : Processors[StageIndex])
+        {
+            m_Stages[StageIndex]->Threads.push_back(std::thread(&JobPipeline::Worker, this, StageIndex, Processor));
+        }
+    }
+}
+
+JobPipeline::~JobPipeline()
+{
+    Drain();
+}
+
+bool JobPipeline::IsRequested(const json &Config)
+{
+    return Config.is_object() && Config.count(PipelineLabel) && Config[PipelineLabel].is_array();
+}
+
+void JobPipeline::Push(Stage &Target, PipelineFrame &&Frame)
+{
+    std::unique_lock<std::mutex> lock(Target.Mutex);
+    if (Target.Queue.size() >= Target.QueueSize)
+    {
+        // Backpressure, the upstream stage waits for this one
+        Target.FullWaits++;
+        Target.ConVarNotFull.wait(lock, [&] { return Target.Closed || Target.Queue.size() < Target.QueueSize; });
+    }
+    if (Target.Closed)
+    {
+        // Cancelled, the frame is dropped
+        return;
+    }
+    Target.Queue.push_back(std::move(Frame));
+    lock.unlock();
+    Target.ConVarNotEmpty.notify_one();
+}
+
+void JobPipeline::Submit(DataPtr &Data)
+{
+    PipelineFrame Frame;
+    Frame.Data.swap(Data);
+    Frame.Submitted = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(m_OrderMutex);
+        Frame.Sequence = m_NextSequence++;
+    }
+    Push(*m_Stages.front(), std::move(Frame));
+}
+
+void JobPipeline::Bypass(DataPtr &Result)
+{
+    PipelineFrame Frame;
+    Frame.Data.swap(Result);
+    Frame.Submitted = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(m_OrderMutex);
+        Frame.Sequence = m_NextSequence++;
+    }
+    Complete(std::move(Frame));
+}
+
+void JobPipeline::Worker(std::size_t StageIndex, std::shared_ptr<IProcessor> Processor)
+{
+    LoadMonitor::LiveThread Live;
+    Stage &Current = *m_Stages[StageIndex];
+    ThreadPlacement::Scope Placement(ThreadRole::Processing, ThreadPlacement::GetPolicy(ThreadRole::Processing, m_Config));
+    const bool IsLast = StageIndex + 1 == m_Stages.size();
+
+    while (true)
+    {
+        PipelineFrame Frame;
+        {
+            std::unique_lock<std::mutex> lock(Current.Mutex);
+            Current.ConVarNotEmpty.wait(lock, [&] { return Current.Closed || !Current.Queue.empty(); });
+            if (Current.Queue.empty())
+            {
+                break;
+            }
+            Frame = std::move(Current.Queue.front());
+            Current.Queue.pop_front();
+        }
+        Current.ConVarNotFull.notify_one();
+
+        DataPtr Output;
+        bool Failed = false;
+        const auto Start = std::chrono::steady_clock::now();
+        try
+        {
+            FairScheduler::Grant Grant(m_SchedulerHandle);
+            if (!Grant)
+            {
+                // Cancelled while waiting for a slot, the pipeline drops the frame
+                continue;
+            }
+            Processor->Process(Frame.Data, Output);
+        }
+        catch (const std::exception &Exc)
+        {
+            Failed = true;
+            Output.clear();
+            Current.Errors++;
+            spdlog::get("MainLogger")->error("Pipeline stage " + Current.Name + " failed: " + Exc.what());
+        }
+        const uint64_t ElapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Start).count();
+        Current.Frames++;
+        Current.BusyUs += ElapsedUs;
+        uint64_t Max = Current.MaxUs.load();
+        while (ElapsedUs > Max && !Current.MaxUs.compare_exchange_weak(Max, ElapsedUs))
+        {
+        }
+
+        Frame.Data.swap(Output);
+        if (IsLast || Failed || Frame.Data.empty())
+        {
+            Complete(std::move(Frame));
+        }
+        else
+        {
+            Push(*m_Stages[StageIndex + 1], std::move(Frame));
+        }
+    }
+}
+
+void JobPipeline::Complete(PipelineFrame &&Frame)
+{
+    std::unique_lock<std::mutex> lock(m_OrderMutex);
+    if (m_Cancelled)
+    {
+        return;
+    }
+    m_Completed[Frame.Sequence] = std::move(Frame);
+    if (m_Emitting)
+    {
+        // The emitting thread picks it up when its turn comes
+        return;
+    }
+    // Only one thread emits at a time, that keeps the results in order without holding
+    // the lock while the callback runs
+    m_Emitting = true;
+    while (!m_Cancelled && !m_Completed.empty() && m_Completed.begin()->first == m_NextToEmit)
+    {
+        PipelineFrame Next = std::move(m_Completed.begin()->second);
+        m_Completed.erase(m_Completed.begin());
+        lock.unlock();
+        const auto Latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Next.Submitted);
+        m_Callback(Next.Data, Latency);
+        lock.lock();
+        m_NextToEmit++;
+    }
+    m_Emitting = false;
+    lock.unlock();
+    m_ConVarEmitted.notify_all();
+}
+
+void JobPipeline::Cancel()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_OrderMutex);
+        m_Cancelled = true;
+        m_Completed.clear();
+    }
+    m_ConVarEmitted.notify_all();
+    for (std::unique_ptr<Stage> &Current : m_Stages)
+    {
+        {
+            std::lock_guard<std::mutex> lock(Current->Mutex);
+            Current->Closed = true;
+            Current->Queue.clear();
+        }
+        Current->ConVarNotEmpty.notify_all();
+        Current->ConVarNotFull.notify_all();
+    }
+}
+
+void JobPipeline::Drain()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_OrderMutex);
+        if (m_Drained)
+        {
+            return;
+        }
+        // A cancelled pipeline still waits for a callback that is running
+        m_ConVarEmitted.wait(lock, [&] { return (m_Cancelled && !m_Emitting) || m_NextToEmit == m_NextSequence; });
+        m_Drained = true;
+    }
+
+    for (std::unique_ptr<Stage> &Current : m_Stages)
+    {
+        {
+            std::lock_guard<std::mutex> lock(Current->Mutex);
+            Current->Closed = true;
+        }
+        Current->ConVarNotEmpty.notify_all();
+        Current->ConVarNotFull.notify_all();
+        for (std::thread &Thread : Current->Threads)
+        {
+            Thread.join();
+        }
+        Current->Threads.clear();
+    }
+}
+
+json JobPipeline::GetStats() const
+{
+    json Stages = json::array();
+    for (const std::unique_ptr<Stage> &Current : m_Stages)
+    {
+        json StageStats;
+        StageStats["name"] = Current->Name;
+        StageStats["workers"] = Current->Workers;
+        StageStats["queueSize"] = Current->QueueSize;
+        {
+            std::lock_guard<std::mutex> lock(Current->Mutex);
+            StageStats["queued"] = Current->Queue.size();
+        }
+        const uint64_t Frames = Current->Frames.load();
+        StageStats["frames"] = Frames;
+        StageStats["errors"] = Current->Errors.load();
+        StageStats["avgUs"] = Frames ? double(Current->BusyUs.load()) / Frames : 0.0;
+        StageStats["maxUs"] = Current->MaxUs.load();
+        // How often this stage's queue was full, the stage before it waited on it
+        StageStats["fullWaits"] = Current->FullWaits.load();
+        Stages.push_back(StageStats);
+    }
+
+    json Stats;
+    Stats["stages"] = Stages;
+    std::lock_guard<std::mutex> lock(m_OrderMutex);
+    Stats["inFlight"] = m_NextSequence - m_NextToEmit;
+    Stats["waitingForOrder"] = m_Completed.size();
+    return Stats;
+}
+} // namespace ProcessingUnit
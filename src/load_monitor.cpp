@@ -0,0 +1,297 @@
+#include "load_monitor.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+namespace ProcessingUnit
+{
+const std::chrono::milliseconds LatencyWindow(10000);
+const std::chrono::milliseconds CpuSampleInterval(1000);
+
+static int64_t SteadyNowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+RateCounter::RateCounter() : m_WindowStartMs(SteadyNowMs()), m_Count(0), m_LastRate(0.0) {}
+
+void RateCounter::Tick()
+{
+    int64_t WindowStart = m_WindowStartMs.load();
+    const int64_t Now = SteadyNowMs();
+    if (Now - WindowStart >= 1000 && m_WindowStartMs.compare_exchange_strong(WindowStart, Now))
+    {
+        m_LastRate = double(m_Count.exchange(0)) * 1000.0 / double(Now - WindowStart);
+    }
+    m_Count++;
+}
+
+double RateCounter::GetRate() const
+{
+    if (SteadyNowMs() - m_WindowStartMs.load() >= 2000)
+    {
+        return 0.0;
+    }
+    return m_LastRate.load();
+}
+
+LoadMonitor::LoadMonitor()
+    : m_ActiveJobs(0), m_QueuedFrames(0), m_ProcessedFrames(0), m_LiveConnections(0), m_LiveJobConnections(0),
+      m_LiveThreads(0), m_CurrentWindow(0), m_WindowStartMs(SteadyNowMs()),
+      m_CpuUtilisation(0.0), m_ProcessThreads(0), m_ResidentBytes(0), m_OpenFiles(0)
+{
+    for (Histogram &Window : m_Latency)
+    {
+        for (std::atomic<uint64_t> &Bucket : Window)
+        {
+            Bucket = 0;
+        }
+    }
+    m_SampleThread = std::thread(&LoadMonitor::Sample, this);
+}
+
+LoadMonitor::~LoadMonitor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_SampleMutex);
+        m_StopSampling = true;
+    }
+    m_ConVarSample.notify_all();
+    m_SampleThread.join();
+}
+
+void LoadMonitor::JobStarted()
+{
+    getInstance().m_ActiveJobs++;
+}
+
+void LoadMonitor::JobEnded()
+{
+    getInstance().m_ActiveJobs--;
+}
+
+void LoadMonitor::FramesQueued(int64_t Count)
+{
+    getInstance().m_QueuedFrames += Count;
+}
+
+void LoadMonitor::RecordProcessingLatency(std::chrono::microseconds Latency)
+{
+    LoadMonitor &Monitor = getInstance();
+    Monitor.RotateLatencyWindow();
+
+    std::size_t Bucket = 0;
+    for (uint64_t Us = Latency.count(); Us > 1 && Bucket + 1 < BucketCount; Us >>= 1)
+    {
+        Bucket++;
+    }
+    Monitor.m_Latency[Monitor.m_CurrentWindow.load()][Bucket]++;
+    Monitor.m_ProcessedFrames++;
+}
+
+void LoadMonitor::ConnectionOpened()
+{
+    getInstance().m_LiveConnections++;
+}
+
+void LoadMonitor::ConnectionClosed()
+{
+    getInstance().m_LiveConnections--;
+}
+
+void LoadMonitor::JobConnectionCreated()
+{
+    getInstance().m_LiveJobConnections++;
+}
+
+void LoadMonitor::JobConnectionDestroyed()
+{
+    getInstance().m_LiveJobConnections--;
+}
+
+void LoadMonitor::RotateLatencyWindow()
+{
+    int64_t WindowStart = m_WindowStartMs.load();
+    const int64_t Now = SteadyNowMs();
+    if (Now - WindowStart < LatencyWindow.count())
+    {
+        return;
+    }
+    // Only the thread winning the exchange rotates, the others keep using the current window
+    if (m_WindowStartMs.compare_exchange_strong(WindowStart, Now))
+    {
+        const int Next = 1 - m_CurrentWindow.load();
+        for (std::atomic<uint64_t> &Bucket : m_Latency[Next])
+        {
+            Bucket = 0;
+        }
+        m_CurrentWindow = Next;
+    }
+}
+
+uint64_t LoadMonitor::GetActiveJobs()
+{
+    return getInstance().m_ActiveJobs.load();
+}
+
+int64_t LoadMonitor::GetQueuedFrames()
+{
+    return getInstance().m_QueuedFrames.load();
+}
+
+uint64_t LoadMonitor::GetLatencyPercentileUs(double Percentile)
+{
+    LoadMonitor &Monitor = getInstance();
+    Monitor.RotateLatencyWindow();
+
+    uint64_t Counts[BucketCount];
+    uint64_t Total = 0;
+    for (std::size_t Bucket = 0; Bucket < BucketCount; ++Bucket)
+    {
+        Counts[Bucket] = Monitor.m_Latency[0][Bucket].load() + Monitor.m_Latency[1][Bucket].load();
+        Total += Counts[Bucket];
+    }
+    if (Total == 0)
+    {
+        return 0;
+    }
+
+    const uint64_t Rank = uint64_t(Percentile * Total);
+    uint64_t Seen = 0;
+    for (std::size_t Bucket = 0; Bucket < BucketCount; ++Bucket)
+    {
+        Seen += Counts[Bucket];
+        if (Seen > Rank)
+        {
+            return uint64_t(1) << (Bucket + 1);
+        }
+    }
+    return uint64_t(1) << BucketCount;
+}
+
+static uint64_t ReadStatusField(const std::string &Field)
+{
+    std::ifstream Status("/proc/self/status");
+    std::string Line;
+    while (std::getline(Status, Line))
+    {
+        if (Line.compare(0, Field.size(), Field) == 0)
+        {
+            return std::stoull(Line.substr(Field.size()));
+        }
+    }
+    return 0;
+}
+
+static uint64_t CountOpenFiles()
+{
+    uint64_t Files = 0;
+#ifndef _WIN32
+    DIR *Directory = opendir("/proc/self/fd");
+    if (!Directory)
+    {
+        return 0;
+    }
+    while (struct dirent *Entry = readdir(Directory))
+    {
+        if (Entry->d_name[0] != '.')
+        {
+            Files++;
+        }
+    }
+    closedir(Directory);
+    // Don't count the descriptor of the listing itself
+    Files = Files ? Files - 1 : 0;
+#endif
+    return Files;
+}
+
+void LoadMonitor::Sample()
+{
+    std::unique_lock<std::mutex> lock(m_SampleMutex);
+    while (!m_StopSampling)
+    {
+        lock.unlock();
+        SampleCpu();
+        m_ProcessThreads = ReadStatusField("Threads:");
+        // Reported in kB
+        m_ResidentBytes = ReadStatusField("VmRSS:") * 1024;
+        m_OpenFiles = CountOpenFiles();
+        lock.lock();
+        m_ConVarSample.wait_for(lock, CpuSampleInterval, [&] { return m_StopSampling; });
+    }
+}
+
+void LoadMonitor::SampleCpu()
+{
+    // First line of /proc/stat: cpu user nice system idle iowait irq softirq steal ...
+    std::ifstream ProcStat("/proc/stat");
+    std::string Line;
+    if (!ProcStat.is_open() || !std::getline(ProcStat, Line))
+    {
+        return;
+    }
+    std::istringstream Fields(Line);
+    std::string Cpu;
+    uint64_t Value = 0, Total = 0, Idle = 0;
+    Fields >> Cpu;
+    for (int Field = 0; Fields >> Value; ++Field)
+    {
+        Total += Value;
+        if (Field == 3 || Field == 4) // idle, iowait
+        {
+            Idle += Value;
+        }
+    }
+
+    const uint64_t Busy = Total - Idle;
+    if (m_LastCpuTotal != 0 && Total > m_LastCpuTotal)
+    {
+        m_CpuUtilisation = double(Busy - m_LastCpuBusy) / double(Total - m_LastCpuTotal);
+    }
+    m_LastCpuBusy = Busy;
+    m_LastCpuTotal = Total;
+}
+
+double LoadMonitor::GetCpuUtilisation()
+{
+    return getInstance().m_CpuUtilisation.load();
+}
+
+uint64_t LoadMonitor::GetProcessThreads()
+{
+    return getInstance().m_ProcessThreads.load();
+}
+
+uint64_t LoadMonitor::GetResidentBytes()
+{
+    return getInstance().m_ResidentBytes.load();
+}
+
+uint64_t LoadMonitor::GetOpenFiles()
+{
+    return getInstance().m_OpenFiles.load();
+}
+
+json LoadMonitor::GetStats()
+{
+    json Stats;
+    Stats["activeJobs"] = GetActiveJobs();
+    Stats["queuedFrames"] = GetQueuedFrames();
+    Stats["processedFrames"] = getInstance().m_ProcessedFrames.load();
+    Stats["cpuUtilisation"] = GetCpuUtilisation();
+    Stats["processingLatencyP50Us"] = GetLatencyPercentileUs(0.50);
+    Stats["processingLatencyP99Us"] = GetLatencyPercentileUs(0.99);
+    Stats["liveConnections"] = getInstance().m_LiveConnections.load();
+    Stats["liveJobConnections"] = getInstance().m_LiveJobConnections.load();
+    Stats["liveThreads"] = getInstance().m_LiveThreads.load();
+    Stats["processThreads"] = GetProcessThreads();
+    Stats["residentBytes"] = GetResidentBytes();
+    Stats["openFiles"] = GetOpenFiles();
+    return Stats;
+}
+} // namespace ProcessingUnit
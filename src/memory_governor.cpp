@@ -0,0 +1,164 @@
+#include "memory_governor.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace ProcessingUnit
+{
+const std::string TotalBytesLabel("totalBytes");
+const std::string PerJobReservedBytesLabel("perJobReservedBytes");
+
+MemoryGovernor::Account::Account(const std::string &JobId, std::function<void()> OnCredit)
+{
+    MemoryGovernor &Governor = getInstance();
+    std::lock_guard<std::mutex> lock(Governor.m_Mutex);
+    m_Id = Governor.m_NextId++;
+    AccountState &State = Governor.m_Accounts[m_Id];
+    State.JobId = JobId;
+    State.OnCredit = OnCredit;
+}
+
+MemoryGovernor::Account::~Account()
+{
+    MemoryGovernor &Governor = getInstance();
+    {
+        std::lock_guard<std::mutex> lock(Governor.m_Mutex);
+        auto Iter = Governor.m_Accounts.find(m_Id);
+        Governor.m_Used -= Iter->second.Used;
+        Governor.m_Accounts.erase(Iter);
+    }
+    Governor.GrantWithheld();
+}
+
+void MemoryGovernor::Account::Charge(std::size_t Bytes)
+{
+    MemoryGovernor &Governor = getInstance();
+    std::lock_guard<std::mutex> lock(Governor.m_Mutex);
+    AccountState &State = Governor.m_Accounts.at(m_Id);
+    State.Used += Bytes;
+    State.Peak = std::max(State.Peak, State.Used);
+    Governor.m_Used += Bytes;
+    Governor.m_Peak = std::max(Governor.m_Peak, Governor.m_Used);
+}
+
+void MemoryGovernor::Account::Release(std::size_t Bytes)
+{
+    MemoryGovernor &Governor = getInstance();
+    {
+        std::lock_guard<std::mutex> lock(Governor.m_Mutex);
+        AccountState &State = Governor.m_Accounts.at(m_Id);
+        Bytes = std::min(Bytes, State.Used);
+        State.Used -= Bytes;
+        Governor.m_Used -= Bytes;
+    }
+    Governor.GrantWithheld();
+}
+
+bool MemoryGovernor::Account::TryTakeCredit()
+{
+    MemoryGovernor &Governor = getInstance();
+    std::lock_guard<std::mutex> lock(Governor.m_Mutex);
+    AccountState &State = Governor.m_Accounts.at(m_Id);
+    if (State.Withheld == 0 && Governor.HasCredit(State))
+    {
+        return true;
+    }
+    // Keeps the order of credits, once one is withheld the following ones wait too
+    State.Withheld++;
+    State.WithheldTotal++;
+    Governor.m_CreditsWithheld++;
+    return false;
+}
+
+std::size_t MemoryGovernor::SharedUsed() const
+{
+    std::size_t Shared = 0;
+    for (auto Iter = m_Accounts.begin(); Iter != m_Accounts.end(); ++Iter)
+    {
+        if (Iter->second.Used > m_PerJobReservedBytes)
+        {
+            Shared += Iter->second.Used - m_PerJobReservedBytes;
+        }
+    }
+    return Shared;
+}
+
+bool MemoryGovernor::HasCredit(const AccountState &State) const
+{
+    if (m_TotalBytes == 0 || State.Used < m_PerJobReservedBytes)
+    {
+        return true;
+    }
+    const std::size_t Reserved = m_PerJobReservedBytes * m_Accounts.size();
+    const std::size_t SharedPool = m_TotalBytes > Reserved ? m_TotalBytes - Reserved : 0;
+    return SharedUsed() < SharedPool;
+}
+
+void MemoryGovernor::GrantWithheld()
+{
+    std::vector<std::function<void()>> Credits;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (auto Iter = m_Accounts.begin(); Iter != m_Accounts.end(); ++Iter)
+        {
+            AccountState &State = Iter->second;
+            // Granted credits don't use memory until the frames arrive, so all of a job's go at once
+            if (State.Withheld && HasCredit(State))
+            {
+                Credits.insert(Credits.end(), State.Withheld, State.OnCredit);
+                State.Withheld = 0;
+            }
+        }
+    }
+    for (std::function<void()> &Credit : Credits)
+    {
+        if (Credit)
+        {
+            Credit();
+        }
+    }
+}
+
+void MemoryGovernor::SetBudget(const json &Config)
+{
+    MemoryGovernor &Governor = getInstance();
+    {
+        std::lock_guard<std::mutex> lock(Governor.m_Mutex);
+        if (Config.is_object())
+        {
+            fetch(Config, TotalBytesLabel, Governor.m_TotalBytes);
+            fetch(Config, PerJobReservedBytesLabel, Governor.m_PerJobReservedBytes);
+        }
+    }
+    Governor.GrantWithheld();
+}
+
+json MemoryGovernor::GetStats()
+{
+    MemoryGovernor &Governor = getInstance();
+    std::lock_guard<std::mutex> lock(Governor.m_Mutex);
+
+    json Jobs = json::array();
+    for (auto Iter = Governor.m_Accounts.begin(); Iter != Governor.m_Accounts.end(); ++Iter)
+    {
+        const AccountState &State = Iter->second;
+        json Job;
+        Job["jobId"] = State.JobId;
+        Job["usedBytes"] = State.Used;
+        Job["peakBytes"] = State.Peak;
+        Job["withheldCredits"] = State.Withheld;
+        Job["creditsWithheldTotal"] = State.WithheldTotal;
+        Jobs.push_back(Job);
+    }
+
+    json Stats;
+    Stats[TotalBytesLabel] = Governor.m_TotalBytes;
+    Stats[PerJobReservedBytesLabel] = Governor.m_PerJobReservedBytes;
+    Stats["usedBytes"] = Governor.m_Used;
+    Stats["sharedUsedBytes"] = Governor.SharedUsed();
+    Stats["peakBytes"] = Governor.m_Peak;
+    Stats["creditsWithheld"] = Governor.m_CreditsWithheld;
+    Stats["jobs"] = Jobs;
+    return Stats;
+}
+} // namespace ProcessingUnit
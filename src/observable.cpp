@@ -1,32 +1,120 @@
 #include "observable.hpp"
+#include "fan_out.hpp"
 
 namespace ProcessingUnit
 {
+Observable::Observable() : _callbacks_observers_map(new CallbacksMap)
+{
+    _readers[0] = 0;
+    _readers[1] = 0;
+}
+
+Observable::~Observable()
+{
+    delete _callbacks_observers_map.load();
+}
+
+Observable::reader_scope::reader_scope(Observable &observable)
+{
+    while (true)
+    {
+        const uint64_t epoch = observable._epoch.load();
+        _readers = &observable._readers[epoch & 1];
+        _readers->fetch_add(1);
+        // Counted before the epoch moved on, so its grace period waits for this reader
+        if (observable._epoch.load() == epoch)
+        {
+            break;
+        }
+        _readers->fetch_sub(1);
+    }
+    _snapshot = observable._callbacks_observers_map.load();
+}
+
+Observable::reader_scope::~reader_scope()
+{
+    _readers->fetch_sub(1);
+}
+
+void Observable::publish(std::unique_ptr<CallbacksMap> snapshot)
+{
+    _retired.emplace_back(_callbacks_observers_map.exchange(snapshot.release()));
+}
+
 uint32_t Observable::subscribe(std::function<void(ObserverDataMessage &)> callback)
 {
     std::lock_guard<std::mutex> lck_input_publisher(_mutex_publisher);
-    _callbacks_observers_map[_counter] = callback;
+    std::unique_ptr<CallbacksMap> snapshot(new CallbacksMap(*_callbacks_observers_map.load()));
+    (*snapshot)[_counter] = std::move(callback);
+    // The replaced snapshot waits for the grace period of the next unsubscribe
+    publish(std::move(snapshot));
     return _counter++;
 }
 
 void Observable::unsubscribe(uint32_t callback_identifier)
 {
     std::lock_guard<std::mutex> lck_input_publisher(_mutex_publisher);
-    auto it = _callbacks_observers_map.find(callback_identifier);
-    if (it != _callbacks_observers_map.end())
+    if (!_callbacks_observers_map.load()->count(callback_identifier))
     {
-        _callbacks_observers_map.erase(it);
+        return;
     }
+    std::unique_ptr<CallbacksMap> snapshot(new CallbacksMap(*_callbacks_observers_map.load()));
+    snapshot->erase(callback_identifier);
+    publish(std::move(snapshot));
+
+    // Grace period: readers that came after the swap see the new snapshot, wait for the
+    // ones counted in the epoch before, they may still hold a replaced one
+    const uint64_t epoch = _epoch.fetch_add(1);
+    std::atomic<uint64_t> &readers = _readers[epoch & 1];
+    for (unsigned spins = 0; readers.load() != 0; ++spins)
+    {
+        if (spins < 64)
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+    _retired.clear();
 }
 
 void Observable::notify(ObserverDataMessage &input_data_message)
 {
-    std::lock_guard<std::mutex> lck_input_publisher(_mutex_publisher);
-    for (auto it = _callbacks_observers_map.begin(); it != _callbacks_observers_map.end(); ++it)
+    const reader_scope reader(*this);
+    for (auto it = reader.callbacks().begin(); it != reader.callbacks().end(); ++it)
+    {
+        it->second(input_data_message);
+    }
+}
+
+std::size_t Observable::fan_out(const ObserverDataMessage &input_data_message, std::vector<uint32_t> &deferred_subscribers)
+{
+    const reader_scope reader(*this);
+    // Copies of the message header, the payload is shared
+    std::vector<ObserverDataMessage> messages(reader.callbacks().size(), input_data_message);
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(messages.size());
+    std::size_t index = 0;
+    for (auto it = reader.callbacks().begin(); it != reader.callbacks().end(); ++it, ++index)
+    {
+        ObserverDataMessage &message = messages[index];
+        message.subscriber_id = it->first;
+        message.result_deferred = false;
+        const std::function<void(ObserverDataMessage &)> &callback = it->second;
+        tasks.push_back([&callback, &message] { callback(message); });
+    }
+    FanOutPool::Run(tasks);
+
+    for (const ObserverDataMessage &message : messages)
     {
-        auto callback = it->second;
-        callback(input_data_message);
+        if (message.result_deferred)
+        {
+            deferred_subscribers.push_back(message.subscriber_id);
+        }
     }
+    return tasks.size();
 }
 
 } // namespace ProcessingUnit
@@ -23,15 +23,21 @@ const std::string JobIdLabel("jobId");
 const std::string InfoLabel("info");
 const std::string PayloadLabel("payload");
 const std::string IsReadyLabel("isReady");
+const std::string ResumeTokenLabel("resumeToken");
+const std::string ResumedLabel("resumed");
+const std::string StatsLabel("stats");
 const std::string DescriptionLabel("description");
 const std::string MetadataLabel("metadata");
+const std::string ChannelLabel("channel");
 
 const std::string StartMessageType("start");
 const std::string ReadyMessageType("ready");
 const std::string DataMessageType("data");
 const std::string ContinueMessageType("continue");
 const std::string EndMessageType("end");
+const std::string StatsMessageType("stats");
 const std::string UnknownMessageType("unknown");
+const std::size_t DefaultMaxPayloadSize = 256 * 1024 * 1024;
 
 Message::MessageType MessageTypeFromString(const std::string &MsgTypeStr)
 {
@@ -55,6 +61,10 @@ Message::MessageType MessageTypeFromString(const std::string &MsgTypeStr)
     {
         return Message::End;
     }
+    else if (MsgTypeStr == StatsMessageType)
+    {
+        return Message::Stats;
+    }
     else
     {
         return Message::Unknown;
@@ -80,6 +90,9 @@ std::string MessageTypeToString(Message::MessageType MsgType)
     case Message::End:
         return EndMessageType;
         break;
+    case Message::Stats:
+        return StatsMessageType;
+        break;
     case Message::Unknown:
     default:
         return UnknownMessageType;
@@ -105,6 +118,7 @@ Message::Message(MessageType MsgType) : m_MessageType(MsgType) {}
 Message::MessageType Message::GetMessageType() const { return m_MessageType; }
 std::string Message::GetMessageTypeAsString() const { return MessageTypeToString(m_MessageType); }
 std::string Message::GetInfoLabel() { return InfoLabel; }
+std::string Message::GetChannelLabel() { return ChannelLabel; }
 std::string Message::GetPayloadLabel() { return PayloadLabel; }
 std::string Message::GetPreamble() { return Pre; }
 std::string Message::GetPostamble() { return Post; }
@@ -116,6 +130,15 @@ StartMessage::StartMessage() : Message(StartMessageType), m_JobId(), m_InfoJson(
 StartMessage::StartMessage(const std::string &JobId, const json &Info) : Message(StartMessageType), m_JobId(JobId), m_InfoJson(Info) {}
 std::string StartMessage::GetJobId() const { return m_JobId; }
 json StartMessage::GetInfoJson() const { return m_InfoJson; }
+std::string StartMessage::GetResumeToken() const
+{
+    std::string ResumeToken;
+    if (m_InfoJson.is_object())
+    {
+        fetch(m_InfoJson, ResumeTokenLabel, ResumeToken);
+    }
+    return ResumeToken;
+}
 
 void StartMessage::SetJobId(const std::string &JobId) { m_JobId = JobId; }
 //void StartMessage::SetInfo(const std::string& Info) { m_Info = Info; }
@@ -140,15 +163,28 @@ DataMessage::DataMessage(const std::string &Metadata, const std::vector<char> &P
 DataMessage::DataMessage(const std::string &Metadata, const std::vector<unsigned char> &Payload) : Message(DataMessageType), m_Metadata(Metadata), m_Payload(Payload.begin(), Payload.end()) {}
 std::string DataMessage::GetMetaData() const { return m_Metadata; }
 std::vector<char> DataMessage::GetPayloadData() const { return m_Payload; }
+const std::vector<char> &DataMessage::GetPayload() const { return m_Payload; }
 std::size_t DataMessage::GetPayloadSize() const { return m_Payload.size(); }
 
 void DataMessage::SetMetadata(const std::string &Metadata) { m_Metadata = Metadata; }
 
+std::vector<char> DataMessage::TakePayload()
+{
+    std::vector<char> Payload;
+    Payload.swap(m_Payload);
+    return Payload;
+}
+
 void DataMessage::SetPayload(const std::vector<char> &Payload)
 {
     m_Payload = Payload;
 }
 
+void DataMessage::SetPayload(std::vector<char> &&Payload)
+{
+    m_Payload = std::move(Payload);
+}
+
 void to_json(json &J, const DataMessage &M)
 {
     J = json{{MessageTypeLabel, M.GetMessageTypeAsString()}, {MetadataLabel, M.GetMetaData()}};
@@ -172,12 +208,21 @@ std::string ReadyMessage::GetDescription() const { return m_Description; }
 
 void ReadyMessage::SetIsReady(bool IsReady) { m_IsReady = IsReady; }
 void ReadyMessage::SetDescription(const std::string &Description) { m_Description = Description; }
+std::string ReadyMessage::GetResumeToken() const { return m_ResumeToken; }
+bool ReadyMessage::IsResumed() const { return m_Resumed; }
+void ReadyMessage::SetResumeToken(const std::string &ResumeToken) { m_ResumeToken = ResumeToken; }
+void ReadyMessage::SetResumed(bool Resumed) { m_Resumed = Resumed; }
 
 void to_json(json &J, const ReadyMessage &M)
 {
     if (M.IsReady())
     {
         J = json{{MessageTypeLabel, M.GetMessageTypeAsString()}, {IsReadyLabel, M.IsReady()}};
+        if (!M.GetResumeToken().empty())
+        {
+            J[ResumeTokenLabel] = M.GetResumeToken();
+            J[ResumedLabel] = M.IsResumed();
+        }
     }
     else
     {
@@ -193,6 +238,14 @@ void from_json(const json &J, ReadyMessage &M)
     {
         M.SetDescription(J.at(DescriptionLabel).get<std::string>());
     }
+    if (J.count(ResumeTokenLabel) > 0)
+    {
+        M.SetResumeToken(J.at(ResumeTokenLabel).get<std::string>());
+    }
+    if (J.count(ResumedLabel) > 0)
+    {
+        M.SetResumed(J.at(ResumedLabel).get<bool>());
+    }
 }
 
 /////////////////////////////////////////////////////////////
@@ -223,6 +276,30 @@ void from_json(const json &J, EndMessage &M)
 
 /////////////////////////////////////////////////////////////
 
+StatsMessage::StatsMessage() : Message(StatsMessageType) {}
+StatsMessage::StatsMessage(const json &Stats) : Message(StatsMessageType), m_Stats(Stats) {}
+json StatsMessage::GetStats() const { return m_Stats; }
+void StatsMessage::SetStats(const json &Stats) { m_Stats = Stats; }
+
+void to_json(json &J, const StatsMessage &M)
+{
+    J = json{{MessageTypeLabel, M.GetMessageTypeAsString()}};
+    if (!M.GetStats().is_null())
+    {
+        J[StatsLabel] = M.GetStats();
+    }
+}
+void from_json(const json &J, StatsMessage &M)
+{
+    M.SetMessageType(J.at(MessageTypeLabel).get<std::string>());
+    if (J.count(StatsLabel) > 0)
+    {
+        M.SetStats(J.at(StatsLabel));
+    }
+}
+
+/////////////////////////////////////////////////////////////
+
 Message::MessageType MessageReader::GetMessageType() const
 {
     return m_CurrMessageType;
@@ -234,6 +311,7 @@ std::unique_ptr<StartMessage> MessageReader::GetStartMessage() const
     if (m_CurrMessageType == Message::Start)
     {
         *Msg = m_Json;
+        Msg->SetChannel(GetChannel());
     }
     return Msg;
 }
@@ -244,6 +322,7 @@ std::unique_ptr<ReadyMessage> MessageReader::GetReadyMessage() const
     if (m_CurrMessageType == Message::Ready)
     {
         *Msg = m_Json;
+        Msg->SetChannel(GetChannel());
     }
     return Msg;
 }
@@ -254,6 +333,7 @@ std::unique_ptr<EndMessage> MessageReader::GetEndMessage() const
     if (m_CurrMessageType == Message::End)
     {
         *Msg = m_Json;
+        Msg->SetChannel(GetChannel());
     }
     return Msg;
 }
@@ -264,6 +344,18 @@ std::unique_ptr<ContinueMessage> MessageReader::GetContinueMessage() const
     if (m_CurrMessageType == Message::Continue)
     {
         *Msg = m_Json;
+        Msg->SetChannel(GetChannel());
+    }
+    return Msg;
+}
+
+std::unique_ptr<StatsMessage> MessageReader::GetStatsMessage() const
+{
+    std::unique_ptr<StatsMessage> Msg(new StatsMessage());
+    if (m_CurrMessageType == Message::Stats)
+    {
+        *Msg = m_Json;
+        Msg->SetChannel(GetChannel());
     }
     return Msg;
 }
@@ -274,7 +366,8 @@ std::unique_ptr<DataMessage> MessageReader::GetDataMessage()
     if (m_CurrMessageType == Message::Data)
     {
         *Msg = m_Json;
-        Msg->SetPayload(m_Payload);
+        Msg->SetChannel(GetChannel());
+        Msg->SetPayload(std::move(m_Payload));
     }
     return Msg;
 }
@@ -287,6 +380,7 @@ std::unique_ptr<Message> MessageReader::GetMessage() const
     {
         std::unique_ptr<StartMessage> Msg(new StartMessage());
         *Msg = m_Json;
+        Msg->SetChannel(GetChannel());
         return Msg;
     }
     break;
@@ -295,6 +389,7 @@ std::unique_ptr<Message> MessageReader::GetMessage() const
         //return ReadyMessageType;
         std::unique_ptr<ReadyMessage> Msg(new ReadyMessage());
         *Msg = m_Json;
+        Msg->SetChannel(GetChannel());
         return Msg;
     }
     break;
@@ -302,6 +397,7 @@ std::unique_ptr<Message> MessageReader::GetMessage() const
     {
         std::unique_ptr<DataMessage> Msg(new DataMessage());
         *Msg = m_Json;
+        Msg->SetChannel(GetChannel());
         Msg->SetPayload(m_Payload);
         return Msg;
     }
@@ -310,6 +406,7 @@ std::unique_ptr<Message> MessageReader::GetMessage() const
     {
         std::unique_ptr<ContinueMessage> Msg(new ContinueMessage());
         *Msg = m_Json;
+        Msg->SetChannel(GetChannel());
         return Msg;
     }
     break;
@@ -317,6 +414,15 @@ std::unique_ptr<Message> MessageReader::GetMessage() const
     {
         std::unique_ptr<EndMessage> Msg(new EndMessage());
         *Msg = m_Json;
+        Msg->SetChannel(GetChannel());
+        return Msg;
+    }
+    break;
+    case Message::Stats:
+    {
+        std::unique_ptr<StatsMessage> Msg(new StatsMessage());
+        *Msg = m_Json;
+        Msg->SetChannel(GetChannel());
         return Msg;
     }
     break;
@@ -327,6 +433,18 @@ std::unique_ptr<Message> MessageReader::GetMessage() const
     }
 }
 
+std::string MessageReader::GetChannel() const
+{
+    std::string Channel;
+    if (m_Json.is_object())
+    {
+        fetch(m_Json, ChannelLabel, Channel);
+    }
+    return Channel;
+}
+
+std::size_t MessageReader::GetPayloadSize() const { return m_Payload.size(); }
+
 bool MessageReader::Parse(const std::string &Input)
 {
     bool RetVal = false;
@@ -361,7 +479,19 @@ bool MessageReader::Parse(const std::string &Input)
             }
             else if (Iter->first == PayloadLabel)
             {
-                Iter->second.convert<std::vector<char>>(m_Payload);
+                // Same limit as the streamed parser, the recorder and small messages come this way
+                const msgpack::object &Payload = Iter->second;
+                const std::size_t Size = Payload.type == msgpack::type::BIN   ? Payload.via.bin.size
+                                         : Payload.type == msgpack::type::STR ? Payload.via.str.size
+                                         : Payload.type == msgpack::type::ARRAY ? Payload.via.array.size
+                                                                                : 0;
+                if (Size > s_MaxPayloadSize)
+                {
+                    std::cerr << "Error: Payload of " << Size << " bytes is over the limit of " << s_MaxPayloadSize << std::endl;
+                    m_Payload.clear();
+                    return false;
+                }
+                Payload.convert<std::vector<char>>(m_Payload);
             }
             else
             {
@@ -372,4 +502,179 @@ bool MessageReader::Parse(const std::string &Input)
     }
     return RetVal;
 }
+
+namespace
+{
+bool ReadExactly(std::istream &Input, char *Destination, std::size_t Size)
+{
+    Input.read(Destination, Size);
+    return std::size_t(Input.gcount()) == Size;
+}
+
+bool ReadBigEndian(std::istream &Input, std::size_t Bytes, uint32_t &Value)
+{
+    unsigned char Buffer[4];
+    if (!ReadExactly(Input, reinterpret_cast<char *>(Buffer), Bytes))
+    {
+        return false;
+    }
+    Value = 0;
+    for (std::size_t Index = 0; Index < Bytes; ++Index)
+    {
+        Value = (Value << 8) | Buffer[Index];
+    }
+    return true;
+}
+
+// fixmap, map 16 and map 32
+bool ReadMapHeader(std::istream &Input, uint32_t &Entries)
+{
+    const int Marker = Input.get();
+    if (Marker >= 0x80 && Marker <= 0x8f)
+    {
+        Entries = Marker & 0x0f;
+        return true;
+    }
+    if (Marker == 0xde || Marker == 0xdf)
+    {
+        return ReadBigEndian(Input, Marker == 0xde ? 2 : 4, Entries);
+    }
+    return false;
+}
+
+// Any str or bin header, both carry raw bytes in this protocol
+bool ReadRawHeader(std::istream &Input, uint32_t &Size)
+{
+    const int Marker = Input.get();
+    if (Marker >= 0xa0 && Marker <= 0xbf)
+    {
+        Size = Marker & 0x1f;
+        return true;
+    }
+    switch (Marker)
+    {
+    case 0xc4: // bin 8
+    case 0xd9: // str 8
+        return ReadBigEndian(Input, 1, Size);
+    case 0xc5: // bin 16
+    case 0xda: // str 16
+        return ReadBigEndian(Input, 2, Size);
+    case 0xc6: // bin 32
+    case 0xdb: // str 32
+        return ReadBigEndian(Input, 4, Size);
+    default:
+        return false;
+    }
+}
+
+// Input holds the whole message in its buffer, a size beyond what is left of it is corrupt
+bool IsAvailable(std::istream &Input, uint32_t Size)
+{
+    const std::streamsize Available = Input.rdbuf()->in_avail();
+    return Available >= 0 && uint64_t(Available) >= Size;
+}
+
+bool ReadRawString(std::istream &Input, std::string &Value)
+{
+    uint32_t Size = 0;
+    if (!ReadRawHeader(Input, Size) || !IsAvailable(Input, Size))
+    {
+        return false;
+    }
+    Value.resize(Size);
+    return Size == 0 || ReadExactly(Input, &Value[0], Size);
+}
+} // namespace
+
+std::atomic<std::size_t> MessageReader::s_MaxPayloadSize(DefaultMaxPayloadSize);
+
+void MessageReader::SetMaxPayloadSize(std::size_t Size)
+{
+    s_MaxPayloadSize = Size;
+}
+
+bool MessageReader::Parse(std::istream &Input)
+{
+    return ParseStream(Input, true);
+}
+
+bool MessageReader::ParseInfo(std::istream &Input)
+{
+    return ParseStream(Input, false);
+}
+
+bool MessageReader::ParseStream(std::istream &Input, bool KeepPayload)
+{
+    bool RetVal = false;
+
+    uint32_t Entries = 0;
+    if (!ReadMapHeader(Input, Entries))
+    {
+        std::cerr << "Error: We couldn't convert the incoming message to a map, wrong protocol? " << std::endl;
+        return false;
+    }
+
+    for (uint32_t Entry = 0; Entry < Entries; ++Entry)
+    {
+        std::string Key;
+        if (!ReadRawString(Input, Key))
+        {
+            std::cerr << "Error: Malformed message key, wrong protocol? " << std::endl;
+            return false;
+        }
+
+        if (Key == InfoLabel)
+        {
+            std::string JsonString;
+            if (!ReadRawString(Input, JsonString))
+            {
+                std::cerr << "Error: Malformed info in message" << std::endl;
+                return false;
+            }
+            m_Json = nlohmann::json::parse(JsonString);
+            m_CurrMessageType = SafeMessageTypeExtractFromJson(m_Json);
+            RetVal = true;
+        }
+        else if (Key == PayloadLabel)
+        {
+            uint32_t Size = 0;
+            if (!ReadRawHeader(Input, Size) || !IsAvailable(Input, Size))
+            {
+                std::cerr << "Error: Malformed payload in message" << std::endl;
+                return false;
+            }
+            if (Size > s_MaxPayloadSize)
+            {
+                std::cerr << "Error: Payload of " << Size << " bytes is over the limit of " << s_MaxPayloadSize << std::endl;
+                return false;
+            }
+            if (!KeepPayload)
+            {
+                Input.ignore(Size);
+                continue;
+            }
+            m_Payload.resize(Size);
+            if (Size && !ReadExactly(Input, m_Payload.data(), Size))
+            {
+                std::cerr << "Error: Message ended inside the payload" << std::endl;
+                m_Payload.clear();
+                return false;
+            }
+        }
+        else
+        {
+            uint32_t Size = 0;
+            if (!ReadRawHeader(Input, Size) || !IsAvailable(Input, Size))
+            {
+                std::cerr << "Error: Unsupported message received, did protocol change? "
+                          << "Key: " << Key << std::endl;
+                return false;
+            }
+            std::cerr << "Error: Unsupported message received, did protocol change? "
+                      << "Key: " << Key << std::endl;
+            Input.ignore(Size);
+        }
+    }
+    return RetVal;
+}
 } // namespace ProcessingUnit
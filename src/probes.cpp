@@ -0,0 +1,11 @@
+#include "probes.hpp"
+
+#ifdef PU_HAVE_SDT
+// Tracers raise a semaphore while they are attached to its probe
+#define PU_PROBE_SEMAPHORE_DEFINE(name) \
+    volatile unsigned short processing_unit_##name##_semaphore __attribute__((unused, section(".probes"))) = 0;
+extern "C"
+{
+    PU_PROBE_LIST(PU_PROBE_SEMAPHORE_DEFINE)
+}
+#endif
@@ -22,6 +22,19 @@
 #include "spdlog/sinks/basic_file_sink.h"
 #include "spdlog/sinks/stdout_color_sinks.h"
 #include "json/jsonconfig.hpp"
+#include "batch_scheduler.hpp"
+#include "processor_pool.hpp"
+#include "stream_recorder.hpp"
+#include "thread_placement.hpp"
+#include "fair_scheduler.hpp"
+#include "load_monitor.hpp"
+#include "admission_controller.hpp"
+#include "memory_governor.hpp"
+#include "frame_gate.hpp"
+#include "session_registry.hpp"
+#include "tuning_config.hpp"
+#include "frame_tracer.hpp"
+#include "fan_out.hpp"
 
 namespace ProcessingUnit
 {
@@ -40,7 +53,9 @@ bool ProcessingUnitServer::StartProcessingUnitServer()
     ConsoleSink->set_level(spdlog::level::trace); // only shows warnings or errors
     ConsoleSink->set_pattern("[%H:%M:%S] [%^%l%$] [thread %t] - %v ");
 
-    auto FileSink = std::make_shared<spdlog::sinks::basic_file_sink_mt>("log.txt", true);
+    std::string LogFile("log.txt");
+    fetch(TuningConfig::Get("logging"), "file", LogFile);
+    auto FileSink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(LogFile, true);
     FileSink->set_level(spdlog::level::trace);
     FileSink->set_pattern("[%H:%M:%S] [%^%l%$] [thread %t] - %v ");
 
@@ -51,17 +66,43 @@ bool ProcessingUnitServer::StartProcessingUnitServer()
     std::shared_ptr<spdlog::logger> Logger = std::make_shared<spdlog::logger>(NameLogger, Sinks.begin(), Sinks.end());
     spdlog::register_logger(Logger);
     spdlog::get(NameLogger)->set_level(spdlog::level::trace);
+    TuningConfig::ApplyLogLevels();
+
+	// Expensive processor initialization happens before the first camera connects
+	if (!_processor_pool_config.empty())
+	{
+		ProcessorPool::Prewarm(_processor_pool_config);
+	}
 
 	//-------------------
 	// Main program loop
 	//-------------------
+	std::string Host = _host;
+	int Port = _port;
+	std::string Endpoint("^/$");
+	std::size_t IoThreads = 1;
+	const json ServerConfig = TuningConfig::Get("server");
+	// The port given to the server wins, the tuning file only fills in what wasn't given
+	if (Host.empty())
+	{
+		fetch(ServerConfig, "host", Host);
+	}
+	int TuningPort = Port;
+	fetch(ServerConfig, "port", TuningPort);
+	if (TuningPort != Port)
+	{
+		spdlog::get(NameLogger)->warn("server.port " + std::to_string(TuningPort) + " of the tuning file is ignored, listening on port " + std::to_string(Port) + " as given to the server");
+	}
+	fetch(ServerConfig, "endpoint", Endpoint);
+	fetch(ServerConfig, "ioThreads", IoThreads);
+
 	std::ostringstream Stream;
-	Stream << "Opening websocket server - " << "  -> " << _host << ":" << _port << std::endl;
+	Stream << "Opening websocket server - " << "  -> " << Host << ":" << Port << std::endl;
 	spdlog::get(NameLogger)->info(Stream.str());
 
 	// Attach our callbacks to the agent and start it up. Ctrl+C to exit.
     vmsAgent = new VmsAgent();
-	bool success = vmsAgent->start(_host, _port);
+	bool success = vmsAgent->start(Host, Port, Endpoint, IoThreads);
 	if (!success) {
 		spdlog::get(NameLogger)->error("Failed to start agent");
 		return false;
@@ -70,6 +111,46 @@ bool ProcessingUnitServer::StartProcessingUnitServer()
 	return true;
 }
 
+void ProcessingUnitServer::SetRecordingDirectory(const std::string &Directory)
+{
+    StreamRecorder::SetOutputDirectory(Directory);
+}
+
+void ProcessingUnitServer::SetThreadPlacement(const json &Config)
+{
+    ThreadPlacement::SetDefaults(Config);
+}
+
+void ProcessingUnitServer::SetAdmissionLimits(const json &Limits)
+{
+    AdmissionController::SetLimits(Limits);
+}
+
+void ProcessingUnitServer::SetMemoryBudget(const json &Config)
+{
+    MemoryGovernor::SetBudget(Config);
+}
+
+void ProcessingUnitServer::SetSessionResumption(const json &Config)
+{
+    SessionRegistry::SetResumption(Config);
+}
+
+void ProcessingUnitServer::SetFrameTracing(const json &Config)
+{
+    FrameTracer::SetTracing(Config);
+}
+
+bool ProcessingUnitServer::LoadTuningConfig(const std::string &Path)
+{
+    if (!TuningConfig::Load(Path))
+    {
+        return false;
+    }
+    TuningConfig::WatchSighup();
+    return true;
+}
+
 void ProcessingUnitServer::StopProcessingUnitServer()
 {
      //close  season if exist
@@ -79,4 +160,24 @@ void ProcessingUnitServer::StopProcessingUnitServer()
         vmsAgent = nullptr;
     }
 }
+
+json ProcessingUnitServer::GetStats() const
+{
+    json Stats;
+    Stats["connections"] = vmsAgent ? vmsAgent->GetStats() : json::array();
+    Stats["batching"] = BatchScheduler::GetAllStats();
+    Stats["processorPool"] = ProcessorPool::GetStats();
+    Stats["threadPlacement"] = ThreadPlacement::GetStats();
+    Stats["scheduling"] = FairScheduler::GetStats();
+    Stats["load"] = LoadMonitor::GetStats();
+    Stats["admission"] = AdmissionController::GetStats();
+    Stats["memory"] = MemoryGovernor::GetStats();
+    Stats["sessions"] = SessionRegistry::GetStats();
+    Stats["frameGate"] = FrameGate::GetStats();
+    Stats["recording"] = StreamRecorder::GetStats();
+    Stats["fanOut"] = FanOutPool::GetStats();
+    Stats["tuning"] = TuningConfig::GetStats();
+    Stats["tracing"] = FrameTracer::GetStats();
+    return Stats;
+}
 }
@@ -0,0 +1,64 @@
+#include "processor.hpp"
+
+namespace ProcessingUnit
+{
+const std::string ProcessorLabel("processor");
+
+void IProcessor::ProcessBatch(const std::vector<DataPtr> &Inputs, std::vector<DataPtr> &Outputs)
+{
+    Outputs.resize(Inputs.size());
+    for (std::size_t Index = 0; Index < Inputs.size(); ++Index)
+    {
+        Process(Inputs[Index], Outputs[Index]);
+    }
+}
+
+void ProcessorRegistry::Register(const std::string &Name, ProcessorFactory Factory)
+{
+    ProcessorRegistry &Registry = getInstance();
+    std::lock_guard<std::mutex> lock(Registry.m_Mutex);
+    Registry.m_Factories[Name] = Factory;
+}
+
+void ProcessorRegistry::Unregister(const std::string &Name)
+{
+    ProcessorRegistry &Registry = getInstance();
+    std::lock_guard<std::mutex> lock(Registry.m_Mutex);
+    Registry.m_Factories.erase(Name);
+}
+
+std::string ProcessorRegistry::GetProcessorName(const json &Config)
+{
+    std::string Name;
+    if (Config.is_object())
+    {
+        fetch(Config, ProcessorLabel, Name);
+    }
+    return Name;
+}
+
+bool ProcessorRegistry::IsRegistered(const std::string &Name)
+{
+    ProcessorRegistry &Registry = getInstance();
+    std::lock_guard<std::mutex> lock(Registry.m_Mutex);
+    return Registry.m_Factories.count(Name) != 0;
+}
+
+std::shared_ptr<IProcessor> ProcessorRegistry::Create(const json &Config)
+{
+    const std::string Name = GetProcessorName(Config);
+    ProcessorFactory Factory;
+    {
+        ProcessorRegistry &Registry = getInstance();
+        std::lock_guard<std::mutex> lock(Registry.m_Mutex);
+        auto Iter = Registry.m_Factories.find(Name);
+        if (Iter == Registry.m_Factories.end())
+        {
+            return nullptr;
+        }
+        Factory = Iter->second;
+    }
+    // Factories can be expensive (model loading), don't hold the registry lock
+    return Factory(Config);
+}
+} // namespace ProcessingUnit
@@ -0,0 +1,172 @@
+#include "processor_pool.hpp"
+
+#include <exception>
+#include <sstream>
+
+#include "spdlog/spdlog.h"
+
+namespace ProcessingUnit
+{
+const std::string PoolCapacityLabel("capacity");
+const std::string PoolPrewarmLabel("prewarm");
+const std::string PoolInfoLabel("info");
+const std::string PoolCountLabel("count");
+
+ProcessorPool::PoolKey ProcessorPool::MakeKey(const json &Config)
+{
+    // nlohmann::json keeps object keys sorted, so equal configs dump to equal strings
+    PoolKey Key;
+    Key.Config = Config.dump();
+    Key.Hash = std::hash<std::string>()(Key.Config);
+    return Key;
+}
+
+std::shared_ptr<IProcessor> ProcessorPool::Acquire(const json &Config)
+{
+    ProcessorPool &Pool = getInstance();
+    const PoolKey Key = MakeKey(Config);
+    {
+        std::lock_guard<std::mutex> lock(Pool.m_Mutex);
+        for (auto Iter = Pool.m_Idle.begin(); Iter != Pool.m_Idle.end(); ++Iter)
+        {
+            if (Iter->Key == Key)
+            {
+                std::shared_ptr<IProcessor> Processor = Iter->Processor;
+                Pool.m_Idle.erase(Iter);
+                Pool.m_Hits++;
+                return Processor;
+            }
+        }
+    }
+
+    Pool.m_Misses++;
+    return ProcessorRegistry::Create(Config);
+}
+
+void ProcessorPool::Release(const json &Config, std::shared_ptr<IProcessor> Processor)
+{
+    if (!Processor)
+    {
+        return;
+    }
+
+    try
+    {
+        Processor->Reset();
+    }
+    catch (const std::exception &e)
+    {
+        // Don't keep an instance around that couldn't clean up after its job
+        spdlog::get("MainLogger")->warn(std::string("[ProcessorPool]: dropping processor, reset failed: ") + e.what());
+        return;
+    }
+
+    getInstance().Insert(MakeKey(Config), Processor);
+}
+
+void ProcessorPool::Insert(const PoolKey &Key, std::shared_ptr<IProcessor> Processor)
+{
+    std::list<IdleProcessor> Evicted;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        IdleProcessor Idle;
+        Idle.Key = Key;
+        Idle.Processor = Processor;
+        m_Idle.push_front(Idle);
+        while (m_Idle.size() > m_Capacity)
+        {
+            Evicted.splice(Evicted.end(), m_Idle, std::prev(m_Idle.end()));
+            m_Evictions++;
+        }
+    }
+    // Evicted instances are destroyed here, outside of the pool lock
+}
+
+bool ProcessorPool::Prewarm(const std::string &ConfigPath)
+{
+    const json PoolConfig = loadJson(ConfigPath);
+    if (!PoolConfig.is_object())
+    {
+        spdlog::get("MainLogger")->error("[ProcessorPool]: couldn't read pool config " + ConfigPath);
+        return false;
+    }
+
+    std::size_t Capacity = getInstance().m_Capacity;
+    fetch(PoolConfig, PoolCapacityLabel, Capacity);
+    SetCapacity(Capacity);
+
+    if (PoolConfig.count(PoolPrewarmLabel) == 0 || !PoolConfig[PoolPrewarmLabel].is_array())
+    {
+        return true;
+    }
+
+    for (const json &Entry : PoolConfig[PoolPrewarmLabel])
+    {
+        json Info;
+        int Count = 1;
+        fetch(Entry, PoolInfoLabel, Info);
+        fetch(Entry, PoolCountLabel, Count);
+
+        for (int Index = 0; Index < Count; ++Index)
+        {
+            std::shared_ptr<IProcessor> Processor;
+            try
+            {
+                Processor = ProcessorRegistry::Create(Info);
+            }
+            catch (const std::exception &e)
+            {
+                spdlog::get("MainLogger")->error(std::string("[ProcessorPool]: prewarm failed: ") + e.what());
+            }
+
+            if (!Processor)
+            {
+                spdlog::get("MainLogger")->warn("[ProcessorPool]: couldn't prewarm processor '" + ProcessorRegistry::GetProcessorName(Info) + "'");
+                break;
+            }
+            getInstance().Insert(MakeKey(Info), Processor);
+        }
+    }
+
+    std::ostringstream Str;
+    Str << "[ProcessorPool]: prewarmed, idle processors: " << GetStats()["idle"];
+    spdlog::get("MainLogger")->info(Str.str());
+    return true;
+}
+
+void ProcessorPool::SetCapacity(std::size_t Capacity)
+{
+    ProcessorPool &Pool = getInstance();
+    std::list<IdleProcessor> Evicted;
+    std::lock_guard<std::mutex> lock(Pool.m_Mutex);
+    Pool.m_Capacity = Capacity;
+    while (Pool.m_Idle.size() > Pool.m_Capacity)
+    {
+        Evicted.splice(Evicted.end(), Pool.m_Idle, std::prev(Pool.m_Idle.end()));
+        Pool.m_Evictions++;
+    }
+}
+
+void ProcessorPool::Clear()
+{
+    ProcessorPool &Pool = getInstance();
+    std::list<IdleProcessor> Idle;
+    std::lock_guard<std::mutex> lock(Pool.m_Mutex);
+    Idle.swap(Pool.m_Idle);
+}
+
+json ProcessorPool::GetStats()
+{
+    ProcessorPool &Pool = getInstance();
+    json Stats;
+    {
+        std::lock_guard<std::mutex> lock(Pool.m_Mutex);
+        Stats["idle"] = Pool.m_Idle.size();
+        Stats["capacity"] = Pool.m_Capacity;
+    }
+    Stats["hits"] = Pool.m_Hits.load();
+    Stats["misses"] = Pool.m_Misses.load();
+    Stats["evictions"] = Pool.m_Evictions.load();
+    return Stats;
+}
+} // namespace ProcessingUnit
@@ -0,0 +1,411 @@
+#include "radiometric_preprocessor.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PU_PREPROCESS_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PU_PREPROCESS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace ProcessingUnit
+{
+const std::string PreprocessLabel("preprocess");
+const std::string WidthLabel("width");
+const std::string HeightLabel("height");
+const std::string PixelFormatLabel("pixelFormat");
+const std::string AgcLabel("agc");
+const std::string ResizeLabel("resize");
+const std::string OutputWidthLabel("outputWidth");
+const std::string OutputHeightLabel("outputHeight");
+const std::string OutputTypeLabel("outputType");
+const std::string LayoutLabel("layout");
+const std::string ChannelsLabel("channels");
+
+// Resize weights are 8 bit fixed point
+const uint32_t WeightOne = 256;
+
+static void MinMaxU16(const uint16_t *Input, std::size_t Size, uint16_t &Min, uint16_t &Max)
+{
+    Min = 0xffff;
+    Max = 0;
+    std::size_t Index = 0;
+#if defined(PU_PREPROCESS_SSE2)
+    // SSE2 only has signed 16 bit min / max, flipping the sign bit keeps the order
+    const __m128i Bias = _mm_set1_epi16(short(0x8000));
+    __m128i VecMin = _mm_set1_epi16(0x7fff);
+    __m128i VecMax = _mm_set1_epi16(short(0x8000));
+    for (; Index + 8 <= Size; Index += 8)
+    {
+        const __m128i Values = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(Input + Index)), Bias);
+        VecMin = _mm_min_epi16(VecMin, Values);
+        VecMax = _mm_max_epi16(VecMax, Values);
+    }
+    uint16_t Lanes[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(Lanes), _mm_xor_si128(VecMin, Bias));
+    Min = *std::min_element(Lanes, Lanes + 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(Lanes), _mm_xor_si128(VecMax, Bias));
+    Max = *std::max_element(Lanes, Lanes + 8);
+#elif defined(PU_PREPROCESS_NEON)
+    uint16x8_t VecMin = vdupq_n_u16(0xffff);
+    uint16x8_t VecMax = vdupq_n_u16(0);
+    for (; Index + 8 <= Size; Index += 8)
+    {
+        const uint16x8_t Values = vld1q_u16(Input + Index);
+        VecMin = vminq_u16(VecMin, Values);
+        VecMax = vmaxq_u16(VecMax, Values);
+    }
+    uint16_t Lanes[8];
+    vst1q_u16(Lanes, VecMin);
+    Min = *std::min_element(Lanes, Lanes + 8);
+    vst1q_u16(Lanes, VecMax);
+    Max = *std::max_element(Lanes, Lanes + 8);
+#endif
+    for (; Index < Size; ++Index)
+    {
+        Min = std::min(Min, Input[Index]);
+        Max = std::max(Max, Input[Index]);
+    }
+}
+
+// (Input - Low) * Scale clamped to 0..255, rounded half up like the scalar tail
+static void LinearMapU8(const uint16_t *Input, std::size_t Size, float Low, float Scale, uint8_t *Output)
+{
+    std::size_t Index = 0;
+#if defined(PU_PREPROCESS_SSE2)
+    const __m128i Zero = _mm_setzero_si128();
+    const __m128 VecLow = _mm_set1_ps(Low);
+    const __m128 VecScale = _mm_set1_ps(Scale);
+    const __m128 VecHalf = _mm_set1_ps(0.5f);
+    const __m128 VecZero = _mm_setzero_ps();
+    const __m128 VecMax = _mm_set1_ps(255.0f);
+    for (; Index + 16 <= Size; Index += 16)
+    {
+        __m128i Words[2] = {_mm_loadu_si128(reinterpret_cast<const __m128i *>(Input + Index)),
+                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(Input + Index + 8))};
+        __m128i Packed[2];
+        for (int Half = 0; Half < 2; ++Half)
+        {
+            __m128i Ints[2] = {_mm_unpacklo_epi16(Words[Half], Zero), _mm_unpackhi_epi16(Words[Half], Zero)};
+            for (int Quarter = 0; Quarter < 2; ++Quarter)
+            {
+                __m128 Values = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(Ints[Quarter]), VecLow), VecScale);
+                Values = _mm_min_ps(_mm_max_ps(Values, VecZero), VecMax);
+                Ints[Quarter] = _mm_cvttps_epi32(_mm_add_ps(Values, VecHalf));
+            }
+            Packed[Half] = _mm_packs_epi32(Ints[0], Ints[1]);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(Output + Index), _mm_packus_epi16(Packed[0], Packed[1]));
+    }
+#elif defined(PU_PREPROCESS_NEON)
+    const float32x4_t VecLow = vdupq_n_f32(Low);
+    const float32x4_t VecScale = vdupq_n_f32(Scale);
+    const float32x4_t VecHalf = vdupq_n_f32(0.5f);
+    const float32x4_t VecZero = vdupq_n_f32(0.0f);
+    const float32x4_t VecMax = vdupq_n_f32(255.0f);
+    for (; Index + 8 <= Size; Index += 8)
+    {
+        const uint16x8_t Words = vld1q_u16(Input + Index);
+        float32x4_t Lo = vmulq_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(Words))), VecLow), VecScale);
+        float32x4_t Hi = vmulq_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(Words))), VecLow), VecScale);
+        Lo = vaddq_f32(vminq_f32(vmaxq_f32(Lo, VecZero), VecMax), VecHalf);
+        Hi = vaddq_f32(vminq_f32(vmaxq_f32(Hi, VecZero), VecMax), VecHalf);
+        const uint16x8_t Narrow = vcombine_u16(vmovn_u32(vcvtq_u32_f32(Lo)), vmovn_u32(vcvtq_u32_f32(Hi)));
+        vst1_u8(Output + Index, vqmovn_u16(Narrow));
+    }
+#endif
+    for (; Index < Size; ++Index)
+    {
+        const float Value = std::min(std::max((Input[Index] - Low) * Scale, 0.0f), 255.0f);
+        Output[Index] = uint8_t(Value + 0.5f);
+    }
+}
+
+// (Input - Low) * Scale
+static void LinearMapF32(const uint16_t *Input, std::size_t Size, float Low, float Scale, float *Output)
+{
+    std::size_t Index = 0;
+#if defined(PU_PREPROCESS_SSE2)
+    const __m128i Zero = _mm_setzero_si128();
+    const __m128 VecLow = _mm_set1_ps(Low);
+    const __m128 VecScale = _mm_set1_ps(Scale);
+    for (; Index + 8 <= Size; Index += 8)
+    {
+        const __m128i Words = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Input + Index));
+        const __m128 Lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(Words, Zero));
+        const __m128 Hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(Words, Zero));
+        _mm_storeu_ps(Output + Index, _mm_mul_ps(_mm_sub_ps(Lo, VecLow), VecScale));
+        _mm_storeu_ps(Output + Index + 4, _mm_mul_ps(_mm_sub_ps(Hi, VecLow), VecScale));
+    }
+#elif defined(PU_PREPROCESS_NEON)
+    const float32x4_t VecLow = vdupq_n_f32(Low);
+    const float32x4_t VecScale = vdupq_n_f32(Scale);
+    for (; Index + 8 <= Size; Index += 8)
+    {
+        const uint16x8_t Words = vld1q_u16(Input + Index);
+        vst1q_f32(Output + Index, vmulq_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(Words))), VecLow), VecScale));
+        vst1q_f32(Output + Index + 4, vmulq_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(Words))), VecLow), VecScale));
+    }
+#endif
+    for (; Index < Size; ++Index)
+    {
+        Output[Index] = (Input[Index] - Low) * Scale;
+    }
+}
+
+template <typename Enum>
+static Enum ParseOption(const json &Config, const std::string &Label, Enum Default,
+                        const std::vector<std::pair<std::string, Enum>> &Options)
+{
+    std::string Value;
+    fetch(Config, Label, Value);
+    if (Value.empty())
+    {
+        return Default;
+    }
+    for (const auto &Option : Options)
+    {
+        if (Option.first == Value)
+        {
+            return Option.second;
+        }
+    }
+    throw std::runtime_error("preprocess: unsupported " + Label + " '" + Value + "'");
+}
+
+RadiometricPreprocessor::RadiometricPreprocessor(const json &Config)
+{
+    typedef PreprocessSettings Settings;
+    const json &Preprocess = Config.at(PreprocessLabel);
+    fetch(Preprocess, WidthLabel, m_Settings.Width);
+    fetch(Preprocess, HeightLabel, m_Settings.Height);
+    fetch(Preprocess, OutputWidthLabel, m_Settings.OutputWidth);
+    fetch(Preprocess, OutputHeightLabel, m_Settings.OutputHeight);
+    fetch(Preprocess, ChannelsLabel, m_Settings.Channels);
+    m_Settings.Format = ParseOption<Settings::PixelFormat>(Preprocess, PixelFormatLabel, m_Settings.Format,
+                                                           {{"mono8", Settings::PixelFormat::Mono8}, {"mono16", Settings::PixelFormat::Mono16}});
+    m_Settings.AgcMode = ParseOption<Settings::Agc>(Preprocess, AgcLabel, m_Settings.AgcMode,
+                                                    {{"none", Settings::Agc::None}, {"linear", Settings::Agc::Linear}, {"histogram", Settings::Agc::Histogram}});
+    m_Settings.ResizeMode = ParseOption<Settings::Resize>(Preprocess, ResizeLabel, m_Settings.ResizeMode,
+                                                          {{"nearest", Settings::Resize::Nearest}, {"bilinear", Settings::Resize::Bilinear}});
+    m_Settings.Type = ParseOption<Settings::OutputType>(Preprocess, OutputTypeLabel, m_Settings.Type,
+                                                        {{"uint8", Settings::OutputType::UInt8}, {"float32", Settings::OutputType::Float32}});
+    m_Settings.TensorLayout = ParseOption<Settings::Layout>(Preprocess, LayoutLabel, m_Settings.TensorLayout,
+                                                            {{"hwc", Settings::Layout::Hwc}, {"chw", Settings::Layout::Chw}});
+
+    if (m_Settings.Width == 0 || m_Settings.Height == 0)
+    {
+        throw std::runtime_error("preprocess: width and height of the input frames are required");
+    }
+    if (m_Settings.Channels != 1 && m_Settings.Channels != 3)
+    {
+        throw std::runtime_error("preprocess: channels must be 1 or 3");
+    }
+    m_OutWidth = m_Settings.OutputWidth ? m_Settings.OutputWidth : m_Settings.Width;
+    m_OutHeight = m_Settings.OutputHeight ? m_Settings.OutputHeight : m_Settings.Height;
+    BuildResizeTables();
+}
+
+bool RadiometricPreprocessor::IsRequested(const json &Config)
+{
+    return Config.is_object() && Config.count(PreprocessLabel) && Config[PreprocessLabel].is_object();
+}
+
+std::size_t RadiometricPreprocessor::GetOutputSize() const
+{
+    const std::size_t Element = m_Settings.Type == PreprocessSettings::OutputType::UInt8 ? 1 : sizeof(float);
+    return m_OutWidth * m_OutHeight * m_Settings.Channels * Element;
+}
+
+static void BuildAxisTable(std::size_t InSize, std::size_t OutSize, bool Bilinear, std::vector<uint32_t> &Index, std::vector<uint16_t> &Weight)
+{
+    Index.resize(OutSize);
+    Weight.resize(OutSize);
+    const double Ratio = double(InSize) / double(OutSize);
+    for (std::size_t Out = 0; Out < OutSize; ++Out)
+    {
+        if (Bilinear)
+        {
+            const double Source = std::max(0.0, (Out + 0.5) * Ratio - 0.5);
+            const std::size_t First = std::min<std::size_t>(std::size_t(Source), InSize - 1);
+            Index[Out] = uint32_t(First);
+            Weight[Out] = uint16_t((Source - First) * WeightOne);
+        }
+        else
+        {
+            Index[Out] = uint32_t(std::min<std::size_t>(std::size_t((Out + 0.5) * Ratio), InSize - 1));
+            Weight[Out] = 0;
+        }
+    }
+}
+
+void RadiometricPreprocessor::BuildResizeTables()
+{
+    const bool Bilinear = m_Settings.ResizeMode == PreprocessSettings::Resize::Bilinear;
+    BuildAxisTable(m_Settings.Width, m_OutWidth, Bilinear, m_ColumnIndex, m_ColumnWeight);
+    BuildAxisTable(m_Settings.Height, m_OutHeight, Bilinear, m_RowIndex, m_RowWeight);
+}
+
+void RadiometricPreprocessor::ResizeFrame(const uint16_t *Input)
+{
+    const std::size_t Width = m_Settings.Width;
+    m_Resized.resize(m_OutWidth * m_OutHeight);
+    uint16_t *Output = m_Resized.data();
+    for (std::size_t Y = 0; Y < m_OutHeight; ++Y)
+    {
+        const uint32_t Row = m_RowIndex[Y];
+        const uint16_t *Top = Input + Row * Width;
+        const uint16_t *Bottom = Input + std::min<std::size_t>(Row + 1, m_Settings.Height - 1) * Width;
+        const uint64_t WeightBottom = m_RowWeight[Y];
+        const uint64_t WeightTop = WeightOne - WeightBottom;
+        for (std::size_t X = 0; X < m_OutWidth; ++X)
+        {
+            const uint32_t Column = m_ColumnIndex[X];
+            const uint32_t Next = std::min<uint32_t>(Column + 1, uint32_t(Width - 1));
+            const uint32_t WeightRight = m_ColumnWeight[X];
+            const uint32_t WeightLeft = WeightOne - WeightRight;
+            const uint64_t Upper = Top[Column] * WeightLeft + Top[Next] * WeightRight;
+            const uint64_t Lower = Bottom[Column] * WeightLeft + Bottom[Next] * WeightRight;
+            *Output++ = uint16_t((Upper * WeightTop + Lower * WeightBottom + WeightOne * WeightOne / 2) / (WeightOne * WeightOne));
+        }
+    }
+}
+
+void RadiometricPreprocessor::MapToOutput(const uint16_t *Input, std::size_t Pixels, char *Output)
+{
+    const bool ToUInt8 = m_Settings.Type == PreprocessSettings::OutputType::UInt8;
+    const float Range = ToUInt8 ? 255.0f : 1.0f;
+
+    uint16_t Low = 0, High = 0xffff;
+    if (m_Settings.AgcMode != PreprocessSettings::Agc::None)
+    {
+        MinMaxU16(Input, Pixels, Low, High);
+    }
+
+    if (m_Settings.AgcMode == PreprocessSettings::Agc::Histogram && High > Low)
+    {
+        // Only the occupied range of the 16 bit histogram is touched
+        const std::size_t Bins = std::size_t(High - Low) + 1;
+        m_Histogram.assign(Bins, 0);
+        for (std::size_t Index = 0; Index < Pixels; ++Index)
+        {
+            m_Histogram[Input[Index] - Low]++;
+        }
+        m_Lut.resize(Bins);
+        const double First = m_Histogram[0];
+        const double Denominator = std::max(1.0, double(Pixels) - First);
+        uint64_t Cumulative = 0;
+        for (std::size_t Bin = 0; Bin < Bins; ++Bin)
+        {
+            Cumulative += m_Histogram[Bin];
+            m_Lut[Bin] = float((Cumulative - First) / Denominator * Range);
+        }
+
+        if (ToUInt8)
+        {
+            uint8_t *Bytes = reinterpret_cast<uint8_t *>(Output);
+            for (std::size_t Index = 0; Index < Pixels; ++Index)
+            {
+                Bytes[Index] = uint8_t(m_Lut[Input[Index] - Low] + 0.5f);
+            }
+        }
+        else
+        {
+            float *Floats = reinterpret_cast<float *>(Output);
+            for (std::size_t Index = 0; Index < Pixels; ++Index)
+            {
+                Floats[Index] = m_Lut[Input[Index] - Low];
+            }
+        }
+        return;
+    }
+
+    const float Scale = High > Low ? Range / float(High - Low) : 0.0f;
+    if (ToUInt8)
+    {
+        LinearMapU8(Input, Pixels, float(Low), Scale, reinterpret_cast<uint8_t *>(Output));
+    }
+    else
+    {
+        LinearMapF32(Input, Pixels, float(Low), Scale, reinterpret_cast<float *>(Output));
+    }
+}
+
+void RadiometricPreprocessor::ExpandChannels(char *Output, std::size_t Pixels)
+{
+    const std::size_t Element = m_Settings.Type == PreprocessSettings::OutputType::UInt8 ? 1 : sizeof(float);
+    const std::size_t PlaneBytes = Pixels * Element;
+    if (m_Settings.TensorLayout == PreprocessSettings::Layout::Chw)
+    {
+        for (std::size_t Channel = 1; Channel < m_Settings.Channels; ++Channel)
+        {
+            std::memcpy(Output + Channel * PlaneBytes, Output, PlaneBytes);
+        }
+        return;
+    }
+
+    // Hwc: the plane was mapped into m_Plane, interleave it
+    const char *Plane = m_Plane.data();
+    const std::size_t Channels = m_Settings.Channels;
+    for (std::size_t Pixel = 0; Pixel < Pixels; ++Pixel)
+    {
+        for (std::size_t Channel = 0; Channel < Channels; ++Channel)
+        {
+            std::memcpy(Output + (Pixel * Channels + Channel) * Element, Plane + Pixel * Element, Element);
+        }
+    }
+}
+
+void RadiometricPreprocessor::Run(DataPtr &Frame)
+{
+    const bool Mono16 = m_Settings.Format == PreprocessSettings::PixelFormat::Mono16;
+    const std::size_t InputPixels = m_Settings.Width * m_Settings.Height;
+    const std::size_t Expected = InputPixels * (Mono16 ? 2 : 1);
+    if (Frame.size() != Expected)
+    {
+        throw std::runtime_error("preprocess: expected a frame of " + std::to_string(Expected) + " bytes, got " + std::to_string(Frame.size()));
+    }
+
+    const uint16_t *Input = reinterpret_cast<const uint16_t *>(Frame.data());
+    if (!Mono16)
+    {
+        // Widen to 16 bit so one code path serves both formats, 255 maps to 65535
+        m_Widened.resize(InputPixels);
+        const uint8_t *Bytes = reinterpret_cast<const uint8_t *>(Frame.data());
+        for (std::size_t Index = 0; Index < InputPixels; ++Index)
+        {
+            m_Widened[Index] = uint16_t(Bytes[Index] * 257);
+        }
+        Input = m_Widened.data();
+    }
+
+    if (m_OutWidth != m_Settings.Width || m_OutHeight != m_Settings.Height)
+    {
+        ResizeFrame(Input);
+        Input = m_Resized.data();
+    }
+
+    const std::size_t Pixels = m_OutWidth * m_OutHeight;
+    m_Output.resize(GetOutputSize());
+    const bool Interleave = m_Settings.Channels > 1 && m_Settings.TensorLayout == PreprocessSettings::Layout::Hwc;
+    if (Interleave)
+    {
+        m_Plane.resize(GetOutputSize() / m_Settings.Channels);
+        MapToOutput(Input, Pixels, m_Plane.data());
+    }
+    else
+    {
+        MapToOutput(Input, Pixels, m_Output.data());
+    }
+    if (m_Settings.Channels > 1)
+    {
+        ExpandChannels(m_Output.data(), Pixels);
+    }
+
+    Frame.swap(m_Output);
+}
+} // namespace ProcessingUnit
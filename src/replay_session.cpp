@@ -0,0 +1,191 @@
+#include "replay_session.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+
+namespace ProcessingUnit
+{
+static json Percentiles(std::vector<uint64_t> &Values)
+{
+    json Result;
+    if (Values.empty())
+    {
+        return Result;
+    }
+
+    std::sort(Values.begin(), Values.end());
+    uint64_t Sum = 0;
+    for (uint64_t Value : Values)
+    {
+        Sum += Value;
+    }
+    auto At = [&](double Fraction) { return Values[std::min(Values.size() - 1, std::size_t(Fraction * Values.size()))]; };
+    Result["mean"] = double(Sum) / Values.size();
+    Result["p50"] = At(0.50);
+    Result["p90"] = At(0.90);
+    Result["p99"] = At(0.99);
+    Result["max"] = Values.back();
+    return Result;
+}
+
+ReplaySession::ReplaySession(const std::string &CapturePath, const ReplayOptions &Options)
+    : m_CapturePath(CapturePath), m_Options(Options)
+{
+    // Jobs log through the MainLogger, which normally is set up by the ProcessingUnitServer
+    if (!spdlog::get("MainLogger"))
+    {
+        spdlog::stdout_color_mt("MainLogger")->set_level(spdlog::level::warn);
+    }
+}
+
+json ReplaySession::Run()
+{
+    if (!m_Reader.Open(m_CapturePath))
+    {
+        return json{{"error", "couldn't open capture " + m_CapturePath}};
+    }
+
+    std::unique_ptr<Job> ReplayJob;
+    json StartInfo;
+    const double Speed = m_Options.Speed > 0 ? m_Options.Speed : 1.0;
+    const auto ReplayStart = std::chrono::steady_clock::now();
+
+    for (int Loop = 0; Loop < std::max(m_Options.Loops, 1); ++Loop)
+    {
+        const auto LoopStart = std::chrono::steady_clock::now();
+        bool HasFirstTimestamp = false;
+        uint64_t FirstTimestampNs = 0;
+
+        for (std::size_t FrameNr = 0; FrameNr < m_Reader.GetFrameCount(); ++FrameNr)
+        {
+            const CaptureFrame Frame = m_Reader.GetFrame(FrameNr);
+            if (Frame.Header->Direction != CaptureReceived)
+            {
+                continue;
+            }
+
+            MessageReader Reader;
+            if (!Reader.Parse(std::string(Frame.Data, Frame.Header->Size)))
+            {
+                continue;
+            }
+
+            if (Reader.GetMessageType() == Message::Start && !ReplayJob)
+            {
+                StartInfo = Reader.GetStartMessage()->GetInfoJson();
+                try
+                {
+                    ReplayJob.reset(new Job(StartInfo, this));
+                }
+                catch (const std::exception &Exc)
+                {
+                    return json{{"error", std::string("recorded Start was refused: ") + Exc.what()}};
+                }
+            }
+            else if (Reader.GetMessageType() == Message::Data && ReplayJob)
+            {
+                if (m_Options.RealTime)
+                {
+                    if (!HasFirstTimestamp)
+                    {
+                        FirstTimestampNs = Frame.Header->TimestampNs;
+                        HasFirstTimestamp = true;
+                    }
+                    const auto Offset = std::chrono::nanoseconds(uint64_t((Frame.Header->TimestampNs - FirstTimestampNs) / Speed));
+                    std::this_thread::sleep_until(LoopStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(Offset));
+                }
+
+                WaitForContinue();
+                std::vector<char> Payload = Reader.GetDataMessage()->TakePayload();
+                {
+                    std::lock_guard<std::mutex> lock(m_Protector);
+                    m_InFlight.push_back(std::chrono::steady_clock::now());
+                    m_FramesFed++;
+                    m_InputBytes += Payload.size();
+                }
+                ReplayJob->process(Payload);
+            }
+        }
+    }
+
+    if (!ReplayJob)
+    {
+        return json{{"error", "capture " + m_CapturePath + " holds no Start message"}};
+    }
+
+    WaitUntilIdle();
+    const auto Elapsed = std::chrono::steady_clock::now() - ReplayStart;
+    ReplayJob->stopJob();
+    ReplayJob.reset();
+
+    json Report = MakeReport(Elapsed);
+    Report["processor"] = ProcessorRegistry::GetProcessorName(StartInfo);
+    return Report;
+}
+
+void ReplaySession::SendContinue()
+{
+    std::unique_lock<std::mutex> lock(m_Protector);
+    m_Credits++;
+    lock.unlock();
+    m_ConVar.notify_all();
+}
+
+void ReplaySession::SendData(std::vector<char> &data)
+{
+    std::lock_guard<std::mutex> lock(m_Protector);
+    m_Results++;
+    m_ResultBytes += data.size();
+}
+
+void ReplaySession::OnFrameProcessed(std::chrono::microseconds ProcessingTime)
+{
+    std::unique_lock<std::mutex> lock(m_Protector);
+    if (!m_InFlight.empty())
+    {
+        m_LatenciesUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_InFlight.front()).count());
+        m_InFlight.pop_front();
+    }
+    m_ProcessingUs.push_back(ProcessingTime.count());
+    lock.unlock();
+    m_ConVar.notify_all();
+}
+
+void ReplaySession::WaitForContinue()
+{
+    std::unique_lock<std::mutex> lock(m_Protector);
+    m_ConVar.wait(lock, [&] { return m_Credits > 0; });
+    m_Credits--;
+}
+
+void ReplaySession::WaitUntilIdle()
+{
+    std::unique_lock<std::mutex> lock(m_Protector);
+    m_ConVar.wait(lock, [&] { return m_InFlight.empty(); });
+}
+
+json ReplaySession::MakeReport(std::chrono::steady_clock::duration Elapsed)
+{
+    std::lock_guard<std::mutex> lock(m_Protector);
+    const double Seconds = std::chrono::duration_cast<std::chrono::duration<double>>(Elapsed).count();
+
+    json Report;
+    Report["capture"] = m_CapturePath;
+    Report["jobId"] = m_Reader.GetJobId();
+    Report["indexed"] = m_Reader.HasIndex();
+    Report["realTime"] = m_Options.RealTime;
+    Report["loops"] = std::max(m_Options.Loops, 1);
+    Report["frames"] = m_FramesFed;
+    Report["results"] = m_Results;
+    Report["inputBytes"] = m_InputBytes;
+    Report["resultBytes"] = m_ResultBytes;
+    Report["seconds"] = Seconds;
+    Report["fps"] = Seconds > 0 ? m_FramesFed / Seconds : 0.0;
+    Report["latencyUs"] = Percentiles(m_LatenciesUs);
+    Report["processingUs"] = Percentiles(m_ProcessingUs);
+    return Report;
+}
+} // namespace ProcessingUnit
@@ -0,0 +1,169 @@
+#include "session_registry.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iterator>
+#include <random>
+#include <sstream>
+
+#include "spdlog/spdlog.h"
+
+namespace ProcessingUnit
+{
+const std::string GracePeriodSecondsLabel("gracePeriodSeconds");
+const std::chrono::seconds DefaultGracePeriod(30);
+const std::chrono::milliseconds ReapInterval(500);
+
+SessionRegistry::SessionRegistry() : m_GracePeriod(DefaultGracePeriod)
+{
+    m_ReaperThread = std::thread(&SessionRegistry::Reap, this);
+}
+
+SessionRegistry::~SessionRegistry()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_ConVarReaper.notify_all();
+    m_ReaperThread.join();
+}
+
+void SessionRegistry::SetResumption(const json &Config)
+{
+    SessionRegistry &Registry = getInstance();
+    std::lock_guard<std::mutex> lock(Registry.m_Mutex);
+    int64_t GracePeriodSeconds = Registry.m_GracePeriod.count();
+    fetch(Config, GracePeriodSecondsLabel, GracePeriodSeconds);
+    Registry.m_GracePeriod = std::chrono::seconds(std::max<int64_t>(GracePeriodSeconds, 0));
+}
+
+bool SessionRegistry::IsEnabled()
+{
+    SessionRegistry &Registry = getInstance();
+    std::lock_guard<std::mutex> lock(Registry.m_Mutex);
+    return Registry.m_GracePeriod.count() > 0;
+}
+
+std::string SessionRegistry::NewToken()
+{
+    // Tokens are the only thing guarding a job against being taken over, keep them unguessable
+    static std::mutex GeneratorMutex;
+    static std::mt19937_64 Generator(std::random_device{}());
+    std::lock_guard<std::mutex> lock(GeneratorMutex);
+    std::ostringstream Token;
+    Token << std::hex << std::setfill('0') << std::setw(16) << Generator() << std::setw(16) << Generator();
+    return Token.str();
+}
+
+void SessionRegistry::Park(std::shared_ptr<JobConnection> Session)
+{
+    SessionRegistry &Registry = getInstance();
+    std::lock_guard<std::mutex> lock(Registry.m_Mutex);
+    ParkedSession &Parked = Registry.m_Parked[Session->GetResumeToken()];
+    Parked.Session = Session;
+    Parked.Expiry = std::chrono::steady_clock::now() + Registry.m_GracePeriod;
+    Registry.m_ParkedTotal++;
+    spdlog::get("MainLogger")->info("Job " + Session->GetJobId() + " detached, waiting for the client to resume it");
+}
+
+std::shared_ptr<JobConnection> SessionRegistry::Claim(const std::string &Token, const std::string &JobId)
+{
+    SessionRegistry &Registry = getInstance();
+    std::lock_guard<std::mutex> lock(Registry.m_Mutex);
+    auto Iter = Registry.m_Parked.find(Token);
+    if (Iter == Registry.m_Parked.end() || Iter->second.Session->GetJobId() != JobId ||
+        Iter->second.Session->GetState() == ConnectionState::job_ended)
+    {
+        return nullptr;
+    }
+    std::shared_ptr<JobConnection> Session = Iter->second.Session;
+    Registry.m_Parked.erase(Iter);
+    Registry.m_Resumed++;
+    return Session;
+}
+
+void SessionRegistry::Retire(std::shared_ptr<JobConnection> Session)
+{
+    Session->Detach();
+    Session->Abandon();
+    SessionRegistry &Registry = getInstance();
+    std::lock_guard<std::mutex> lock(Registry.m_Mutex);
+    Registry.m_Retiring.push_back(Session);
+}
+
+void SessionRegistry::Reap()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (!m_Stop)
+    {
+        m_ConVarReaper.wait_for(lock, ReapInterval);
+
+        const auto Now = std::chrono::steady_clock::now();
+        std::vector<std::shared_ptr<JobConnection>> Expired;
+        // Destroying a session joins its threads, that happens after the lock is released
+        std::vector<std::shared_ptr<JobConnection>> Finished;
+        for (auto Iter = m_Parked.begin(); Iter != m_Parked.end();)
+        {
+            if (Iter->second.Session->GetState() == ConnectionState::job_ended)
+            {
+                // The client had sent End before the drop, there is nothing left to resume
+                Finished.push_back(Iter->second.Session);
+                Iter = m_Parked.erase(Iter);
+            }
+            else if (Now >= Iter->second.Expiry)
+            {
+                spdlog::get("MainLogger")->info("Job " + Iter->second.Session->GetJobId() + " was not resumed in time, ending it");
+                Expired.push_back(Iter->second.Session);
+                Iter = m_Parked.erase(Iter);
+                m_Expired++;
+            }
+            else
+            {
+                ++Iter;
+            }
+        }
+        const auto Ended = std::stable_partition(m_Retiring.begin(), m_Retiring.end(),
+                                                 [](const std::shared_ptr<JobConnection> &Session) {
+                                                     return Session->GetState() != ConnectionState::job_ended;
+                                                 });
+        std::move(Ended, m_Retiring.end(), std::back_inserter(Finished));
+        m_Retiring.erase(Ended, m_Retiring.end());
+
+        lock.unlock();
+        Finished.clear();
+        for (const std::shared_ptr<JobConnection> &Session : Expired)
+        {
+            Session->Abandon();
+        }
+        lock.lock();
+        m_Retiring.insert(m_Retiring.end(), Expired.begin(), Expired.end());
+    }
+}
+
+std::vector<std::shared_ptr<JobConnection>> SessionRegistry::GetParked()
+{
+    SessionRegistry &Registry = getInstance();
+    std::vector<std::shared_ptr<JobConnection>> Parked;
+    std::lock_guard<std::mutex> lock(Registry.m_Mutex);
+    for (auto Iter = Registry.m_Parked.begin(); Iter != Registry.m_Parked.end(); ++Iter)
+    {
+        Parked.push_back(Iter->second.Session);
+    }
+    return Parked;
+}
+
+json SessionRegistry::GetStats()
+{
+    SessionRegistry &Registry = getInstance();
+    std::lock_guard<std::mutex> lock(Registry.m_Mutex);
+    json Stats;
+    Stats["gracePeriodSeconds"] = Registry.m_GracePeriod.count();
+    Stats["detachedJobs"] = Registry.m_Parked.size();
+    Stats["retiringJobs"] = Registry.m_Retiring.size();
+    Stats["detachedTotal"] = Registry.m_ParkedTotal;
+    Stats["resumed"] = Registry.m_Resumed;
+    Stats["expired"] = Registry.m_Expired;
+    return Stats;
+}
+} // namespace ProcessingUnit
@@ -0,0 +1,226 @@
+#include "stream_recorder.hpp"
+
+#include <cstring>
+#include <sstream>
+
+#include "spdlog/spdlog.h"
+
+namespace ProcessingUnit
+{
+const std::string RecordLabel("record");
+const std::string CaptureExtension(".pucap");
+
+std::mutex StreamRecorder::s_DirectoryMutex;
+std::string StreamRecorder::s_OutputDirectory;
+std::atomic<std::size_t> StreamRecorder::s_MaxQueuedBytes{64 * 1024 * 1024};
+std::atomic<uint64_t> StreamRecorder::s_DroppedFrames{0};
+
+static uint64_t PaddingFor(uint64_t Size)
+{
+    return (8 - (Size % 8)) % 8;
+}
+
+StreamRecorder::StreamRecorder(const std::string &FilePath, const std::string &JobId)
+    : m_File(FilePath, std::ios::binary | std::ios::out | std::ios::trunc), m_Start(std::chrono::steady_clock::now())
+{
+    m_isOpen = m_File.is_open();
+    if (!m_isOpen)
+    {
+        spdlog::get("MainLogger")->error("[StreamRecorder]: couldn't open capture file " + FilePath);
+        return;
+    }
+
+    CaptureFileHeader Header;
+    std::memset(&Header, 0, sizeof(Header));
+    std::memcpy(Header.Magic, CaptureFileMagic, sizeof(Header.Magic));
+    Header.Version = CaptureFormatVersion;
+    Header.HeaderSize = sizeof(CaptureFileHeader);
+    Header.StartTimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    std::strncpy(Header.JobId, JobId.c_str(), sizeof(Header.JobId) - 1);
+    m_File.write(reinterpret_cast<const char *>(&Header), sizeof(Header));
+    m_Offset = sizeof(Header);
+
+    spdlog::get("MainLogger")->info("[StreamRecorder]: recording job " + JobId + " to " + FilePath);
+    m_WriterThread = std::thread(&StreamRecorder::Writing, this);
+}
+
+StreamRecorder::~StreamRecorder()
+{
+    if (!m_isOpen)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> queue_lock(m_QueueProtector);
+    m_isStopSignaled = true;
+    queue_lock.unlock();
+    m_ConVarQueue.notify_one();
+    m_WriterThread.join();
+
+    WriteIndex();
+    m_File.close();
+}
+
+void StreamRecorder::Record(CaptureDirection Direction, Message::MessageType Type, const char *Data, std::size_t Size)
+{
+    Record(Direction, Type, Data, Size, nullptr, 0);
+}
+
+void StreamRecorder::Record(CaptureDirection Direction, Message::MessageType Type, const char *Head, std::size_t HeadSize,
+                            const char *Tail, std::size_t TailSize)
+{
+    if (!m_isOpen)
+    {
+        return;
+    }
+
+    const std::size_t Size = HeadSize + TailSize;
+    {
+        std::lock_guard<std::mutex> queue_lock(m_QueueProtector);
+        if (m_QueuedBytes + Size > s_MaxQueuedBytes)
+        {
+            if (m_Dropped++ == 0)
+            {
+                spdlog::get("MainLogger")->warn("[StreamRecorder]: disk can't keep up, dropping frames from the capture");
+            }
+            s_DroppedFrames++;
+            return;
+        }
+        m_QueuedBytes += Size;
+    }
+
+    PendingRecord Record;
+    std::memset(&Record.Header, 0, sizeof(Record.Header));
+    Record.Header.Magic = CaptureRecordMagic;
+    Record.Header.Direction = Direction;
+    Record.Header.MessageType = uint8_t(Type);
+    Record.Header.TimestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count();
+    Record.Header.Size = uint32_t(HeadSize + TailSize);
+    Record.Frame.reserve(HeadSize + TailSize);
+    Record.Frame.assign(Head, Head + HeadSize);
+    Record.Frame.insert(Record.Frame.end(), Tail, Tail + TailSize);
+
+    std::unique_lock<std::mutex> queue_lock(m_QueueProtector);
+    m_Queue.push_back(std::move(Record));
+    queue_lock.unlock();
+    m_ConVarQueue.notify_one();
+}
+
+void StreamRecorder::Writing()
+{
+    std::deque<PendingRecord> Records;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> queue_lock(m_QueueProtector);
+            m_ConVarQueue.wait(queue_lock, [&] { return m_isStopSignaled || !m_Queue.empty(); });
+            if (m_Queue.empty())
+            {
+                break;
+            }
+            Records.swap(m_Queue);
+        }
+
+        std::size_t Written = 0;
+        for (const PendingRecord &Record : Records)
+        {
+            Write(Record);
+            Written += Record.Frame.size();
+        }
+        Records.clear();
+        m_File.flush();
+
+        std::lock_guard<std::mutex> queue_lock(m_QueueProtector);
+        m_QueuedBytes -= Written;
+    }
+}
+
+void StreamRecorder::Write(const PendingRecord &Record)
+{
+    static const char Padding[8] = {0};
+
+    CaptureIndexEntry Entry;
+    Entry.Offset = m_Offset;
+    Entry.TimestampNs = Record.Header.TimestampNs;
+    m_Index.push_back(Entry);
+
+    const uint64_t PadSize = PaddingFor(Record.Frame.size());
+    m_File.write(reinterpret_cast<const char *>(&Record.Header), sizeof(Record.Header));
+    m_File.write(Record.Frame.data(), Record.Frame.size());
+    m_File.write(Padding, PadSize);
+    m_Offset += sizeof(Record.Header) + Record.Frame.size() + PadSize;
+}
+
+void StreamRecorder::WriteIndex()
+{
+    CaptureFileTrailer Trailer;
+    std::memset(&Trailer, 0, sizeof(Trailer));
+    Trailer.IndexOffset = m_Offset;
+    Trailer.FrameCount = m_Index.size();
+    Trailer.Magic = CaptureTrailerMagic;
+
+    if (!m_Index.empty())
+    {
+        m_File.write(reinterpret_cast<const char *>(m_Index.data()), m_Index.size() * sizeof(CaptureIndexEntry));
+    }
+    m_File.write(reinterpret_cast<const char *>(&Trailer), sizeof(Trailer));
+}
+
+void StreamRecorder::SetOutputDirectory(const std::string &Directory)
+{
+    std::lock_guard<std::mutex> lock(s_DirectoryMutex);
+    s_OutputDirectory = Directory;
+}
+
+std::string StreamRecorder::GetOutputDirectory()
+{
+    std::lock_guard<std::mutex> lock(s_DirectoryMutex);
+    return s_OutputDirectory;
+}
+
+void StreamRecorder::SetMaxQueuedBytes(std::size_t MaxQueuedBytes)
+{
+    s_MaxQueuedBytes = MaxQueuedBytes;
+}
+
+json StreamRecorder::GetStats()
+{
+    json Stats;
+    Stats["directory"] = GetOutputDirectory();
+    Stats["maxQueuedBytes"] = s_MaxQueuedBytes.load();
+    Stats["droppedFrames"] = s_DroppedFrames.load();
+    return Stats;
+}
+
+std::shared_ptr<StreamRecorder> StreamRecorder::Create(const std::string &JobId, const json &Config)
+{
+    const std::string Directory = GetOutputDirectory();
+    bool Record = !Directory.empty();
+    if (Config.is_object())
+    {
+        fetch(Config, RecordLabel, Record);
+    }
+    if (!Record || Directory.empty())
+    {
+        return nullptr;
+    }
+
+    // Job ids come from the client, keep them from escaping the capture directory
+    std::string FileName = JobId.empty() ? "job" : JobId;
+    for (char &C : FileName)
+    {
+        if (C == '/' || C == '\\' || C == '.')
+        {
+            C = '_';
+        }
+    }
+
+    std::ostringstream Path;
+    Path << Directory << "/" << FileName << "-"
+         << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+         << CaptureExtension;
+
+    std::shared_ptr<StreamRecorder> Recorder = std::make_shared<StreamRecorder>(Path.str(), JobId);
+    return Recorder->IsOpen() ? Recorder : nullptr;
+}
+} // namespace ProcessingUnit
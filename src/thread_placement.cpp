@@ -0,0 +1,321 @@
+#include "thread_placement.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "spdlog/spdlog.h"
+
+namespace ProcessingUnit
+{
+const std::string ThreadPlacementLabel("threadPlacement");
+const std::string PolicyLabel("policy");
+const std::string CpusLabel("cpus");
+const std::string NodeLabel("node");
+const std::string NumaLocalBuffersLabel("numaLocalBuffers");
+
+std::string RoleToString(ThreadRole Role)
+{
+    switch (Role)
+    {
+    case ThreadRole::Io:
+        return "io";
+    case ThreadRole::Connection:
+        return "connection";
+    case ThreadRole::Processing:
+    default:
+        return "processing";
+    }
+}
+
+// Parses the kernel cpu list format, e.g. "0-3,8,10-11"
+std::vector<int> ParseCpuList(const std::string &CpuList)
+{
+    std::vector<int> Cpus;
+    std::istringstream Stream(CpuList);
+    std::string Range;
+    while (std::getline(Stream, Range, ','))
+    {
+        const std::size_t Dash = Range.find('-');
+        try
+        {
+            const int First = std::stoi(Range.substr(0, Dash));
+            const int Last = Dash == std::string::npos ? First : std::stoi(Range.substr(Dash + 1));
+            for (int Cpu = First; Cpu <= Last; ++Cpu)
+            {
+                Cpus.push_back(Cpu);
+            }
+        }
+        catch (const std::exception &)
+        {
+        }
+    }
+    return Cpus;
+}
+
+ThreadPlacement::ThreadPlacement() : m_RoundRobin(0), m_PinFailures(0), m_CrossNodeFrames(0), m_CrossNodeBytes(0)
+{
+    // Node ids can have gaps, the online list has the ones that exist
+    std::ifstream OnlineFile("/sys/devices/system/node/online");
+    std::string OnlineList;
+    if (OnlineFile.is_open() && std::getline(OnlineFile, OnlineList))
+    {
+        for (int Node : ParseCpuList(OnlineList))
+        {
+            std::ifstream CpuListFile("/sys/devices/system/node/node" + std::to_string(Node) + "/cpulist");
+            std::string CpuList;
+            std::getline(CpuListFile, CpuList);
+            const std::vector<int> Cpus = ParseCpuList(CpuList);
+            // Memory only nodes have no cpus to run threads on
+            if (!Cpus.empty())
+            {
+                m_NodeCpus[Node] = Cpus;
+            }
+        }
+    }
+
+    // No NUMA information, everything is one node
+    if (m_NodeCpus.empty())
+    {
+        std::vector<int> Cpus;
+        for (unsigned Cpu = 0; Cpu < std::max(1u, std::thread::hardware_concurrency()); ++Cpu)
+        {
+            Cpus.push_back(int(Cpu));
+        }
+        m_NodeCpus[0] = Cpus;
+    }
+
+    for (auto Iter = m_NodeCpus.begin(); Iter != m_NodeCpus.end(); ++Iter)
+    {
+        for (int Cpu : Iter->second)
+        {
+            m_CpuToNode[Cpu] = Iter->first;
+        }
+    }
+}
+
+PlacementPolicy ThreadPlacement::ParsePolicy(const json &Config, const PlacementPolicy &Default)
+{
+    PlacementPolicy Policy = Default;
+    if (!Config.is_object())
+    {
+        return Policy;
+    }
+
+    std::string Name;
+    fetch(Config, PolicyLabel, Name);
+    if (Name == "none")
+    {
+        Policy.Policy = PlacementPolicy::None;
+    }
+    else if (Name == "cpus")
+    {
+        Policy.Policy = PlacementPolicy::Cpus;
+    }
+    else if (Name == "node")
+    {
+        Policy.Policy = PlacementPolicy::Node;
+    }
+    else if (Name == "spread")
+    {
+        Policy.Policy = PlacementPolicy::Spread;
+    }
+    else if (Name == "compact")
+    {
+        Policy.Policy = PlacementPolicy::Compact;
+    }
+    else if (!Name.empty())
+    {
+        spdlog::get("MainLogger")->warn("[ThreadPlacement]: unknown policy " + Name);
+    }
+
+    fetch(Config, CpusLabel, Policy.CpuList);
+    fetch(Config, NodeLabel, Policy.NumaNode);
+    fetch(Config, NumaLocalBuffersLabel, Policy.NumaLocalBuffers);
+    return Policy;
+}
+
+void ThreadPlacement::SetDefaults(const json &Config)
+{
+    ThreadPlacement &Placement = getInstance();
+    std::lock_guard<std::mutex> lock(Placement.m_Mutex);
+    for (ThreadRole Role : {ThreadRole::Io, ThreadRole::Connection, ThreadRole::Processing})
+    {
+        const std::string RoleName = RoleToString(Role);
+        if (Config.is_object() && Config.count(RoleName))
+        {
+            Placement.m_Defaults[Role] = ParsePolicy(Config[RoleName], PlacementPolicy());
+        }
+    }
+}
+
+PlacementPolicy ThreadPlacement::GetPolicy(ThreadRole Role, const json &JobConfig)
+{
+    ThreadPlacement &Placement = getInstance();
+    PlacementPolicy Policy;
+    {
+        std::lock_guard<std::mutex> lock(Placement.m_Mutex);
+        Policy = Placement.m_Defaults[Role];
+    }
+
+    const std::string RoleName = RoleToString(Role);
+    if (JobConfig.is_object() && JobConfig.count(ThreadPlacementLabel) && JobConfig[ThreadPlacementLabel].is_object() &&
+        JobConfig[ThreadPlacementLabel].count(RoleName))
+    {
+        Policy = ParsePolicy(JobConfig[ThreadPlacementLabel][RoleName], Policy);
+    }
+    return Policy;
+}
+
+std::vector<int> ThreadPlacement::ResolveCpus(const PlacementPolicy &Policy, int &Node)
+{
+    Node = -1;
+    const int NodeCount = int(m_NodeCpus.size());
+    switch (Policy.Policy)
+    {
+    case PlacementPolicy::Cpus:
+        if (!Policy.CpuList.empty() && m_CpuToNode.count(Policy.CpuList.front()))
+        {
+            Node = m_CpuToNode.at(Policy.CpuList.front());
+            for (int Cpu : Policy.CpuList)
+            {
+                if (!m_CpuToNode.count(Cpu) || m_CpuToNode.at(Cpu) != Node)
+                {
+                    Node = -1;
+                }
+            }
+        }
+        return Policy.CpuList;
+    case PlacementPolicy::Node:
+        if (!m_NodeCpus.count(Policy.NumaNode))
+        {
+            return std::vector<int>();
+        }
+        Node = Policy.NumaNode;
+        return m_NodeCpus.at(Node);
+    case PlacementPolicy::Spread:
+    {
+        auto Iter = std::next(m_NodeCpus.begin(), m_RoundRobin++ % NodeCount);
+        Node = Iter->first;
+        return Iter->second;
+    }
+    case PlacementPolicy::Compact:
+    {
+        std::vector<int> AllCpus;
+        for (auto Iter = m_NodeCpus.begin(); Iter != m_NodeCpus.end(); ++Iter)
+        {
+            AllCpus.insert(AllCpus.end(), Iter->second.begin(), Iter->second.end());
+        }
+        const int Cpu = AllCpus[m_RoundRobin++ % AllCpus.size()];
+        Node = m_CpuToNode.at(Cpu);
+        return std::vector<int>(1, Cpu);
+    }
+    case PlacementPolicy::None:
+    default:
+        return std::vector<int>();
+    }
+}
+
+bool ThreadPlacement::Pin(const std::vector<int> &Cpus)
+{
+#ifdef __linux__
+    cpu_set_t CpuSet;
+    CPU_ZERO(&CpuSet);
+    for (int Cpu : Cpus)
+    {
+        if (Cpu >= 0 && Cpu < CPU_SETSIZE)
+        {
+            CPU_SET(Cpu, &CpuSet);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(CpuSet), &CpuSet) == 0;
+#else
+    return false;
+#endif
+}
+
+int ThreadPlacement::CurrentNode()
+{
+#ifdef __linux__
+    const int Cpu = sched_getcpu();
+    ThreadPlacement &Placement = getInstance();
+    auto Iter = Placement.m_CpuToNode.find(Cpu);
+    return Iter == Placement.m_CpuToNode.end() ? -1 : Iter->second;
+#else
+    return -1;
+#endif
+}
+
+int ThreadPlacement::GetNodeCount()
+{
+    return int(getInstance().m_NodeCpus.size());
+}
+
+void ThreadPlacement::PlaceIoThread()
+{
+    // The websocket server owns its io threads, they get pinned on their first callback
+    static thread_local std::unique_ptr<Scope> IoScope;
+    if (!IoScope)
+    {
+        IoScope.reset(new Scope(ThreadRole::Io, GetPolicy(ThreadRole::Io)));
+    }
+}
+
+void ThreadPlacement::CountCrossNodeFrame(std::size_t Bytes)
+{
+    ThreadPlacement &Placement = getInstance();
+    Placement.m_CrossNodeFrames++;
+    Placement.m_CrossNodeBytes += Bytes;
+}
+
+json ThreadPlacement::GetStats()
+{
+    ThreadPlacement &Placement = getInstance();
+    json Stats;
+    Stats["nodes"] = Placement.m_NodeCpus.size();
+    Stats["pinFailures"] = Placement.m_PinFailures.load();
+    Stats["crossNodeFrames"] = Placement.m_CrossNodeFrames.load();
+    Stats["crossNodeBytes"] = Placement.m_CrossNodeBytes.load();
+
+    json Threads = json::object();
+    std::lock_guard<std::mutex> lock(Placement.m_Mutex);
+    for (auto &Role : Placement.m_ThreadsPerNode)
+    {
+        for (auto &Node : Role.second)
+        {
+            // Node -1 holds the threads that aren't bound to a single node
+            Threads[Role.first][Node.first < 0 ? "unbound" : std::to_string(Node.first)] = Node.second;
+        }
+    }
+    Stats["threads"] = Threads;
+    return Stats;
+}
+
+ThreadPlacement::Scope::Scope(ThreadRole Role, const PlacementPolicy &Policy) : m_Role(Role), m_Node(-1)
+{
+    ThreadPlacement &Placement = getInstance();
+    const std::vector<int> Cpus = Placement.ResolveCpus(Policy, m_Node);
+    if (!Cpus.empty() && !Placement.Pin(Cpus))
+    {
+        Placement.m_PinFailures++;
+        m_Node = -1;
+        spdlog::get("MainLogger")->warn("[ThreadPlacement]: couldn't pin " + RoleToString(Role) + " thread");
+    }
+
+    std::lock_guard<std::mutex> lock(Placement.m_Mutex);
+    Placement.m_ThreadsPerNode[RoleToString(m_Role)][m_Node]++;
+}
+
+ThreadPlacement::Scope::~Scope()
+{
+    ThreadPlacement &Placement = getInstance();
+    std::lock_guard<std::mutex> lock(Placement.m_Mutex);
+    Placement.m_ThreadsPerNode[RoleToString(m_Role)][m_Node]--;
+}
+} // namespace ProcessingUnit
@@ -0,0 +1,357 @@
+#include "tuning_config.hpp"
+
+#include <csignal>
+#include <stdexcept>
+
+#include "spdlog/spdlog.h"
+#include "admission_controller.hpp"
+#include "fair_scheduler.hpp"
+#include "fan_out.hpp"
+#include "frame_tracer.hpp"
+#include "memory_governor.hpp"
+#include "osprey_ws_protocol.hpp"
+#include "processor_pool.hpp"
+#include "session_registry.hpp"
+#include "stream_recorder.hpp"
+#include "thread_placement.hpp"
+
+namespace ProcessingUnit
+{
+const std::string ServerSection("server");
+const std::string LoggingSection("logging");
+const std::string ThreadPlacementSection("threadPlacement");
+const std::string ProcessorPoolSection("processorPool");
+const std::string SchedulingSection("scheduling");
+const std::string AdmissionSection("admission");
+const std::string MemorySection("memory");
+const std::string SessionsSection("sessions");
+const std::string RecordingSection("recording");
+const std::string TracingSection("tracing");
+const std::string FanOutPoolSection("fanOutPool");
+const std::string ProtocolSection("protocol");
+const std::string LevelLabel("level");
+const std::string ConsoleLevelLabel("consoleLevel");
+const std::string FileLevelLabel("fileLevel");
+const std::string CapacityLabel("capacity");
+const std::string PrewarmLabel("prewarm");
+const std::string SlotsLabel("slots");
+const std::string AgingMsLabel("agingMs");
+const std::string DirectoryLabel("directory");
+const std::string MaxQueuedBytesLabel("maxQueuedBytes");
+const std::string MaxPayloadBytesLabel("maxPayloadBytes");
+const std::chrono::milliseconds SighupPollInterval(250);
+
+static volatile std::sig_atomic_t s_ReloadRequested = 0;
+
+static void OnSighup(int)
+{
+    s_ReloadRequested = 1;
+}
+
+static void LogTuning(spdlog::level::level_enum Level, const std::string &Message)
+{
+    // Loading can happen before the server created its logger
+    std::shared_ptr<spdlog::logger> Logger = spdlog::get("MainLogger");
+    if (Logger)
+    {
+        Logger->log(Level, "[TuningConfig]: " + Message);
+    }
+}
+
+// spdlog turns names it doesn't know into off, a typo must not silence the server
+static spdlog::level::level_enum ParseLevel(const std::string &Name)
+{
+    const spdlog::level::level_enum Level = spdlog::level::from_str(Name);
+    if (Level == spdlog::level::off && Name != "off")
+    {
+        throw std::runtime_error("unknown log level \"" + Name + "\"");
+    }
+    return Level;
+}
+
+TuningConfig::~TuningConfig()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_WatchMutex);
+        m_StopWatch = true;
+    }
+    m_ConVarWatch.notify_all();
+    if (m_WatchThread.joinable())
+    {
+        m_WatchThread.join();
+    }
+}
+
+bool TuningConfig::Load(const std::string &Path)
+{
+    TuningConfig &Tuning = getInstance();
+    std::lock_guard<std::mutex> reload_lock(Tuning.m_ReloadMutex);
+    const json Config = loadJson(Path);
+    if (!Config.is_object())
+    {
+        LogTuning(spdlog::level::err, "could not read " + Path);
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(Tuning.m_Mutex);
+        Tuning.m_Path = Path;
+    }
+    try
+    {
+        Tuning.Apply(Config, true);
+    }
+    catch (const std::exception &Exc)
+    {
+        LogTuning(spdlog::level::err, "could not apply " + Path + ": " + Exc.what());
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(Tuning.m_Mutex);
+        Tuning.m_Config = Config;
+    }
+    LogTuning(spdlog::level::info, "loaded " + Path);
+    return true;
+}
+
+bool TuningConfig::Reload()
+{
+    TuningConfig &Tuning = getInstance();
+    // One reload at a time, m_Config is only committed once its file was applied
+    std::lock_guard<std::mutex> reload_lock(Tuning.m_ReloadMutex);
+    std::unique_lock<std::mutex> lock(Tuning.m_Mutex);
+    const std::string Path = Tuning.m_Path;
+    const json Config = loadJson(Path);
+    if (!Config.is_object())
+    {
+        // A half written file must not reset a running box to its defaults
+        Tuning.m_Failures++;
+        lock.unlock();
+        LogTuning(spdlog::level::err, "could not reload " + Path + ", keeping the current settings");
+        return false;
+    }
+    for (const std::string &Section : {ServerSection, ThreadPlacementSection})
+    {
+        if (Config.value(Section, json()) != Tuning.m_Config.value(Section, json()))
+        {
+            LogTuning(spdlog::level::warn, "changes to \"" + Section + "\" take effect after a restart");
+        }
+    }
+    // Startup only values keep what the server runs with, so Get stays truthful
+    json Applied = Config;
+    for (const std::string &Section : {ServerSection, ThreadPlacementSection})
+    {
+        Applied.erase(Section);
+        if (Tuning.m_Config.count(Section))
+        {
+            Applied[Section] = Tuning.m_Config[Section];
+        }
+    }
+    lock.unlock();
+
+    try
+    {
+        Tuning.Apply(Applied, false);
+    }
+    catch (const std::exception &Exc)
+    {
+        // Sections before the bad one may be applied already, Get keeps the previous file
+        lock.lock();
+        Tuning.m_Failures++;
+        lock.unlock();
+        LogTuning(spdlog::level::err, "could not apply " + Path + ": " + Exc.what() + ", keeping the previous file");
+        return false;
+    }
+    lock.lock();
+    Tuning.m_Config = Applied;
+    Tuning.m_Reloads++;
+    lock.unlock();
+    LogTuning(spdlog::level::info, "reloaded " + Path);
+    return true;
+}
+
+void TuningConfig::Apply(const json &Config, bool Startup)
+{
+    // First, a bad level is rejected before any other section changed
+    ApplyLogLevels(Config.value(LoggingSection, json()));
+    if (Startup && Config.count(ThreadPlacementSection))
+    {
+        ThreadPlacement::SetDefaults(Config[ThreadPlacementSection]);
+    }
+    if (Config.count(ProcessorPoolSection))
+    {
+        std::size_t Capacity = 0;
+        if (Config[ProcessorPoolSection].count(CapacityLabel))
+        {
+            fetch(Config[ProcessorPoolSection], CapacityLabel, Capacity);
+            ProcessorPool::SetCapacity(Capacity);
+        }
+        std::string PrewarmPath;
+        fetch(Config[ProcessorPoolSection], PrewarmLabel, PrewarmPath);
+        if (Startup && !PrewarmPath.empty())
+        {
+            ProcessorPool::Prewarm(PrewarmPath);
+        }
+    }
+    if (Config.count(SchedulingSection) && Config[SchedulingSection].count(SlotsLabel))
+    {
+        std::size_t Slots = 1;
+        fetch(Config[SchedulingSection], SlotsLabel, Slots);
+        FairScheduler::SetSlots(Slots);
+    }
+    if (Config.count(SchedulingSection) && Config[SchedulingSection].count(AgingMsLabel))
+    {
+        int64_t AgingMs = 0;
+        fetch(Config[SchedulingSection], AgingMsLabel, AgingMs);
+        FairScheduler::SetAging(std::chrono::milliseconds(AgingMs));
+    }
+    if (Config.count(AdmissionSection))
+    {
+        AdmissionController::SetLimits(Config[AdmissionSection]);
+    }
+    if (Config.count(MemorySection))
+    {
+        MemoryGovernor::SetBudget(Config[MemorySection]);
+    }
+    if (Config.count(SessionsSection))
+    {
+        SessionRegistry::SetResumption(Config[SessionsSection]);
+    }
+    if (Config.count(RecordingSection) && Config[RecordingSection].count(DirectoryLabel))
+    {
+        std::string Directory;
+        fetch(Config[RecordingSection], DirectoryLabel, Directory);
+        StreamRecorder::SetOutputDirectory(Directory);
+    }
+    if (Config.count(RecordingSection) && Config[RecordingSection].count(MaxQueuedBytesLabel))
+    {
+        std::size_t MaxQueuedBytes = 0;
+        fetch(Config[RecordingSection], MaxQueuedBytesLabel, MaxQueuedBytes);
+        StreamRecorder::SetMaxQueuedBytes(MaxQueuedBytes);
+    }
+    if (Config.count(ProtocolSection) && Config[ProtocolSection].count(MaxPayloadBytesLabel))
+    {
+        std::size_t MaxPayloadBytes = 0;
+        fetch(Config[ProtocolSection], MaxPayloadBytesLabel, MaxPayloadBytes);
+        MessageReader::SetMaxPayloadSize(MaxPayloadBytes);
+    }
+    if (Config.count(FanOutPoolSection))
+    {
+        FanOutPool::SetWorkers(Config[FanOutPoolSection]);
+    }
+    if (Config.count(TracingSection))
+    {
+        FrameTracer::SetTracing(Config[TracingSection]);
+    }
+    // batching, pipeline and flowControl are read through Get when a job starts
+}
+
+void TuningConfig::ApplyLogLevels()
+{
+    try
+    {
+        ApplyLogLevels(Get(LoggingSection));
+    }
+    catch (const std::exception &Exc)
+    {
+        LogTuning(spdlog::level::err, Exc.what());
+    }
+}
+
+void TuningConfig::ApplyLogLevels(const json &Logging)
+{
+    std::shared_ptr<spdlog::logger> Logger = spdlog::get("MainLogger");
+    if (!Logging.is_object())
+    {
+        return;
+    }
+    // Checked before anything changes, a bad sink level leaves the others alone too
+    const std::string Labels[] = {LevelLabel, ConsoleLevelLabel, FileLevelLabel};
+    std::string Levels[3];
+    for (std::size_t Index = 0; Index < 3; ++Index)
+    {
+        fetch(Logging, Labels[Index], Levels[Index]);
+        if (!Levels[Index].empty())
+        {
+            ParseLevel(Levels[Index]);
+        }
+    }
+    if (!Logger)
+    {
+        return;
+    }
+    if (!Levels[0].empty())
+    {
+        Logger->set_level(ParseLevel(Levels[0]));
+    }
+    // The server creates the logger with the console sink first and the file sink second
+    for (std::size_t Index = 0; Index < Logger->sinks().size() && Index < 2; ++Index)
+    {
+        if (!Levels[Index + 1].empty())
+        {
+            Logger->sinks()[Index]->set_level(ParseLevel(Levels[Index + 1]));
+        }
+    }
+}
+
+void TuningConfig::WatchSighup()
+{
+#ifdef SIGHUP
+    TuningConfig &Tuning = getInstance();
+    std::lock_guard<std::mutex> lock(Tuning.m_WatchMutex);
+    if (Tuning.m_WatchThread.joinable())
+    {
+        return;
+    }
+    std::signal(SIGHUP, OnSighup);
+    // Reloading allocates and locks, the handler only raises a flag for this thread
+    Tuning.m_WatchThread = std::thread(&TuningConfig::Watch, &Tuning);
+#endif
+}
+
+void TuningConfig::Watch()
+{
+    std::unique_lock<std::mutex> lock(m_WatchMutex);
+    while (!m_StopWatch)
+    {
+        m_ConVarWatch.wait_for(lock, SighupPollInterval);
+        if (s_ReloadRequested)
+        {
+            s_ReloadRequested = 0;
+            lock.unlock();
+            try
+            {
+                Reload();
+            }
+            catch (const std::exception &Exc)
+            {
+                // The next SIGHUP must still be served
+                LogTuning(spdlog::level::err, std::string("reload failed: ") + Exc.what());
+            }
+            lock.lock();
+        }
+    }
+}
+
+json TuningConfig::Get(const std::string &Section)
+{
+    TuningConfig &Tuning = getInstance();
+    std::lock_guard<std::mutex> lock(Tuning.m_Mutex);
+    if (!Tuning.m_Config.is_object())
+    {
+        return json();
+    }
+    return Tuning.m_Config.value(Section, json());
+}
+
+json TuningConfig::GetStats()
+{
+    TuningConfig &Tuning = getInstance();
+    std::lock_guard<std::mutex> lock(Tuning.m_Mutex);
+    json Stats;
+    Stats["path"] = Tuning.m_Path;
+    Stats["reloads"] = Tuning.m_Reloads;
+    Stats["reloadFailures"] = Tuning.m_Failures;
+    Stats["config"] = Tuning.m_Config;
+    return Stats;
+}
+} // namespace ProcessingUnit
@@ -10,6 +10,7 @@
 #include <fstream>
 
 #include "spdlog/spdlog.h"
+#include "thread_placement.hpp"
 
 using namespace std;
 using std::chrono::high_resolution_clock;
@@ -79,7 +80,8 @@ void VmsAgent::Reset()
 bool VmsAgent::start(
     const string &host,
     int port,
-    const string &endpoint_reg_ex)
+    const string &endpoint_reg_ex,
+    std::size_t io_threads)
 {
     // Some security checks around the port
     if (PortInUse(port))
@@ -92,18 +94,21 @@ bool VmsAgent::start(
 
     _server.config.address = host;
     _server.config.port = port;
+    _server.config.thread_pool_size = io_threads;
     //bool TeardownInitiated = false;
     auto &endpoint = _server.endpoint[endpoint_reg_ex];
 
     // Handle new connection
     endpoint.on_open = [this](shared_ptr<WsServer::Connection> connection) {
         //spdlog::get("MainLogger")->trace("Opened connection " + std::string(connection));
+        ThreadPlacement::PlaceIoThread();
         LogTraceVMS(std::string("Opened connection "), connection);
         m_ConnectionManager.OnOpen(connection);
     };
 
     // Handle incoming message
     endpoint.on_message = [&](shared_ptr<WsServer::Connection> connection, shared_ptr<WsServer::Message> message) {
+        ThreadPlacement::PlaceIoThread();
         LogTraceVMS(std::string(" OnMessage "));
 
         try
@@ -0,0 +1,70 @@
+/*!
+    pu_dispatcher: one websocket address in front of several processing units.
+    Clients connect to it as they would to a ProcessingUnitServer, every job is
+    relayed to the backend with the most room, see job_dispatcher.hpp.
+
+    pu_dispatcher <dispatcher.json>
+    pu_dispatcher --port <port> [--policy load|leastOutstanding] <host:port> [<host:port> ...]
+
+    To try it on one machine, start a few servers on ports 8081, 8082, ... and run
+    pu_dispatcher --port 8080 127.0.0.1:8081 127.0.0.1:8082
+*/
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "spdlog/spdlog.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+#include "job_dispatcher.hpp"
+
+using namespace ProcessingUnit;
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " <dispatcher.json>" << std::endl;
+        std::cerr << "       " << argv[0] << " --port <port> [--policy load|leastOutstanding] <host:port> [<host:port> ...]" << std::endl;
+        return 1;
+    }
+
+    json Config;
+    if (argc == 2 && std::string(argv[1]).find(':') == std::string::npos)
+    {
+        Config = loadJson(argv[1]);
+        if (!Config.is_object())
+        {
+            std::cerr << "couldn't read " << argv[1] << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        Config["backends"] = json::array();
+        for (int Arg = 1; Arg < argc; ++Arg)
+        {
+            const std::string Option(argv[Arg]);
+            if (Option == "--port" && Arg + 1 < argc)
+            {
+                Config["port"] = std::atoi(argv[++Arg]);
+            }
+            else if (Option == "--policy" && Arg + 1 < argc)
+            {
+                Config["policy"] = argv[++Arg];
+            }
+            else if (Option.compare(0, 2, "--") == 0)
+            {
+                std::cerr << "unknown option " << Option << std::endl;
+                return 1;
+            }
+            else
+            {
+                Config["backends"].push_back(Option);
+            }
+        }
+    }
+
+    spdlog::stdout_color_mt("MainLogger")->set_level(spdlog::level::info);
+    JobDispatcher Dispatcher(Config);
+    return Dispatcher.Start() ? 0 : 1;
+}
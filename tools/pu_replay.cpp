@@ -0,0 +1,62 @@
+/*!
+    pu_replay: replays a capture file recorded by the processing unit into a Job
+    without any network and prints throughput and latency as json.
+
+    pu_replay <capture.pucap> [--realtime] [--speed <factor>] [--loops <count>]
+
+    The tool answers every frame with an echo of its payload, so it measures the
+    framework overhead. To profile a processor, link it into your own binary,
+    register it and run a ReplaySession from there.
+*/
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "observables_resolver.hpp"
+#include "replay_session.hpp"
+
+using namespace ProcessingUnit;
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " <capture.pucap> [--realtime] [--speed <factor>] [--loops <count>]" << std::endl;
+        return 1;
+    }
+
+    ReplayOptions Options;
+    for (int Arg = 2; Arg < argc; ++Arg)
+    {
+        const std::string Option(argv[Arg]);
+        if (Option == "--realtime")
+        {
+            Options.RealTime = true;
+        }
+        else if (Option == "--speed" && Arg + 1 < argc)
+        {
+            Options.Speed = std::atof(argv[++Arg]);
+        }
+        else if (Option == "--loops" && Arg + 1 < argc)
+        {
+            Options.Loops = std::atoi(argv[++Arg]);
+        }
+        else
+        {
+            std::cerr << "unknown option " << Option << std::endl;
+            return 1;
+        }
+    }
+
+    // Echo processor on the observables
+    std::shared_ptr<IObservable> ResultObservable = ObservablesResolver::getProcessorResultObservable();
+    ObservablesResolver::getInputObservable()->subscribe([ResultObservable](ObserverDataMessage &Input) {
+        ObserverDataMessage Result(Input.message_payload);
+        ResultObservable->notify(Result);
+    });
+
+    ReplaySession Session(argv[1], Options);
+    const json Report = Session.Run();
+    std::cout << Report.dump(4) << std::endl;
+    return Report.count("error") ? 1 : 0;
+}
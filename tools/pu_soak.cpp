@@ -0,0 +1,520 @@
+/*!
+    pu_soak: runs a ProcessingUnitServer for hours against synthetic clients and fails
+    when the process keeps growing: resident memory, threads, open files or latency.
+
+    pu_soak [--duration <seconds>] [--clients <count>] [--port <port>] [--sample <seconds>]
+            [--warmup <seconds>] [--tolerance <fraction>] [--min-frame <bytes>] [--max-frame <bytes>]
+            [--frames <count>] [--abrupt <fraction>] [--tuning <tuning.json>]
+
+    Every client loops over short jobs: connect, Start, a random number of Data frames
+    of random size, then either End and a regular close or a dropped socket. Jobs run
+    an echo processor, so what is measured is the framework and not a model. No VMS
+    is needed, server and clients run in this process on 127.0.0.1.
+
+    A sample is taken every --sample seconds. After the warmup a least squares line is
+    fitted through every metric, a metric fails when that line rises over the run by
+    more than --tolerance of its mean and by more than a small absolute floor. The
+    report is printed as json, the exit code is 1 when any metric failed.
+
+    The process metrics come from /proc, so it runs on Linux.
+*/
+#include <client_ws.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+#include "processing_unit_server.hpp"
+#include "processor.hpp"
+#include "load_monitor.hpp"
+#include "osprey_ws_protocol.hpp"
+
+using namespace ProcessingUnit;
+
+typedef SimpleWeb::SocketClient<SimpleWeb::WS> WsClient;
+typedef std::chrono::steady_clock SoakClock;
+
+const std::string SoakProcessorName("soak_echo");
+// A job that takes longer than this is counted as stalled and its socket dropped
+const std::chrono::seconds SessionTimeout(60);
+
+struct SoakOptions
+{
+    double DurationSeconds = 3600;
+    int Clients = 8;
+    int Port = 18080;
+    double SampleSeconds = 10;
+    double WarmupSeconds = 60;
+    double Tolerance = 0.10;
+    std::size_t MinFrameBytes = 1024;
+    std::size_t MaxFrameBytes = 1024 * 1024;
+    int MaxFrames = 200;
+    double AbruptFraction = 0.2;
+    std::string TuningPath;
+};
+
+/*!
+    Counters shared by all clients, latencies are collected per sample window
+*/
+struct SoakCounters
+{
+    std::mutex Mutex;
+    std::vector<uint64_t> LatenciesUs;
+    std::atomic<uint64_t> Sessions{0};
+    std::atomic<uint64_t> AbruptCloses{0};
+    std::atomic<uint64_t> Refused{0};
+    std::atomic<uint64_t> Stalled{0};
+    std::atomic<uint64_t> Errors{0};
+    std::atomic<uint64_t> Frames{0};
+};
+
+class EchoProcessor : public IProcessor
+{
+public:
+    void Process(const DataPtr &Input, DataPtr &Output) override { Output = Input; }
+};
+
+template <class CertainMessageType>
+void SendTo(std::shared_ptr<WsClient::Connection> Conn, CertainMessageType &Msg)
+{
+    auto SendStream = std::make_shared<WsClient::SendStream>();
+    msgpack::pack(*SendStream, Msg);
+    // Final fragment of a binary message
+    Conn->send(SendStream, nullptr, 130);
+}
+
+/*!
+    One synthetic camera, runs one job after the other until told to stop. All
+    callbacks of a session run on the thread calling RunSession.
+*/
+class SoakClient
+{
+public:
+    SoakClient(int Id, const SoakOptions &Options, SoakCounters &Counters)
+        : m_Id(Id), m_Options(Options), m_Counters(Counters), m_Random(std::random_device{}() + Id) {}
+
+    void Run()
+    {
+        while (!m_Stopping)
+        {
+            RunSession();
+        }
+    }
+
+    // Drops the socket of a session that runs past the timeout
+    void AbortStalled()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_Client && SoakClock::now() - m_SessionStart > SessionTimeout)
+        {
+            m_Counters.Stalled++;
+            m_Client->stop();
+            m_Client = nullptr;
+        }
+    }
+
+    // Drops the current session and starts no new one
+    void Stop()
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stopping = true;
+        if (m_Client)
+        {
+            m_Client->stop();
+            m_Client = nullptr;
+        }
+    }
+
+private:
+    void RunSession()
+    {
+        m_FramesLeft = std::uniform_int_distribution<int>(1, std::max(m_Options.MaxFrames, 1))(m_Random);
+        m_Abrupt = std::bernoulli_distribution(m_Options.AbruptFraction)(m_Random);
+        m_DropAfter = std::uniform_int_distribution<int>(0, m_FramesLeft)(m_Random);
+        m_Credits = 0;
+        m_Sent = 0;
+        m_EndSent = false;
+        m_InFlight.clear();
+
+        WsClient Client("127.0.0.1:" + std::to_string(m_Options.Port) + "/");
+        Client.on_open = [this](std::shared_ptr<WsClient::Connection> Conn) {
+            StartMessage Start("soak-" + std::to_string(m_Id) + "-" + std::to_string(m_Session++), json{{"processor", SoakProcessorName}});
+            SendTo(Conn, Start);
+        };
+        Client.on_message = [this, &Client](std::shared_ptr<WsClient::Connection> Conn, std::shared_ptr<WsClient::InMessage> Message) {
+            OnMessage(Client, Conn, Message->string());
+        };
+        Client.on_error = [this](std::shared_ptr<WsClient::Connection>, const SimpleWeb::error_code &) {
+            m_Counters.Errors++;
+        };
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            if (m_Stopping)
+            {
+                return;
+            }
+            m_Client = &Client;
+            m_SessionStart = SoakClock::now();
+        }
+        Client.start();
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Client = nullptr;
+    }
+
+    void OnMessage(WsClient &Client, std::shared_ptr<WsClient::Connection> Conn, const std::string &Bytes)
+    {
+        MessageReader Reader;
+        if (!Reader.Parse(Bytes))
+        {
+            m_Counters.Errors++;
+            return;
+        }
+        switch (Reader.GetMessageType())
+        {
+        case Message::Ready:
+            if (!Reader.GetReadyMessage()->IsReady())
+            {
+                m_Counters.Refused++;
+                Conn->send_close(1000);
+                return;
+            }
+            m_Credits = 1;
+            SendFrames(Client, Conn);
+            break;
+        case Message::Continue:
+            m_Credits++;
+            SendFrames(Client, Conn);
+            break;
+        case Message::Data:
+        {
+            if (!m_InFlight.empty())
+            {
+                const uint64_t LatencyUs = std::chrono::duration_cast<std::chrono::microseconds>(SoakClock::now() - m_InFlight.front()).count();
+                m_InFlight.erase(m_InFlight.begin());
+                std::lock_guard<std::mutex> lock(m_Counters.Mutex);
+                m_Counters.LatenciesUs.push_back(LatencyUs);
+            }
+            m_Counters.Frames++;
+            ContinueMessage Continue;
+            SendTo(Conn, Continue);
+            SendFrames(Client, Conn);
+            break;
+        }
+        case Message::End:
+            m_Counters.Sessions++;
+            Conn->send_close(1000);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void SendFrames(WsClient &Client, std::shared_ptr<WsClient::Connection> Conn)
+    {
+        if (m_Abrupt && m_Sent >= m_DropAfter)
+        {
+            // Gone without End or close frame, like a camera losing power
+            m_Counters.AbruptCloses++;
+            m_Counters.Sessions++;
+            Client.stop();
+            return;
+        }
+        while (m_Credits > 0 && m_FramesLeft > 0)
+        {
+            const std::size_t Size = std::uniform_int_distribution<std::size_t>(
+                m_Options.MinFrameBytes, std::max(m_Options.MinFrameBytes, m_Options.MaxFrameBytes))(m_Random);
+            DataMessage Data("", std::vector<char>(Size, char(m_Sent)));
+            m_InFlight.push_back(SoakClock::now());
+            SendTo(Conn, Data);
+            m_Credits--;
+            m_FramesLeft--;
+            m_Sent++;
+        }
+        if (m_FramesLeft == 0 && m_InFlight.empty() && !m_EndSent)
+        {
+            EndMessage End;
+            SendTo(Conn, End);
+            m_EndSent = true;
+        }
+    }
+
+    const int m_Id;
+    const SoakOptions &m_Options;
+    SoakCounters &m_Counters;
+    std::mt19937 m_Random;
+    uint64_t m_Session = 0;
+
+    int m_FramesLeft = 0;
+    int m_Credits = 0;
+    int m_Sent = 0;
+    int m_DropAfter = 0;
+    bool m_Abrupt = false;
+    bool m_EndSent = false;
+    std::vector<SoakClock::time_point> m_InFlight;
+
+    // Guards the client pointer and the stop flag for the sampling thread
+    std::mutex m_Mutex;
+    std::atomic<bool> m_Stopping{false};
+    WsClient *m_Client = nullptr;
+    SoakClock::time_point m_SessionStart;
+};
+
+struct SoakSample
+{
+    double Seconds;
+    json Values;
+};
+
+uint64_t Percentile(std::vector<uint64_t> &Values, double Fraction)
+{
+    if (Values.empty())
+    {
+        return 0;
+    }
+    const std::size_t Index = std::min(Values.size() - 1, std::size_t(Fraction * Values.size()));
+    std::nth_element(Values.begin(), Values.begin() + Index, Values.end());
+    return Values[Index];
+}
+
+/*!
+    Least squares line through the samples after the warmup, fails on a rise beyond
+    Tolerance of the mean that is also larger than Floor
+*/
+json Trend(const std::vector<SoakSample> &Samples, const std::string &Metric, double WarmupSeconds, double Tolerance, double Floor)
+{
+    std::vector<std::pair<double, double>> Points;
+    for (const SoakSample &Sample : Samples)
+    {
+        if (Sample.Seconds >= WarmupSeconds && Sample.Values.count(Metric) && !Sample.Values[Metric].is_null())
+        {
+            Points.emplace_back(Sample.Seconds, Sample.Values[Metric].get<double>());
+        }
+    }
+
+    json Result;
+    Result["samples"] = Points.size();
+    if (Points.size() < 3)
+    {
+        Result["failed"] = false;
+        Result["note"] = "not enough samples after the warmup";
+        return Result;
+    }
+
+    double MeanT = 0, MeanV = 0;
+    for (const auto &Point : Points)
+    {
+        MeanT += Point.first;
+        MeanV += Point.second;
+    }
+    MeanT /= Points.size();
+    MeanV /= Points.size();
+    double Covariance = 0, Variance = 0;
+    for (const auto &Point : Points)
+    {
+        Covariance += (Point.first - MeanT) * (Point.second - MeanV);
+        Variance += (Point.first - MeanT) * (Point.first - MeanT);
+    }
+    const double Slope = Variance > 0 ? Covariance / Variance : 0;
+    const double Rise = Slope * (Points.back().first - Points.front().first);
+
+    Result["first"] = Points.front().second;
+    Result["last"] = Points.back().second;
+    Result["mean"] = MeanV;
+    Result["slopePerHour"] = Slope * 3600;
+    Result["rise"] = Rise;
+    Result["failed"] = Rise > Floor && Rise > Tolerance * MeanV;
+    return Result;
+}
+
+bool ParseOptions(int argc, char **argv, SoakOptions &Options)
+{
+    for (int Arg = 1; Arg < argc; ++Arg)
+    {
+        const std::string Option(argv[Arg]);
+        if (Arg + 1 >= argc)
+        {
+            std::cerr << "missing value for " << Option << std::endl;
+            return false;
+        }
+        const char *Value = argv[++Arg];
+        if (Option == "--duration")
+        {
+            Options.DurationSeconds = std::atof(Value);
+        }
+        else if (Option == "--clients")
+        {
+            Options.Clients = std::max(std::atoi(Value), 1);
+        }
+        else if (Option == "--port")
+        {
+            Options.Port = std::atoi(Value);
+        }
+        else if (Option == "--sample")
+        {
+            Options.SampleSeconds = std::max(std::atof(Value), 0.1);
+        }
+        else if (Option == "--warmup")
+        {
+            Options.WarmupSeconds = std::atof(Value);
+        }
+        else if (Option == "--tolerance")
+        {
+            Options.Tolerance = std::atof(Value);
+        }
+        else if (Option == "--min-frame")
+        {
+            Options.MinFrameBytes = std::strtoull(Value, nullptr, 10);
+        }
+        else if (Option == "--max-frame")
+        {
+            Options.MaxFrameBytes = std::strtoull(Value, nullptr, 10);
+        }
+        else if (Option == "--frames")
+        {
+            Options.MaxFrames = std::atoi(Value);
+        }
+        else if (Option == "--abrupt")
+        {
+            Options.AbruptFraction = std::min(std::max(std::atof(Value), 0.0), 1.0);
+        }
+        else if (Option == "--tuning")
+        {
+            Options.TuningPath = Value;
+        }
+        else
+        {
+            std::cerr << "unknown option " << Option << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    SoakOptions Options;
+    if (!ParseOptions(argc, argv, Options))
+    {
+        std::cerr << "usage: " << argv[0] << " [--duration <seconds>] [--clients <count>] [--port <port>] [--sample <seconds>]" << std::endl
+                  << "       [--warmup <seconds>] [--tolerance <fraction>] [--min-frame <bytes>] [--max-frame <bytes>]" << std::endl
+                  << "       [--frames <count>] [--abrupt <fraction>] [--tuning <tuning.json>]" << std::endl;
+        return 1;
+    }
+
+    ProcessorRegistry::Register(SoakProcessorName, [](const json &) { return std::make_shared<EchoProcessor>(); });
+
+    ProcessingUnitServer Server(Options.Port);
+    if (!Options.TuningPath.empty() && !Server.LoadTuningConfig(Options.TuningPath))
+    {
+        std::cerr << "couldn't load " << Options.TuningPath << std::endl;
+        return 1;
+    }
+    std::thread ServerThread([&Server] { Server.StartProcessingUnitServer(); });
+    // Give the server time to create its logger and open the port
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    if (spdlog::get("MainLogger") && Options.TuningPath.empty())
+    {
+        // The server logs every message at trace level, a soak only needs its warnings
+        spdlog::get("MainLogger")->set_level(spdlog::level::warn);
+    }
+
+    SoakCounters Counters;
+    std::vector<std::unique_ptr<SoakClient>> Clients;
+    std::vector<std::thread> ClientThreads;
+    for (int Id = 0; Id < Options.Clients; ++Id)
+    {
+        Clients.emplace_back(new SoakClient(Id, Options, Counters));
+        SoakClient *Client = Clients.back().get();
+        ClientThreads.emplace_back([Client] { Client->Run(); });
+    }
+
+    std::vector<SoakSample> Samples;
+    const auto Begin = SoakClock::now();
+    const auto Sampling = std::chrono::duration_cast<SoakClock::duration>(std::chrono::duration<double>(Options.SampleSeconds));
+    auto NextSample = Begin + Sampling;
+    while (true)
+    {
+        std::this_thread::sleep_until(NextSample);
+        NextSample += Sampling;
+        const double Seconds = std::chrono::duration<double>(SoakClock::now() - Begin).count();
+
+        for (auto &Client : Clients)
+        {
+            Client->AbortStalled();
+        }
+
+        std::vector<uint64_t> Latencies;
+        {
+            std::lock_guard<std::mutex> lock(Counters.Mutex);
+            Latencies.swap(Counters.LatenciesUs);
+        }
+        SoakSample Sample;
+        Sample.Seconds = Seconds;
+        Sample.Values["residentBytes"] = LoadMonitor::GetResidentBytes();
+        Sample.Values["threads"] = LoadMonitor::GetProcessThreads();
+        Sample.Values["openFiles"] = LoadMonitor::GetOpenFiles();
+        Sample.Values["frames"] = Latencies.size();
+        if (!Latencies.empty())
+        {
+            Sample.Values["latencyP50Us"] = Percentile(Latencies, 0.50);
+            Sample.Values["latencyP99Us"] = Percentile(Latencies, 0.99);
+        }
+        Samples.push_back(Sample);
+        std::cerr << "[" << int(Seconds) << "s] " << Sample.Values.dump() << std::endl;
+
+        if (Seconds >= Options.DurationSeconds)
+        {
+            break;
+        }
+    }
+
+    for (auto &Client : Clients)
+    {
+        Client->Stop();
+    }
+    for (std::thread &Thread : ClientThreads)
+    {
+        Thread.join();
+    }
+    Server.StopProcessingUnitServer();
+    ServerThread.join();
+
+    // Floors keep noise from failing short runs: a few MB of allocator slack, a pool thread, ...
+    json Trends;
+    Trends["residentBytes"] = Trend(Samples, "residentBytes", Options.WarmupSeconds, Options.Tolerance, 16.0 * 1024 * 1024);
+    Trends["threads"] = Trend(Samples, "threads", Options.WarmupSeconds, Options.Tolerance, 2);
+    Trends["openFiles"] = Trend(Samples, "openFiles", Options.WarmupSeconds, Options.Tolerance, 4);
+    Trends["latencyP50Us"] = Trend(Samples, "latencyP50Us", Options.WarmupSeconds, Options.Tolerance, 500);
+    Trends["latencyP99Us"] = Trend(Samples, "latencyP99Us", Options.WarmupSeconds, Options.Tolerance, 2000);
+
+    bool Failed = false;
+    json FailedMetrics = json::array();
+    for (auto Iter = Trends.begin(); Iter != Trends.end(); ++Iter)
+    {
+        if (Iter.value()["failed"].get<bool>())
+        {
+            Failed = true;
+            FailedMetrics.push_back(Iter.key());
+        }
+    }
+
+    json Report;
+    Report["durationSeconds"] = std::chrono::duration<double>(SoakClock::now() - Begin).count();
+    Report["sessions"] = Counters.Sessions.load();
+    Report["abruptCloses"] = Counters.AbruptCloses.load();
+    Report["refused"] = Counters.Refused.load();
+    Report["stalled"] = Counters.Stalled.load();
+    Report["errors"] = Counters.Errors.load();
+    Report["frames"] = Counters.Frames.load();
+    Report["trends"] = Trends;
+    Report["failed"] = FailedMetrics;
+    std::cout << Report.dump(4) << std::endl;
+    return Failed ? 1 : 0;
+}